@@ -0,0 +1 @@
+../lib/aggregate.c
\ No newline at end of file
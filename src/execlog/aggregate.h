@@ -0,0 +1 @@
+../lib/aggregate.h
\ No newline at end of file
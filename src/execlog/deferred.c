@@ -0,0 +1 @@
+../lib/deferred.c
\ No newline at end of file
@@ -0,0 +1 @@
+../lib/exe_identity.h
\ No newline at end of file
@@ -5,6 +5,9 @@
 #include <linux/tty.h>
 #include <linux/version.h>
 #include "execlog.h"
+#include "aggregate.h"
+#include "path_cache.h"
+#include "prefilter.h"
 #include "probes.h"
 #include "whitelist.h"
 
@@ -18,13 +21,25 @@ static int __init execlog_init(void)
 
 	pr_info("Light monitoring tool for execve by CERN Security Team\n");
 
+	err = whitelist_device_register();
+	if (err != 0)
+		goto free_params;
+
 	err = probes_plant();
 	if (err < 0) {
-		destroy_whitelist();
-		return err;
+		whitelist_device_unregister();
+		goto free_params;
 	}
 	pr_info("[+] "MODULE_NAME" version "MOD_VER" deployed\n");
 	return 0;
+
+free_params:
+	/* Parameters given at load time were already applied */
+	destroy_whitelist();
+	destroy_prefilter();
+	aggregate_destroy();
+	path_cache_destroy();
+	return err;
 }
 
 /************************************/
@@ -34,7 +49,10 @@ static int __init execlog_init(void)
 static void __exit execlog_exit(void)
 {
 	probes_unplant();
+	whitelist_device_unregister();
 	destroy_whitelist();
+	destroy_prefilter();
+	aggregate_destroy();
 }
 
 
@@ -60,6 +78,25 @@ module_param_cb(whitelist_include_root, &whitelist_root_param, NULL, 0600);
 MODULE_PARM_DESC(whitelist_include_root, "A boolean indicating if root actions"
 		 " should be whitelisted like actions from other users or not.");
 
+# if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(prefilter, &prefilter_param_set, &prefilter_param_get, NULL, 0600);
+module_param_call(prefilter_stats, &prefilter_stats_param_set, &prefilter_stats_param_get, NULL, 0400);
+# else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(prefilter, &prefilter_param, NULL, 0600);
+module_param_cb(prefilter_stats, &prefilter_stats_param, NULL, 0400);
+# endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(prefilter, " A coma separated list of rules dropping executions"
+		 " before their path or arguments are looked at. A rule is a '|'"
+		 " separated list of fields which must all match: 'u<uid[-max]>',"
+		 " 'e<euid[-max]>', 'c<cgroup id>' (Linux 4.18 and later),"
+		 " 'x<path of the parent executable>', resolved when set and not"
+		 " after the executable is replaced. 'e' sees the euid before the"
+		 " execution with the kprobe backend, after it (setuid applied) with"
+		 " the tracepoint backend. Executions by root are only"
+		 " dropped when whitelist_include_root is set.");
+MODULE_PARM_DESC(prefilter_stats, " Number of executions dropped by the prefilter,"
+		 " and by root but kept");
+
 #define STR_HELPER(x) #x
 #define STR(x) STR_HELPER(x)
 
@@ -72,6 +109,46 @@ MODULE_PARM_DESC(argv_max_size, "An unsigned integer controling the truncation"
                  "of the argv. Must be between " STR(ARGV_MIN_SIZE) " and "
                  STR(ARGV_MAX_SIZE) ".");
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(backend, &backend_param_set, &backend_param_get, NULL, 0444);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(backend, &backend_param, NULL, 0444);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(backend, "How executions are captured, set at load time:"
+		 " 'kprobe' (default) or 'tracepoint' (sched_process_exec,"
+		 " Linux 3.4 and later, also sees execveat). For scripts, the"
+		 " kprobe backend logs and whitelists the script with the arguments"
+		 " of execve, the tracepoint backend the interpreter with the"
+		 " arguments it received.");
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(interpreter_chain, &interpreter_chain_param_set, &interpreter_chain_param_get, NULL, 0600);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(interpreter_chain, &interpreter_chain_param, NULL, 0600);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(interpreter_chain, "A boolean indicating if the interpreter of"
+		 " scripts is logged with their path, as 'script -> interpreter'"
+		 " (default to false).");
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(deferred, &deferred_param_set, &deferred_param_get, NULL, 0600);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(deferred, &deferred_param, NULL, 0600);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(deferred, "A boolean indicating if executions are logged by"
+		 " their task before it returns to userspace, where all the"
+		 " arguments can be read, instead of from the probes"
+		 " (Linux 3.7 and later, default to false).");
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(execve_stats, &execve_stats_param_set, &execve_stats_param_get, NULL, 0400);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(execve_stats, &execve_stats_param, NULL, 0400);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(execve_stats, "Statistics of the execve contexts lookups"
+		 " (lookups, contexts compared, contended bucket locks and"
+		 " calls for interpreters, ignored)");
+
 /************************************/
 /*             MODULE DEF           */
 /************************************/
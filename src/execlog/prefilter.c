@@ -0,0 +1,524 @@
+#include <linux/cgroup.h>
+#include <linux/cred.h>
+#include <linux/err.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+#include "prefilter.h"
+#include "execlog.h"
+#include "exe_identity.h"
+#include "whitelist.h"
+#include "sparse_compat.h"
+
+/* Maximum number of rules */
+#define PREFILTER_MAX_RULES 64
+
+/* Fields of a rule, all the fields set must match */
+#define PF_UID    (1 << 0)
+#define PF_EUID   (1 << 1)
+#define PF_CGROUP (1 << 2)
+#define PF_PARENT (1 << 3)
+
+/* cgroup v2 ids, as seen by bpf_get_current_cgroup_id() */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 18, 0) && defined(CONFIG_CGROUPS)
+#define PREFILTER_CGROUP
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 18, 0) && CONFIG_CGROUPS */
+
+struct prefilter_rule {
+	unsigned int fields        /** PF_* fields set */;
+	u32 uid[2]                 /** Range of real UIDs, bounds included */;
+	u32 euid[2]                /** Range of effective UIDs, bounds included */;
+	u64 cgroup                 /** Id of the cgroup (v2) */;
+	struct exe_identity parent /** Executable of the parent */;
+	const char *parent_path    /** Path of the executable of the parent */;
+};
+
+struct prefilter {
+	size_t nr_rules;
+	unsigned int fields      /** Union of the fields of all the rules */;
+	char *raw                /** Rules as set, for the parameter */;
+	char *parsed             /** Copy of 'raw' split by the parser, holds the paths */;
+	unsigned long resolve_after /** No resolution is requested by probes before (jiffies) */;
+	bool settled             /** The paths resolve to the identities of the rules */;
+	struct prefilter_rule rules[];
+};
+
+/* Current rules, NULL if none. Probes only read them under rcu_read_lock */
+static struct prefilter __rcu *prefilter = NULL;
+
+/* Only one update at a time */
+static DEFINE_MUTEX(prefilter_lock);
+
+struct prefilter_stats {
+	unsigned long rejected   /** Executions dropped */;
+	unsigned long root       /** Executions by root kept despite a matching rule */;
+};
+
+static DEFINE_PER_CPU(struct prefilter_stats, prefilter_stats);
+
+/**********************************/
+/*           Matching             */
+/**********************************/
+
+static inline bool
+prefilter_in_range(const u32 *range, u32 value)
+{
+	return value >= range[0] && value <= range[1];
+}
+
+#ifdef PREFILTER_CGROUP
+/* Must be called under rcu_read_lock */
+static u64
+prefilter_cgroup_of_current(void)
+{
+	struct cgroup *cgrp = task_dfl_cgroup(current);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 5, 0)
+	return cgroup_id(cgrp);
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(5, 5, 0) */
+	return cgrp->kn->id.id;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(5, 5, 0) */
+}
+#endif /* PREFILTER_CGROUP */
+
+/* Executable of the parent of 'current', must be called under rcu_read_lock */
+static void
+prefilter_parent_of_current(struct exe_identity *id)
+{
+	exe_identity_of_task(id, rcu_dereference(current->real_parent));
+}
+
+bool
+prefilter_reject(void)
+{
+	const struct prefilter *filter;
+	const struct prefilter_rule *rule;
+	const struct cred *cred;
+	struct exe_identity parent;
+	u32 uid, euid;
+	u64 cgroup = 0;
+	bool matched = false;
+	size_t i;
+
+	rcu_read_lock();
+	filter = rcu_dereference(prefilter);
+	if (likely(filter == NULL))
+		goto out;
+
+	cred = current_cred();
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 5, 0)
+	uid = cred->uid.val;
+	euid = cred->euid.val;
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 5, 0) */
+	uid = cred->uid;
+	euid = cred->euid;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 5, 0) */
+
+	/* Only look at what the rules need */
+#ifdef PREFILTER_CGROUP
+	if (filter->fields & PF_CGROUP)
+		cgroup = prefilter_cgroup_of_current();
+#endif /* PREFILTER_CGROUP */
+	if (filter->fields & PF_PARENT)
+		prefilter_parent_of_current(&parent);
+	else
+		exe_identity_clear(&parent);
+
+	for (i = 0; i < filter->nr_rules && !matched; ++i) {
+		rule = &filter->rules[i];
+		if ((rule->fields & PF_UID) && !prefilter_in_range(rule->uid, uid))
+			continue;
+		if ((rule->fields & PF_EUID) && !prefilter_in_range(rule->euid, euid))
+			continue;
+		if ((rule->fields & PF_CGROUP) && rule->cgroup != cgroup)
+			continue;
+		if ((rule->fields & PF_PARENT) &&
+		    !exe_identity_equal(&rule->parent, &parent))
+			continue;
+		matched = true;
+	}
+
+out:
+	rcu_read_unlock();
+	if (!matched)
+		return false;
+
+	/* Same as the whitelist */
+	if (!whitelist_applies()) {
+		this_cpu_inc(prefilter_stats.root);
+		return false;
+	}
+	this_cpu_inc(prefilter_stats.rejected);
+	return true;
+}
+
+/*
+ * 'x' fields are matched on the identity of the parent, resolved from their
+ * path when the rules are set. As for the whitelist, an execution with the
+ * path of such a field but another identity means that the file was
+ * replaced: the rules are parsed again from a work item, at most once per
+ * second. If the paths still resolve to the same identities, the execution
+ * ran another file with the same path (chroot, container, mount namespace):
+ * the rules are settled and never requested again.
+ */
+static void prefilter_resolve(struct work_struct *work);
+static DECLARE_WORK(prefilter_resolve_work, prefilter_resolve);
+
+void
+prefilter_exe_seen(const struct exe_identity *id, const char *path)
+{
+	struct prefilter *filter;
+	const struct prefilter_rule *rule;
+	size_t i;
+
+	if (path == NULL)
+		return;
+
+	rcu_read_lock();
+	filter = rcu_dereference(prefilter);
+	if (likely(filter == NULL || !(filter->fields & PF_PARENT)))
+		goto out;
+	if (READ_ONCE(filter->settled) ||
+	    time_before(jiffies, READ_ONCE(filter->resolve_after)))
+		goto out;
+
+	for (i = 0; i < filter->nr_rules; ++i) {
+		rule = &filter->rules[i];
+		if (!(rule->fields & PF_PARENT) ||
+		    exe_identity_equal(&rule->parent, id) ||
+		    strcmp(rule->parent_path, path) != 0)
+			continue;
+		WRITE_ONCE(filter->resolve_after, jiffies + HZ);
+		schedule_work(&prefilter_resolve_work);
+		break;
+	}
+
+out:
+	rcu_read_unlock();
+}
+
+/**********************************/
+/*            Parsing             */
+/**********************************/
+
+/* Parse 'value' or 'low-high' */
+static int
+prefilter_parse_range(char *str, u32 *range)
+{
+	char *high;
+	int ret;
+
+	high = strchr(str, '-');
+	if (high != NULL)
+		*high++ = '\0';
+	ret = kstrtou32(str, 0, &range[0]);
+	if (ret != 0)
+		return ret;
+	if (high == NULL)
+		range[1] = range[0];
+	else if ((ret = kstrtou32(high, 0, &range[1])) != 0)
+		return ret;
+	return (range[0] > range[1]) ? -EINVAL : 0;
+}
+
+/* Parse 'key<value>|key<value>...', might sleep */
+static int
+prefilter_parse_rule(char *str, struct prefilter_rule *rule)
+{
+	char *field, *value;
+	size_t len;
+	unsigned int bit;
+	int ret = 0;
+
+	memset(rule, 0, sizeof(*rule));
+	while ((field = strsep(&str, "|")) != NULL) {
+		if (field[0] == '\0' || field[1] == '\0')
+			return -EINVAL;
+		value = field + 1;
+		if (*value == '<')
+			++value;
+		len = strlen(value);
+		if (len > 0 && value[len - 1] == '>')
+			value[--len] = '\0';
+		if (len == 0)
+			return -EINVAL;
+
+		switch (field[0]) {
+		case 'u':
+			bit = PF_UID;
+			ret = prefilter_parse_range(value, rule->uid);
+			break;
+		case 'e':
+			bit = PF_EUID;
+			ret = prefilter_parse_range(value, rule->euid);
+			break;
+		case 'c':
+			bit = PF_CGROUP;
+#ifdef PREFILTER_CGROUP
+			ret = kstrtou64(value, 0, &rule->cgroup);
+			if (ret == 0 && rule->cgroup == 0)
+				ret = -EINVAL;
+#else /* !PREFILTER_CGROUP */
+			ret = -EINVAL;
+#endif /* PREFILTER_CGROUP */
+			break;
+		case 'x':
+			/* Resolved again by prefilter_resolve if replaced */
+			bit = PF_PARENT;
+			rule->parent_path = value;
+			ret = exe_identity_resolve(&rule->parent, value);
+			if (ret != 0)
+				pr_err("[-] Cannot resolve prefilter parent %s: %d\n",
+				       value, ret);
+			else if (!exe_identity_known(&rule->parent))
+				ret = -ENOENT;
+			break;
+		default:
+			return -EINVAL;
+		}
+		if (ret != 0)
+			return ret;
+		if (rule->fields & bit)
+			return -EINVAL;
+		rule->fields |= bit;
+	}
+
+	/* A rule without any field would drop everything */
+	return (rule->fields == 0) ? -EINVAL : 0;
+}
+
+static void
+prefilter_free(struct prefilter *filter)
+{
+	if (filter == NULL)
+		return;
+	kfree(filter->raw);
+	kfree(filter->parsed);
+	kfree(filter);
+}
+
+/* Parse the rules in 'buf', NULL if there are none. Might sleep */
+static struct prefilter *
+prefilter_build(const char *buf)
+{
+	struct prefilter *filter;
+	char *pos, *raw;
+	size_t nr_rules = 0;
+	int ret;
+
+	filter = kzalloc(sizeof(*filter) + PREFILTER_MAX_RULES * sizeof(filter->rules[0]),
+			 GFP_KERNEL);
+	if (filter != NULL) {
+		filter->raw = kstrdup(buf, GFP_KERNEL);
+		filter->parsed = kstrdup(buf, GFP_KERNEL);
+	}
+	if (unlikely(filter == NULL || filter->raw == NULL || filter->parsed == NULL)) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+	filter->resolve_after = jiffies;
+
+	pos = filter->parsed;
+	while ((raw = strsep(&pos, ",\n")) != NULL) {
+		if (*raw == '\0')
+			continue;
+		if (nr_rules == PREFILTER_MAX_RULES) {
+			pr_err("[-] Too many prefilter rules (max %d)\n", PREFILTER_MAX_RULES);
+			ret = -E2BIG;
+			goto fail;
+		}
+		ret = prefilter_parse_rule(raw, &filter->rules[nr_rules]);
+		if (ret != 0) {
+			pr_err("[-] Invalid prefilter rule %zu\n", nr_rules + 1);
+			goto fail;
+		}
+		filter->fields |= filter->rules[nr_rules].fields;
+		++nr_rules;
+	}
+
+	if (nr_rules == 0) {
+		prefilter_free(filter);
+		return NULL;
+	}
+	filter->nr_rules = nr_rules;
+	return filter;
+
+fail:
+	prefilter_free(filter);
+	return ERR_PTR(ret);
+}
+
+/* Install new rules, NULL for none, and free the previous ones */
+static void
+prefilter_swap(struct prefilter *filter)
+{
+	struct prefilter *old;
+
+	mutex_lock(&prefilter_lock);
+	old = rcu_dereference_protected(prefilter, lockdep_is_held(&prefilter_lock));
+	rcu_assign_pointer(prefilter, filter);
+	mutex_unlock(&prefilter_lock);
+
+	synchronize_rcu();
+	prefilter_free(old);
+}
+
+static bool
+prefilter_same_parents(const struct prefilter *a, const struct prefilter *b)
+{
+	const struct exe_identity *id_a, *id_b;
+	size_t i;
+
+	for (i = 0; i < a->nr_rules; ++i) {
+		id_a = &a->rules[i].parent;
+		id_b = &b->rules[i].parent;
+		if (id_a->dev != id_b->dev || id_a->ino != id_b->ino ||
+		    id_a->generation != id_b->generation)
+			return false;
+	}
+	return true;
+}
+
+/* Parse the current rules again, requested by probes */
+static void
+prefilter_resolve(struct work_struct *work)
+{
+	struct prefilter *filter, *old;
+
+	mutex_lock(&prefilter_lock);
+	old = rcu_dereference_protected(prefilter, lockdep_is_held(&prefilter_lock));
+	if (old == NULL) {
+		mutex_unlock(&prefilter_lock);
+		return;
+	}
+
+	/* Same string, same rules: only the identities can differ */
+	filter = prefilter_build(old->raw);
+	if (IS_ERR_OR_NULL(filter)) {
+		/* A file missing for now, probes will ask again */
+		mutex_unlock(&prefilter_lock);
+		pr_err("[-] Failed to resolve the prefilter rules again\n");
+		return;
+	}
+	if (prefilter_same_parents(old, filter)) {
+		WRITE_ONCE(old->settled, true);
+		mutex_unlock(&prefilter_lock);
+		prefilter_free(filter);
+		return;
+	}
+	rcu_assign_pointer(prefilter, filter);
+	mutex_unlock(&prefilter_lock);
+
+	pr_info("[+] Prefilter parents resolved again\n");
+	synchronize_rcu();
+	prefilter_free(old);
+}
+
+void
+destroy_prefilter(void)
+{
+	/* No execution can request it anymore */
+	cancel_work_sync(&prefilter_resolve_work);
+	prefilter_swap(NULL);
+}
+
+/**********************************/
+/*      Module parameters         */
+/**********************************/
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+prefilter_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+prefilter_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	struct prefilter *filter;
+
+	if (buf == NULL)
+		return -EINVAL;
+
+	filter = prefilter_build(buf);
+	if (IS_ERR(filter))
+		return PTR_ERR(filter);
+
+	prefilter_swap(filter);
+	pr_info("[+] %zu prefilter rules applied\n",
+		(filter == NULL) ? (size_t)0 : filter->nr_rules);
+	return 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+prefilter_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+prefilter_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	const struct prefilter *filter;
+	int ret;
+
+	mutex_lock(&prefilter_lock);
+	filter = rcu_dereference_protected(prefilter, lockdep_is_held(&prefilter_lock));
+	ret = scnprintf(buffer, PAGE_SIZE, "%s", (filter == NULL) ? "" : filter->raw);
+	mutex_unlock(&prefilter_lock);
+
+	return ret;
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+const struct kernel_param_ops prefilter_param = {
+	.set = prefilter_param_set,
+	.get = prefilter_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+prefilter_stats_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+prefilter_stats_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return -EPERM;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+prefilter_stats_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+prefilter_stats_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	struct prefilter_stats total = { 0 };
+	const struct prefilter_stats *stats;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		stats = per_cpu_ptr(&prefilter_stats, cpu);
+		total.rejected += READ_ONCE(stats->rejected);
+		total.root += READ_ONCE(stats->root);
+	}
+
+	return scnprintf(buffer, PAGE_SIZE, "rejected:%lu root:%lu",
+			 total.rejected, total.root);
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+const struct kernel_param_ops prefilter_stats_param = {
+	.set = prefilter_stats_param_set,
+	.get = prefilter_stats_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
@@ -0,0 +1,40 @@
+#ifndef __EXECLOG_PREFILTER__
+#define __EXECLOG_PREFILTER__
+
+#include <linux/moduleparam.h>
+#include <linux/types.h>
+#include <linux/version.h>
+#include "exe_identity.h"
+
+/*
+ * Rules dropping executions before their path or arguments are looked at,
+ * from the credentials, the cgroup and the parent of 'current' only.
+ */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int prefilter_param_set(const char *buf, struct kernel_param *kp);
+int prefilter_param_get(char *buffer, struct kernel_param *kp);
+int prefilter_stats_param_set(const char *buf, struct kernel_param *kp);
+int prefilter_stats_param_get(char *buffer, struct kernel_param *kp);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+extern const struct kernel_param_ops prefilter_param;
+extern const struct kernel_param_ops prefilter_stats_param;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+
+/*
+ * Can be called from probes. Return true if a rule drops the execution.
+ * Like the whitelist, rules never drop executions by root unless
+ * whitelist_include_root is set.
+ */
+bool prefilter_reject(void);
+
+/*
+ * Can be called from probes, with the executable of an execution that was
+ * not dropped. Requests the 'x' fields to be resolved again if it has their
+ * path but not their identity.
+ */
+void prefilter_exe_seen(const struct exe_identity *id, const char *path);
+
+void destroy_prefilter(void);
+
+#endif /* __EXECLOG_PREFILTER__ */
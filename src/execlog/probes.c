@@ -1,12 +1,25 @@
 #include <linux/module.h>
 #include <linux/binfmts.h>
+#include <linux/file.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
 #include <linux/kprobes.h>
+#include <linux/percpu.h>
+#include <linux/random.h>
 #include <linux/slab.h>
 #include <linux/tty.h>
 #include <linux/version.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/clock.h>
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0) */
 #include "execlog.h"
+#include "path_cache.h"
 #include "probes.h"
 #include "probes_helper.h"
+#include "tracepoint_helper.h"
+#include "deferred.h"
+#include "aggregate.h"
+#include "prefilter.h"
 #include "whitelist.h"
 #ifdef USE_PRINK
 #include "current_details.h"
@@ -14,6 +27,14 @@
 #include "log.h"
 #endif /* ? USE_PRINK */
 
+#ifndef pr_err_ratelimited
+#define pr_err_ratelimited(fmt, ...)				\
+	do {							\
+		if (printk_ratelimit())				\
+			pr_err(fmt, ##__VA_ARGS__);		\
+	} while (0)
+#endif /* ! pr_err_ratelimited */
+
 /**********************************/
 /*         argv_max_len           */
 /**********************************/
@@ -115,14 +136,82 @@ get_user_arg_ptr(struct user_arg_ptr argv, int nr)
 /*     inter-probe nightmare      */
 /**********************************/
 
+/*
+ * Contexts of the execve calls in progress, found by task in a hash table
+ * with a lock per bucket: concurrent execs only contend when their tasks
+ * hash to the same bucket, and a lookup only walks the contexts of one
+ * bucket.
+ */
+#define EXECVE_HASH_BITS 8
+
 struct execve_data {
 	struct hlist_node hlist;
-	pid_t pid;
+	struct task_struct *task;
 	struct user_arg_ptr argv;
+	unsigned int entries     /** Calls to search_binary_handler so far */;
+	struct execlog_deferred *deferred /** Logging deferred to task_work, NULL if none */;
+};
+
+struct execve_bucket {
+	spinlock_t lock;
+	struct hlist_head head;
+} ____cacheline_aligned_in_smp;
+
+static struct execve_bucket execve_contexts[1 << EXECVE_HASH_BITS];
+
+struct execve_stats {
+	unsigned long lookups   /** Contexts looked up by search_binary_handler */;
+	unsigned long scanned   /** Contexts compared during those lookups */;
+	unsigned long contended /** Bucket locks found held by another CPU */;
+	unsigned long reentries /** Calls to search_binary_handler for interpreters, ignored */;
 };
 
-static HLIST_HEAD(active_kretprobes);
-static DEFINE_SPINLOCK(active_kretprobes_lock);
+static DEFINE_PER_CPU(struct execve_stats, execve_stats);
+
+static void
+execve_contexts_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(execve_contexts); ++i) {
+		spin_lock_init(&execve_contexts[i].lock);
+		INIT_HLIST_HEAD(&execve_contexts[i].head);
+	}
+}
+
+static struct execve_bucket *
+execve_bucket_lock(const struct task_struct *task)
+{
+	struct execve_bucket *bucket;
+
+	bucket = &execve_contexts[hash_ptr((void *)task, EXECVE_HASH_BITS)];
+	if (unlikely(!spin_trylock(&bucket->lock))) {
+		this_cpu_inc(execve_stats.contended);
+		spin_lock(&bucket->lock);
+	}
+	return bucket;
+}
+
+static void
+execve_context_add(struct execve_data *priv)
+{
+	struct execve_bucket *bucket;
+
+	priv->task = current;
+	bucket = execve_bucket_lock(current);
+	hlist_add_head(&priv->hlist, &bucket->head);
+	spin_unlock(&bucket->lock);
+}
+
+static void
+execve_context_del(struct execve_data *priv)
+{
+	struct execve_bucket *bucket;
+
+	bucket = execve_bucket_lock(priv->task);
+	hlist_del(&priv->hlist);
+	spin_unlock(&bucket->lock);
+}
 
 static struct execve_data*
 get_current_kretprobe_data(void)
@@ -131,158 +220,537 @@ get_current_kretprobe_data(void)
 	struct hlist_node * tmp;
 #endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
 	struct execve_data *cur, *tgt = NULL;
+	struct execve_bucket *bucket;
+	unsigned long scanned = 0;
 
-	spin_lock(&active_kretprobes_lock);
+	bucket = execve_bucket_lock(current);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
-	hlist_for_each_entry(cur, tmp, &active_kretprobes, hlist) {
+	hlist_for_each_entry(cur, tmp, &bucket->head, hlist) {
 #else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
-	hlist_for_each_entry(cur, &active_kretprobes, hlist) {
+	hlist_for_each_entry(cur, &bucket->head, hlist) {
 #endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
-		if (cur->pid == current->pid) {
+		++scanned;
+		if (cur->task == current) {
 			tgt = cur;
 			break;
 		}
 	}
-	spin_unlock(&active_kretprobes_lock);
+	spin_unlock(&bucket->lock);
+
+	this_cpu_inc(execve_stats.lookups);
+	this_cpu_add(execve_stats.scanned, scanned);
 	return tgt;
 }
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+execve_stats_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+execve_stats_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return -EPERM;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+execve_stats_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+execve_stats_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	unsigned long lookups = 0, scanned = 0, contended = 0, reentries = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct execve_stats *stats = per_cpu_ptr(&execve_stats, cpu);
+
+		lookups += READ_ONCE(stats->lookups);
+		scanned += READ_ONCE(stats->scanned);
+		contended += READ_ONCE(stats->contended);
+		reentries += READ_ONCE(stats->reentries);
+	}
+
+	return scnprintf(buffer, PAGE_SIZE, "lookups:%lu scanned:%lu contended:%lu reentries:%lu",
+			 lookups, scanned, contended, reentries);
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+const struct kernel_param_ops execve_stats_param = {
+	.set = execve_stats_param_set,
+	.get = execve_stats_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
 
 /**********************************/
 /*          common core           */
 /**********************************/
 
-static const char * default_argv = "@Memory_error";
+/*
+ * Arguments are copied into a buffer of ARGV_MAX_SIZE bytes per CPU,
+ * allocated when the probes are planted: probes run with preemption
+ * disabled, and do not nest on a CPU. The buffer is followed by room for
+ * the path of the executable with its interpreter.
+ */
+#define CHAIN_MAX_SIZE (MAX_EXEC_PATH + BINPRM_BUF_SIZE + 8)
+#define SCRATCH_SIZE (ARGV_MAX_SIZE + CHAIN_MAX_SIZE)
+
+static DEFINE_PER_CPU(char *, argv_scratch);
 
 static void
-execlog_common(const char *filename,
-	       const struct user_arg_ptr __argv)
+argv_scratch_free(void)
 {
-	const char __user *__argv_content;
-	int argv_cur_pos;
-	size_t argv_size;
-	long argv_written;
-	char *argv_buffer, *argv_current_end, *argv_loop;
-	bool argv_truncated;
-#ifdef USE_PRINK
-	struct current_details details;
-	size_t filename_len, printed, print_size;
-#endif /* USE_PRINK */
+	int cpu;
 
-	/* Find total argv_size */
-	argv_size = 2;
-	argv_cur_pos = 0;
-	argv_truncated = 0;
-	while ((__argv_content = get_user_arg_ptr(__argv, argv_cur_pos)) != NULL) {
-		/* str(n)len_user includes the final \0 */
-#if LINUX_VERSION_CODE < KERNEL_VERSION(4, 13, 0)
-		/* strlen_user always return something > 0 */
-		argv_size += (unsigned long) strlen_user(__argv_content);
-#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 13, 0) */
-		unsigned long user_len = strnlen_user(__argv_content, argv_max_len);
-		if (user_len == 0) {
-			if (!access_ok(VERIFY_READ, __argv_content, 1)) {
-				/* This will be logged later */
-				user_len += 1;
-			} else {
-				pr_err("Unable to read at most %lu from single argv", argv_max_len);
-				user_len += argv_max_len;
-				break;
-			}
-		} else {
-			argv_size += user_len;
+	for_each_possible_cpu(cpu) {
+		kfree(per_cpu(argv_scratch, cpu));
+		per_cpu(argv_scratch, cpu) = NULL;
+	}
+}
+
+static int
+argv_scratch_alloc(void)
+{
+	char *buffer;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		buffer = kmalloc_node(SCRATCH_SIZE, GFP_KERNEL, cpu_to_node(cpu));
+		if (unlikely(buffer == NULL)) {
+			pr_err("Unable to allocate memory for user argv");
+			argv_scratch_free();
+			return -ENOMEM;
 		}
-#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(4, 13, 0) */
-		++argv_cur_pos;
+		per_cpu(argv_scratch, cpu) = buffer;
 	}
+	return 0;
+}
 
-	/* Truncate argv when larger than the configured value */
-	if (argv_size > argv_max_len) {
-		argv_size = argv_max_len;
-		argv_truncated = 1;
+/*
+ * Copy of argv, which can be done in several steps. Arguments are read
+ * either from the argv array given to execve, or from the memory of the
+ * new program, where they are stored one after the other.
+ */
+struct argv_copy {
+	struct user_arg_ptr argv   /** Arguments given to execve */;
+	const char __user *flat    /** Arguments of the new program, NULL if not used */;
+	size_t flat_len            /** Size of the arguments of the new program */;
+	bool faulted               /** A fault stopped the copy of 'flat' for good */;
+	char *buffer               /** Buffer, followed by CHAIN_MAX_SIZE bytes for the path */;
+	size_t size                /** Size of the buffer for the arguments */;
+	bool may_fault             /** User pages can be faulted in (not in a probe) */;
+	size_t len                 /** Bytes copied, '\0' excluded */;
+	int nr                     /** Argument being copied */;
+	size_t offset              /** Bytes of the argument (or of 'flat') already copied */;
+	bool complete              /** All the arguments were copied */;
+};
+
+static void
+argv_copy_setup(struct argv_copy *copy, const struct user_arg_ptr __argv,
+		char *buffer, size_t size)
+{
+	copy->argv = __argv;
+	copy->flat = NULL;
+	copy->flat_len = 0;
+	copy->faulted = false;
+	copy->buffer = buffer;
+	copy->size = size;
+	copy->may_fault = false;
+	copy->len = 0;
+	copy->nr = 0;
+	copy->offset = 0;
+	copy->complete = false;
+	copy->buffer[0] = '\0';
+}
+
+/* Copy into the buffer of the CPU, from a probe */
+static void
+argv_copy_init(struct argv_copy *copy, const struct user_arg_ptr __argv)
+{
+	argv_copy_setup(copy, __argv, this_cpu_read(argv_scratch), ARGV_MAX_SIZE);
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 4, 0)
+static const struct user_arg_ptr no_argv = {
+	.is_compat = false,
+	.ptr.native = NULL,
+};
+
+/* Read the arguments from the memory of the new program, 'mm' */
+static void
+argv_copy_set_flat(struct argv_copy *copy, const struct mm_struct *mm)
+{
+	copy->flat = (const char __user *) mm->arg_start;
+	copy->flat_len = mm->arg_end - mm->arg_start;
+}
+
+/* Skip the first 'nr' arguments of the new program, might fault */
+static void
+argv_copy_skip_flat(struct argv_copy *copy, int nr)
+{
+	long len;
+
+	for (; nr > 0 && copy->flat_len > 0; --nr) {
+		/* Length including the '\0', 0 on fault */
+		len = strnlen_user(copy->flat, copy->flat_len);
+		if (len <= 0 || (size_t)len > copy->flat_len) {
+			copy->flat_len = 0;
+			copy->faulted = true;
+			return;
+		}
+		copy->flat += len;
+		copy->flat_len -= (size_t)len;
 	}
+}
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 4, 0) */
 
-	/* Allocate memory for copying the argv from userspace */
-	argv_buffer = kmalloc(argv_size, GFP_ATOMIC);
-	if (unlikely(argv_buffer == NULL)) {
-		pr_err("Unable to allocate memory for user argv");
-		argv_buffer = (char *)default_argv;
-		argv_size = sizeof(default_argv);
-		goto log;
-	}
-
-	/* Copy argv from userspace */
-	argv_cur_pos = 0;
-	argv_current_end = argv_buffer;
-	while ((__argv_content = get_user_arg_ptr(__argv, argv_cur_pos)) != NULL) {
-		/* Get at max argv_size bytes from __argv_content */
-		/* argv_size is <= LONG_MAX, so we can cast it */
-		argv_written = strncpy_from_user(argv_current_end,
-						 __argv_content,
-						 (long) argv_size);
+/*
+ * From a probe, the scratch buffer of the CPU is written: faults are
+ * disabled, an argument that is not in memory stops the copy.
+ */
+static void
+argv_copy_array(struct argv_copy *copy, size_t limit)
+{
+	const char __user *__argv_content;
+	long argv_written;
+
+	if (!copy->may_fault)
+		pagefault_disable();
+	while (copy->len < limit) {
+		__argv_content = get_user_arg_ptr(copy->argv, copy->nr);
+		if (__argv_content == NULL) {
+			copy->complete = true;
+			break;
+		}
+		/* argv_max_len is <= LONG_MAX, so we can cast */
+		argv_written = strncpy_from_user(copy->buffer + copy->len,
+						 __argv_content + copy->offset,
+						 (long) (limit - copy->len));
 		if (unlikely(argv_written < 0)) {
+			if (argv_written == -EFAULT && !copy->may_fault)
+				break;
 			if (argv_written == -EFAULT)
-				pr_err("Unable to copy one of the arguments: Page fault");
+				pr_err_ratelimited("Unable to copy one of the arguments: Page fault");
 			else
-				pr_err("Unable to copy one of the arguments : %li", argv_written);
+				pr_err_ratelimited("Unable to copy one of the arguments : %li", argv_written);
 			/* We can just skip this argument for now */
 			argv_written = 0;
 		}
-		/* Update the pointer and remaining size
-		 * strncpy_from_user guaranties that argv_written <= argv_size, i-e argv_size will not loop (unsigned) */
-		argv_current_end += (unsigned long) argv_written;
-		argv_size -= (unsigned long) argv_written;
-		/* As we calculated the size before, this should never occur, except if userspace is malicious or had to be truncated */
-		if (argv_size == 0) {
-			if (argv_truncated == 0) {
-				pr_err("Argv size changed between two read (malicious resize?)!");
-				argv_truncated = 1;
-			}
-			/* We still need one char to write '\0' */
-			/* The buffer is at least of size 2, we can always go back by one */
-			--argv_current_end;
+		copy->len += (unsigned long) argv_written;
+		/* No '\0' found: the argument goes on */
+		if (copy->len == limit) {
+			copy->offset += (unsigned long) argv_written;
 			break;
 		}
-		/* Add separator ' ' between arguments
-		 * Previous check guaranties that argv_size >= 1, thus will not loop (unsigned) afterwards */
+		/* Add separator ' ' between arguments */
 		/* TODO: Should we have a better separator ? */
-		*argv_current_end = ' ';
-		++argv_current_end;
-		--argv_size;
-		/* Next iteration */
-		++argv_cur_pos;
+		copy->buffer[copy->len] = ' ';
+		++copy->len;
+		copy->offset = 0;
+		++copy->nr;
+	}
+	/* Exactly full: there may be nothing left */
+	if (!copy->complete && copy->offset == 0 &&
+	    get_user_arg_ptr(copy->argv, copy->nr) == NULL)
+		copy->complete = true;
+	if (!copy->may_fault)
+		pagefault_enable();
+}
+
+/*
+ * Probes may not sleep: the arguments of the new program were just
+ * written, a fault stops the copy. The copy is then left incomplete, to be
+ * marked as truncated.
+ */
+static void
+argv_copy_flat(struct argv_copy *copy, size_t limit)
+{
+	size_t size, missing;
+
+	if (copy->len >= limit || copy->faulted)
+		return;
+	size = min(limit - copy->len, copy->flat_len - copy->offset);
+	if (copy->may_fault) {
+		missing = copy_from_user(copy->buffer + copy->len,
+					 copy->flat + copy->offset, size);
+	} else {
+		pagefault_disable();
+		missing = __copy_from_user_inatomic(copy->buffer + copy->len,
+						    copy->flat + copy->offset, size);
+		pagefault_enable();
+	}
+	if (unlikely(missing > 0)) {
+		pr_err_ratelimited("Unable to copy the arguments: Page fault");
+		size -= missing;
+		copy->faulted = true;
 	}
-	*argv_current_end = '\0';
+	copy->len += size;
+	copy->offset += size;
+	copy->complete = (!copy->faulted && copy->offset == copy->flat_len);
+}
 
-	/* Remove any new lines as some software don't support them properly */
-	for (argv_loop = argv_buffer; argv_loop < argv_current_end; ++argv_loop) {
-		if (*argv_loop == '\n' || *argv_loop == '\r')
+/*
+ * Copy argv, separated by ' ', until 'limit' (< copy->size) bytes are
+ * copied. Each argument is read once, in a single pass: a copy stopped in
+ * the middle of an argument resumes where it stopped.
+ */
+static void
+argv_copy(struct argv_copy *copy, size_t limit)
+{
+	char *argv_loop;
+	size_t start = copy->len;
+
+	if (copy->flat != NULL)
+		argv_copy_flat(copy, limit);
+	else
+		argv_copy_array(copy, limit);
+	copy->buffer[copy->len] = '\0';
+
+	/*
+	 * Remove any new lines as some software don't support them properly,
+	 * and separate the arguments of the new program by ' '
+	 */
+	for (argv_loop = copy->buffer + start; argv_loop < copy->buffer + copy->len; ++argv_loop) {
+		if (*argv_loop == '\n' || *argv_loop == '\r' || *argv_loop == '\0')
 			*argv_loop = ' ';
 	}
+}
 
-	/* Add a symbol to represent truncated output */
-	if (argv_truncated && (argv_current_end > argv_buffer)) {
-		*(argv_current_end - 1) = '$';
+/**********************************/
+/*       interpreter chain        */
+/**********************************/
+
+/* Log the interpreter of scripts with their path (default to false) */
+static bool interpreter_chain;
+
+/* Script run by an interpreter */
+struct exec_chain {
+	const char *script  /** Path of the script */;
+	const char *interp  /** Path of its interpreter, not terminated */;
+	size_t interp_len   /** Length of the path of the interpreter */;
+};
+
+/*
+ * Interpreter of a "#!" script, as binfmt_script reads it from the start of
+ * the file, already in bprm->buf. Return its length, 0 if not a script.
+ */
+static size_t
+script_interpreter(const struct linux_binprm *bprm, const char **interp)
+{
+	const char *pos = bprm->buf + 2;
+	const char *end = bprm->buf + BINPRM_BUF_SIZE;
+
+	if (bprm->buf[0] != '#' || bprm->buf[1] != '!')
+		return 0;
+	while (pos < end && (*pos == ' ' || *pos == '\t'))
+		++pos;
+	*interp = pos;
+	while (pos < end && *pos != ' ' && *pos != '\t' && *pos != '\n' && *pos != '\0')
+		++pos;
+	return (size_t)(pos - *interp);
+}
+
+/* "script -> interpreter", after the arguments in their buffer */
+static const char *
+exec_chain_print(const struct argv_copy *copy, const struct exec_chain *chain)
+{
+	char *buffer = copy->buffer + copy->size;
+
+	scnprintf(buffer, CHAIN_MAX_SIZE, "%.*s -> %.*s", MAX_EXEC_PATH, chain->script,
+		  (int) min_t(size_t, chain->interp_len, BINPRM_BUF_SIZE), chain->interp);
+	return buffer;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+interpreter_chain_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+interpreter_chain_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	bool value;
+	int ret;
+
+	if (buf == NULL)
+		return -EBADF;
+
+	ret = strtobool(buf, &value);
+	if (ret == 0)
+		WRITE_ONCE(interpreter_chain, value);
+	return ret;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+interpreter_chain_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+interpreter_chain_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return sprintf(buffer, "%c", READ_ONCE(interpreter_chain) ? 'Y' : 'N');
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+const struct kernel_param_ops interpreter_chain_param = {
+	.set = interpreter_chain_param_set,
+	.get = interpreter_chain_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+/**********************************/
+/*       repeated executions      */
+/**********************************/
+
+/*
+ * What makes two executions the same in the logs, the key of the
+ * aggregation. The arguments are fingerprinted, only their start is kept
+ * for the summary.
+ */
+struct execlog_exec {
+	uid_t uid                /** Real UID of the process */;
+	u32 argv_size            /** Size of the arguments, including the tailing '\0' */;
+	u64 argv_hash            /** Hash of the arguments */;
+	size_t path_len          /** Length of the path, including the tailing '\0' */;
+	char data[]              /** Path, then the start of the arguments */;
+};
+
+/* Random seeds of the hash, so that it can't be predicted */
+static u32 argv_seeds[2];
+
+static inline u64
+execlog_argv_hash(const char *argv, size_t argv_size)
+{
+	return ((u64) jhash(argv, argv_size, argv_seeds[0]) << 32) |
+	       jhash(argv, argv_size, argv_seeds[1]);
+}
+
+/* Check if the execution repeats one logged less than a window ago */
+static bool
+execlog_repeated(const char *filename, const char *argv, size_t argv_size)
+{
+	union {
+		struct execlog_exec exec;
+		char raw[AGGREGATE_KEY_SIZE];
+	} key;
+	size_t path_len, argv_start;
+
+	if (likely(!aggregate_enabled()))
+		return false;
+
+	/* Too long to be aggregated */
+	path_len = strlen(filename) + 1;
+	if (path_len > sizeof(key) - sizeof(key.exec))
+		return false;
+
+	/* Keys are compared as a whole, padding included */
+	memset(&key.exec, 0, sizeof(key.exec));
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 5, 0)
+	key.exec.uid = current_uid().val;
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 5, 0) */
+	key.exec.uid = current_uid();
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 5, 0) */
+	key.exec.argv_size = argv_size;
+	key.exec.argv_hash = execlog_argv_hash(argv, argv_size);
+	key.exec.path_len = path_len;
+	memcpy(key.exec.data, filename, path_len);
+
+	/* As much of the arguments as fits, with a symbol if truncated */
+	argv_start = min(argv_size, sizeof(key) - sizeof(key.exec) - path_len);
+	memcpy(key.exec.data + path_len, argv, argv_start);
+	if (argv_start < argv_size && argv_start > 0)
+		key.exec.data[path_len + argv_start - 1] = '$';
+
+	return aggregate_event(&key, sizeof(key.exec) + path_len + argv_start,
+			       local_clock());
+}
+
+void
+aggregate_report(const struct aggregate_summary *summary)
+{
+	const struct execlog_exec *exec = (const struct execlog_exec *)summary->key;
+	const char *argv = exec->data + exec->path_len;
+	size_t argv_start = summary->key_len - sizeof(*exec) - exec->path_len;
+
+#ifdef USE_PRINK
+	printk(KERN_DEBUG pr_fmt("Repeated %u times by uid %u: %s %.*s\n"),
+	       summary->count, exec->uid, exec->data, (int) argv_start, argv);
+#else /* ! USE_PRINK */
+	store_execlog_repeated(summary->first, summary->last, summary->count,
+			       exec->uid, exec->data, argv, argv_start);
+#endif /* ? USE_PRINK */
+}
+
+/**********************************/
+/*          logging               */
+/**********************************/
+
+/*
+ * Log an execution, 'copy' being initialized but not started. 'chain', if
+ * not NULL, replaces the logged path.
+ */
+static void
+execlog_common(const struct exe_identity *id, const char *filename,
+	       struct argv_copy *copy, const struct exec_chain *chain)
+{
+	const char *argv_buffer;
+	size_t argv_size;
+	size_t argv_needed;
+	size_t limit;
+#ifdef USE_PRINK
+	struct current_details details;
+	char tty_buffer[TTY_NAME_LEN];
+	const char *tty;
+	size_t filename_len, printed, print_size;
+#endif /* USE_PRINK */
+
+	/*
+	 * Decide on the executable first: argv is only copied for what the
+	 * rules need, and fully only when the event is logged.
+	 */
+	prefilter_exe_seen(id, filename);
+	if (is_whitelisted_exe(id, filename, &argv_needed))
+		return;
+
+	/* Keep one byte for '\0' */
+	limit = min_t(size_t, READ_ONCE(argv_max_len), copy->size) - 1;
+
+	/* Only rules with an argv start can ignore it: copy just what they need */
+	if (argv_needed > 0) {
+		argv_copy(copy, min(argv_needed, limit));
+		if (is_whitelisted(id, filename, copy->buffer, copy->len + 1))
+			return;
 	}
 
-	/* Update argv_size with real value */
-	/* By construction, argv_current_end > argv_buffer, we can cast */
-	argv_size = (size_t)(argv_current_end - argv_buffer + 1);
+	/* Then the rest, for the log */
+	argv_copy(copy, limit);
 
-	/* Check whitelist */
-	if (is_whitelisted(filename, argv_buffer, argv_size))
-		goto exit;
+	/* Add a symbol to represent truncated output */
+	if (!copy->complete && copy->len > 0)
+		copy->buffer[copy->len - 1] = '$';
+
+	argv_buffer = copy->buffer;
+	argv_size = copy->len + 1;
+	if (chain != NULL)
+		filename = exec_chain_print(copy, chain);
+
+	/* Only counted, until its window is closed */
+	if (execlog_repeated(filename, argv_buffer, argv_size))
+		return;
 
-log:
 #ifdef USE_PRINK
 	fill_current_details(&details);
+	tty = current_tty_name(tty_buffer);
 	print_size = argv_size - 1;
 	filename_len = strlen(filename);
 	/* Rsyslog only reads 1000 char a time ... */
 #define DATA_MAX_LEN 900
 	if (print_size + filename_len < DATA_MAX_LEN) {
 		printk(KERN_DEBUG pr_fmt(CURRENT_DETAILS_FORMAT" %s %.*s\n"),
-		       CURRENT_DETAILS_ARGS(details), filename,
+		       CURRENT_DETAILS_ARGS(details, tty), filename,
 		       (int)print_size, argv_buffer);
 	} else {
 		size_t to_be_printed;
@@ -292,7 +760,7 @@ log:
 			to_be_printed = DATA_MAX_LEN - filename_len;
 		}
 		printk(KERN_DEBUG pr_fmt(CURRENT_DETAILS_FORMAT" %.*s %.*s\n"),
-		       CURRENT_DETAILS_ARGS(details), DATA_MAX_LEN, filename,
+		       CURRENT_DETAILS_ARGS(details, tty), DATA_MAX_LEN, filename,
 		       (int)to_be_printed, argv_buffer);
 		printed = to_be_printed;
 		print_size -= to_be_printed;
@@ -302,7 +770,7 @@ log:
 			else
 				to_be_printed = print_size;
 			printk(KERN_DEBUG pr_fmt(CURRENT_DETAILS_FORMAT" @ %.*s\n"),
-			       CURRENT_DETAILS_ARGS(details),
+			       CURRENT_DETAILS_ARGS(details, tty),
 			       (int)to_be_printed, argv_buffer + printed);
 			printed += to_be_printed;
 			print_size -= to_be_printed;
@@ -311,12 +779,278 @@ log:
 #else /* ! USE_PRINK */
 	store_execlog_record(filename, argv_buffer, argv_size);
 #endif /* ? USE_PRINK */
+}
 
-exit:
-	if (argv_buffer != default_argv)
-		kfree(argv_buffer);
+/**********************************/
+/*        deferred logging        */
+/**********************************/
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0)
+/* Log from task_work instead of from the probes (default to false) */
+static bool deferred_logging;
+
+/* task_work_add was found when the probes were planted */
+static bool deferred_available;
+
+/*
+ * Execution logged by its task before it returns to userspace: it can sleep
+ * there, and the argument pages can be faulted in.
+ */
+struct execlog_deferred {
+	struct callback_head work;
+	struct exe_identity id               /** Identity of the executable */;
+	struct file *file                    /** Executable, referenced */;
+	struct user_arg_ptr argv             /** Arguments given to execve, read if it failed */;
+	bool failed                          /** The execve failed: the old program still runs */;
+	bool chain_is_script                 /** 'chain' is the script run by the executable, not its interpreter */;
+	int argc                             /** Number of arguments given to execve, -1 if not known */;
+	int prepended                        /** Arguments prepended by interpreters (binfmt_script, binfmt_misc) */;
+	int interps                          /** Interpreters recorded in 'chain' from the re-entries */;
+	size_t chain_len                     /** Length of 'chain', 0 if not logged */;
+	char chain[BINPRM_BUF_SIZE + 1]      /** Other end of the interpreter chain */;
+};
+
+static inline bool
+execlog_deferred_enabled(void)
+{
+	return deferred_available && READ_ONCE(deferred_logging);
+}
+
+static void
+execlog_deferred_run(struct callback_head *work)
+{
+	struct execlog_deferred *item = container_of(work, struct execlog_deferred, work);
+	char path_buffer[MAX_EXEC_PATH + 1];
+	char fallback[2];
+	struct exec_chain chain, *chain_ptr = NULL;
+	struct argv_copy copy;
+	struct mm_struct *mm = current->mm;
+	const char *filename;
+	char *buffer;
+	size_t size;
+
+	filename = path_cache_get(item->file, path_buffer, MAX_EXEC_PATH);
+	if (filename == NULL)
+		filename = (const char *) item->file->f_path.dentry->d_name.name;
+
+	/* Arguments of the new program, or those given to execve if it failed */
+	if (item->failed)
+		size = READ_ONCE(argv_max_len);
+	else if (mm != NULL)
+		size = min_t(size_t, mm->arg_end - mm->arg_start + 1, READ_ONCE(argv_max_len));
+	else
+		size = 1;
+
+	buffer = kmalloc(size + CHAIN_MAX_SIZE, GFP_KERNEL);
+	if (likely(buffer != NULL)) {
+		argv_copy_setup(&copy, item->failed ? item->argv : no_argv, buffer, size);
+		if (item->chain_len > 0) {
+			if (item->chain_is_script) {
+				chain.script = item->chain;
+				chain.interp = filename;
+				chain.interp_len = strlen(filename);
+			} else {
+				chain.script = filename;
+				chain.interp = item->chain;
+				chain.interp_len = item->chain_len;
+			}
+			chain_ptr = &chain;
+		}
+	} else {
+		pr_err("Unable to allocate memory for user argv");
+		argv_copy_setup(&copy, no_argv, fallback, sizeof(fallback));
+	}
+	copy.may_fault = true;
+	if (!item->failed && mm != NULL && buffer != NULL) {
+		argv_copy_set_flat(&copy, mm);
+		/* Same arguments as the kprobe backend logs without deferring */
+		argv_copy_skip_flat(&copy, item->prepended);
+	}
+
+	execlog_common(&item->id, filename, &copy, chain_ptr);
+
+	kfree(buffer);
+	fput(item->file);
+	kfree(item);
+	deferred_done();
+}
+
+/*
+ * Defer the logging of the current execution to task_work. Return NULL if
+ * it has to be logged right away.
+ */
+static struct execlog_deferred *
+execlog_defer(const struct exe_identity *id, struct file *file,
+	      const struct user_arg_ptr __argv, const char *chain,
+	      size_t chain_len, bool chain_is_script)
+{
+	struct execlog_deferred *item;
+
+	item = kmalloc(sizeof(*item), GFP_ATOMIC);
+	if (unlikely(item == NULL))
+		return NULL;
+
+	item->id = *id;
+	get_file(file);
+	item->file = file;
+	item->argv = __argv;
+	item->failed = false;
+	item->argc = -1;
+	item->prepended = 0;
+	item->interps = 0;
+	item->chain_is_script = chain_is_script;
+	item->chain_len = min_t(size_t, chain_len, BINPRM_BUF_SIZE);
+	if (item->chain_len > 0)
+		memcpy(item->chain, chain, item->chain_len);
+	item->chain[item->chain_len] = '\0';
+
+	if (unlikely(deferred_queue(&item->work, execlog_deferred_run) < 0)) {
+		fput(file);
+		kfree(item);
+		return NULL;
+	}
+	return item;
+}
+
+/* Called by the syscall return probe, before the task_work runs */
+static inline void
+execlog_deferred_result(struct execlog_deferred *item, long ret)
+{
+	item->failed = IS_ERR_VALUE(ret);
+}
+
+/*
+ * Called on each call to search_binary_handler: interpreters replace
+ * argv[0] by their own arguments, before calling it again.
+ */
+static inline void
+execlog_deferred_argc(struct execlog_deferred *item, int argc)
+{
+	if (item->argc < 0)
+		item->argc = argc;
+	else if (argc > item->argc)
+		item->prepended = argc - item->argc;
+}
+
+/*
+ * Called on the re-entries of search_binary_handler, with the interpreter
+ * set by binfmt_script or binfmt_misc: the chain becomes
+ * "interp1 -> interp2 ...", replacing the interpreter read from "#!".
+ */
+static inline void
+execlog_deferred_interp(struct execlog_deferred *item, const char *interp)
+{
+	size_t len = (item->interps > 0) ? item->chain_len : 0;
+
+	if (item->chain_is_script || interp == NULL)
+		return;
+	len += scnprintf(item->chain + len, sizeof(item->chain) - len, "%s%s",
+			 (len > 0) ? " -> " : "", interp);
+	item->chain_len = len;
+	++item->interps;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+deferred_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+deferred_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	bool value;
+	int ret;
+
+	if (buf == NULL)
+		return -EBADF;
+
+	ret = strtobool(buf, &value);
+	if (ret == 0)
+		WRITE_ONCE(deferred_logging, value);
+	return ret;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+deferred_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+deferred_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return sprintf(buffer, "%c", READ_ONCE(deferred_logging) ? 'Y' : 'N');
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+const struct kernel_param_ops deferred_param = {
+	.set = deferred_param_set,
+	.get = deferred_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 7, 0) */
+/* No task_work */
+static inline bool
+execlog_deferred_enabled(void)
+{
+	return false;
+}
+
+static inline struct execlog_deferred *
+execlog_defer(const struct exe_identity *id, struct file *file,
+	      const struct user_arg_ptr __argv, const char *chain,
+	      size_t chain_len, bool chain_is_script)
+{
+	return NULL;
+}
+
+static inline void
+execlog_deferred_result(struct execlog_deferred *item, long ret)
+{
 }
 
+static inline void
+execlog_deferred_argc(struct execlog_deferred *item, int argc)
+{
+}
+
+static inline void
+execlog_deferred_interp(struct execlog_deferred *item, const char *interp)
+{
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+deferred_param_set(const char *buf, struct kernel_param *kp)
+{
+	return -EINVAL;
+}
+
+int
+deferred_param_get(char *buffer, struct kernel_param *kp)
+{
+	return sprintf(buffer, "N");
+}
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+deferred_param_set(const char *buf, const struct kernel_param *kp)
+{
+	return -EINVAL;
+}
+
+static int
+deferred_param_get(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "N");
+}
+
+const struct kernel_param_ops deferred_param = {
+	.set = deferred_param_set,
+	.get = deferred_param_get,
+};
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 7, 0) */
+
 /**********************************/
 /*           PROBES               */
 /**********************************/
@@ -335,11 +1069,9 @@ pre_sys_execve(struct kretprobe_instance *ri, struct pt_regs *regs)
 
 	priv->argv.is_compat = false;
 	priv->argv.ptr.native = (const char __user *const __user *) GET_ARG_2(regs);
-	priv->pid = current->pid;
-
-	spin_lock(&active_kretprobes_lock);
-	hlist_add_head(&priv->hlist, &active_kretprobes);
-	spin_unlock(&active_kretprobes_lock);
+	priv->entries = 0;
+	priv->deferred = NULL;
+	execve_context_add(priv);
 
 	return 0;
 }
@@ -359,11 +1091,9 @@ pre_compat_sys_execve(struct kretprobe_instance *ri, struct pt_regs *regs)
 
 	priv->argv.is_compat = true;
 	priv->argv.ptr.compat = (const compat_uptr_t __user *) GET_ARG_2(regs);
-	priv->pid = current->pid;
-
-	spin_lock(&active_kretprobes_lock);
-	hlist_add_head(&priv->hlist, &active_kretprobes);
-	spin_unlock(&active_kretprobes_lock);
+	priv->entries = 0;
+	priv->deferred = NULL;
+	execve_context_add(priv);
 
 	return 0;
 }
@@ -375,6 +1105,9 @@ static int
 pre_search_binary_handler(struct kprobe *p, struct pt_regs *regs)
 {
 	char buffer[MAX_EXEC_PATH + 1];
+	struct exe_identity id;
+	struct argv_copy copy;
+	struct exec_chain chain, *chain_ptr = NULL;
 	const char *filename;
 	struct execve_data *priv;
 	struct linux_binprm *bprm = (struct linux_binprm *) GET_ARG_1(regs);
@@ -384,20 +1117,58 @@ pre_search_binary_handler(struct kprobe *p, struct pt_regs *regs)
 		return 0;
 	}
 
+	/*
+	 * Scripts and binfmt_misc call search_binary_handler again for their
+	 * interpreter: the execve was already handled by the first call.
+	 */
+	priv = get_current_kretprobe_data();
+	if (likely(priv != NULL) && priv->entries++ > 0) {
+		this_cpu_inc(execve_stats.reentries);
+		if (priv->deferred != NULL) {
+			execlog_deferred_argc(priv->deferred, bprm->argc);
+			if (READ_ONCE(interpreter_chain))
+				execlog_deferred_interp(priv->deferred, bprm->interp);
+		}
+		return 0;
+	}
+
+	/* Executions dropped by the prefilter need nothing else */
+	if (prefilter_reject())
+		return 0;
+
+	/* Whitelisted executables don't need their path or arguments */
+	exe_identity_of_file(&id, bprm->file);
+	if (is_whitelisted(&id, NULL, NULL, 0))
+		return 0;
+
+	/* Nothing else to do in the probe */
+	if (likely(priv != NULL) && execlog_deferred_enabled()) {
+		chain.interp = NULL;
+		chain.interp_len = 0;
+		if (READ_ONCE(interpreter_chain))
+			chain.interp_len = script_interpreter(bprm, &chain.interp);
+		priv->deferred = execlog_defer(&id, bprm->file, priv->argv, chain.interp,
+					       chain.interp_len, false);
+		if (likely(priv->deferred != NULL)) {
+			execlog_deferred_argc(priv->deferred, bprm->argc);
+			return 0;
+		}
+	}
+
 	/* Extract real path from file */
-	filename = d_path(&bprm->file->f_path, buffer, MAX_EXEC_PATH);
-	if (IS_ERR(filename)) {
+	filename = path_cache_get(bprm->file, buffer, MAX_EXEC_PATH);
+	if (filename == NULL) {
 		/* fallback to file called */
 		filename = bprm->filename;
 	}
 
-	priv = get_current_kretprobe_data();
 	if (unlikely(priv == NULL)) {
 #ifdef USE_PRINK
 		struct current_details details;
+		char tty_buffer[TTY_NAME_LEN];
 		fill_current_details(&details);
 		printk(KERN_DEBUG pr_fmt(CURRENT_DETAILS_FORMAT" %s %s\n"),
-		       CURRENT_DETAILS_ARGS(details), filename,
+		       CURRENT_DETAILS_ARGS(details, current_tty_name(tty_buffer)), filename,
 		       kretprobe_missed);
 #else /* ! USE_PRINK */
 		store_execlog_record(filename, kretprobe_missed,
@@ -405,8 +1176,18 @@ pre_search_binary_handler(struct kprobe *p, struct pt_regs *regs)
 #endif /* ? USE_PRINK */
 		return 0;
 	}
-	execlog_common(filename, priv->argv);
-	priv->argv.ptr.native = NULL;
+
+	/* The interpreter is not known yet: read it as binfmt_script will */
+	if (READ_ONCE(interpreter_chain)) {
+		chain.interp_len = script_interpreter(bprm, &chain.interp);
+		if (chain.interp_len > 0) {
+			chain.script = filename;
+			chain_ptr = &chain;
+		}
+	}
+
+	argv_copy_init(&copy, priv->argv);
+	execlog_common(&id, filename, &copy, chain_ptr);
 	return 0;
 }
 
@@ -418,15 +1199,16 @@ post_check(struct kretprobe_instance *ri, struct pt_regs *regs)
 	if (unlikely(priv == NULL))
 		return 0;
 	/* Log a missed instanced if:
-	    - search_binary_handler did not clean priv->argv.ptr.native
+	    - search_binary_handler was not called
 	    - The syscall did work (no error)
 	*/
-	if (unlikely(priv->argv.ptr.native != NULL && !IS_ERR(ERR_PTR(regs_return_value(regs)))))
+	if (unlikely(priv->entries == 0 && !IS_ERR(ERR_PTR(regs_return_value(regs)))))
 		pr_err("Execve probe: search_binary_handler not called\n");
 
-	spin_lock(&active_kretprobes_lock);
-	hlist_del(&priv->hlist);
-	spin_unlock(&active_kretprobes_lock);
+	if (priv->deferred != NULL)
+		execlog_deferred_result(priv->deferred, (long) regs_return_value(regs));
+
+	execve_context_del(priv);
 
 	return 0;
 }
@@ -476,14 +1258,149 @@ static struct kprobe kprobe_search_binary_handler = {
 };
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
-#warning "This kernel contains a new syscall, execveat, not supported by execlog!"
+#warning "This kernel contains a new syscall, execveat, not supported by the kprobe backend of execlog!"
 #endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0) */
 
+/*************************************/
+/*        tracepoint backend         */
+/*************************************/
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 4, 0)
+/*
+ * Successful executions, whatever the syscall (execve, execveat, compat),
+ * once the new program is loaded: its file is bprm->file and its arguments
+ * are in its memory, between arg_start and arg_end.
+ */
+static void
+probe_sched_process_exec(void *data, struct task_struct *p, pid_t old_pid,
+			 struct linux_binprm *bprm)
+{
+	char buffer[MAX_EXEC_PATH + 1];
+	struct exe_identity id;
+	struct argv_copy copy;
+	struct exec_chain chain, *chain_ptr = NULL;
+	const char *filename;
+	struct mm_struct *mm = current->mm;
+
+	if (unlikely(bprm == NULL || bprm->file == NULL || mm == NULL))
+		return;
+
+	/* Executions dropped by the prefilter need nothing else */
+	if (prefilter_reject())
+		return;
+
+	/* Whitelisted executables don't need their path or arguments */
+	exe_identity_of_file(&id, bprm->file);
+	if (is_whitelisted(&id, NULL, NULL, 0))
+		return;
+
+	if (execlog_deferred_enabled()) {
+		chain.interp_len = 0;
+		if (READ_ONCE(interpreter_chain) && bprm->interp != bprm->filename)
+			chain.interp_len = strlen(bprm->filename);
+		if (execlog_defer(&id, bprm->file, no_argv, bprm->filename,
+				  chain.interp_len, true) != NULL)
+			return;
+	}
+
+	filename = path_cache_get(bprm->file, buffer, MAX_EXEC_PATH);
+	if (filename == NULL)
+		filename = bprm->filename;
+
+	/*
+	 * Scripts: the file is their (last) interpreter, the file of the script
+	 * is already closed and only its name, as given to execve, is known.
+	 * The interpreter is logged and whitelisted, unlike the kprobe backend.
+	 */
+	if (READ_ONCE(interpreter_chain) && bprm->interp != bprm->filename) {
+		chain.script = bprm->filename;
+		chain.interp = filename;
+		chain.interp_len = strlen(filename);
+		chain_ptr = &chain;
+	}
+
+	argv_copy_init(&copy, no_argv);
+	argv_copy_set_flat(&copy, mm);
+	execlog_common(&id, filename, &copy, chain_ptr);
+}
+
+static struct tracepoint_probe tracepoint_sched_process_exec = {
+	.name = "sched_process_exec",
+	.probe = probe_sched_process_exec,
+	.data = NULL,
+};
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 4, 0) */
+
+/*************************************/
+/*             backend               */
+/*************************************/
+
+enum execlog_backend {
+	BACKEND_KPROBE     /** Kretprobes on the execve syscalls and a kprobe on search_binary_handler */,
+	BACKEND_TRACEPOINT /** sched_process_exec tracepoint (3.4 and later) */,
+};
+
+static const char * const backend_names[] = {
+	[BACKEND_KPROBE] = "kprobe",
+	[BACKEND_TRACEPOINT] = "tracepoint",
+};
+
+/* Only read when the probes are planted */
+static enum execlog_backend backend = BACKEND_KPROBE;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+backend_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+backend_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	if (buf == NULL)
+		return -EINVAL;
+
+	if (sysfs_streq(buf, backend_names[BACKEND_KPROBE])) {
+		backend = BACKEND_KPROBE;
+		return 0;
+	}
+	if (sysfs_streq(buf, backend_names[BACKEND_TRACEPOINT])) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 4, 0)
+		backend = BACKEND_TRACEPOINT;
+		return 0;
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 4, 0) */
+		pr_err("The tracepoint backend needs Linux 3.4 or later");
+		return -EINVAL;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 4, 0) */
+	}
+
+	pr_err("Invalid backend %s", buf);
+	return -EINVAL;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+backend_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+backend_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return scnprintf(buffer, PAGE_SIZE, "%s", backend_names[backend]);
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+const struct kernel_param_ops backend_param = {
+	.set = backend_param_set,
+	.get = backend_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
 /************************************/
 /*             INIT MODULE          */
 /************************************/
 
-int probes_plant(void)
+static int
+kprobes_plant(void)
 {
 	int err;
 
@@ -518,16 +1435,70 @@ err_cleaned:
 	return err;
 }
 
+int probes_plant(void)
+{
+	int err;
+
+	err = argv_scratch_alloc();
+	if (err < 0)
+		return err;
+	execve_contexts_init();
+	get_random_bytes(argv_seeds, sizeof(argv_seeds));
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0)
+	deferred_available = (deferred_init() == 0);
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0) */
+
+	pr_info("[+] Using the %s backend\n", backend_names[backend]);
+	switch (backend) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 4, 0)
+	case BACKEND_TRACEPOINT:
+		err = plant_tracepoint(&tracepoint_sched_process_exec);
+		if (err < 0)
+			err = -4;
+		break;
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 4, 0) */
+	default:
+		err = kprobes_plant();
+		break;
+	}
+
+	if (err < 0)
+		argv_scratch_free();
+	return err;
+}
+
 /************************************/
 /*             EXIT MODULE          */
 /************************************/
 
-void probes_unplant(void)
+static void
+kprobes_unplant(void)
 {
 	unplant_kretprobe(&kretprobe_sys_execve);
 #ifdef CONFIG_COMPAT
 	unplant_kretprobe(&kretprobe_compat_sys_execve);
 #endif /* CONFIG_COMPAT */
 	unplant_kprobe(&kprobe_search_binary_handler);
+}
+
+void probes_unplant(void)
+{
+	switch (backend) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 4, 0)
+	case BACKEND_TRACEPOINT:
+		unplant_tracepoint(&tracepoint_sched_process_exec);
+		break;
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 4, 0) */
+	default:
+		kprobes_unplant();
+		break;
+	}
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0)
+	/* Executions being logged by their task */
+	if (deferred_available)
+		deferred_wait();
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0) */
+	argv_scratch_free();
 	destroy_whitelist();
+	path_cache_destroy();
 }
@@ -12,8 +12,20 @@ void probes_unplant(void);
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
 int argv_max_size_set(const char *buf, struct kernel_param *kp);
 int argv_max_size_get(char *buffer, struct kernel_param *kp);
+int execve_stats_param_set(const char *buf, struct kernel_param *kp);
+int execve_stats_param_get(char *buffer, struct kernel_param *kp);
+int backend_param_set(const char *buf, struct kernel_param *kp);
+int backend_param_get(char *buffer, struct kernel_param *kp);
+int interpreter_chain_param_set(const char *buf, struct kernel_param *kp);
+int interpreter_chain_param_get(char *buffer, struct kernel_param *kp);
+int deferred_param_set(const char *buf, struct kernel_param *kp);
+int deferred_param_get(char *buffer, struct kernel_param *kp);
 #else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
 extern const struct kernel_param_ops argv_max_size_param;
+extern const struct kernel_param_ops execve_stats_param;
+extern const struct kernel_param_ops backend_param;
+extern const struct kernel_param_ops interpreter_chain_param;
+extern const struct kernel_param_ops deferred_param;
 #endif /* if LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
 
 
@@ -0,0 +1 @@
+../lib/tty_name.h
\ No newline at end of file
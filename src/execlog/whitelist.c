@@ -1,27 +1,28 @@
 #include <linux/version.h>
 #include <linux/cred.h>
 #include <linux/err.h>
+#include <linux/sort.h>
 #include <linux/spinlock.h>
 #include "execlog.h"
 #include "whitelist.h"
 #include "sparse_compat.h"
+#include "exe_identity.h"
+#include "whitelist_match.h"
 
-/* Whitelist */
-struct white_process {
-	struct white_process *next;
-	size_t filename_len;
-	size_t argv_start_len;
-	char data[];
-};
-#define ARGV_START(row) (row->data + row->filename_len + 1)
-
-static struct white_process *whitelist = NULL;
+#define WHITELIST_BLOB_TYPE WHITELIST_BLOB_EXECLOG
 
 static struct white_process* whiterow_from_string(char *str);
-static int is_already_whitelisted(struct white_process *head, struct white_process *new_row);
-static char * whitelist_print(struct white_process *row, char * buf, size_t *avail);
+static struct white_process *whiterow_from_blob(const void *record, size_t size);
+static struct white_process *whiterow_find(struct white_process *head, const struct white_process *row);
+static const char *whiterow_path(const struct white_process *row, size_t *len);
+static char * whitelist_print(const struct white_process *row, char * buf, size_t *avail);
+static struct white_match *white_match_build(struct white_process *rows);
+static void white_match_free(struct white_match *match);
+static const struct white_process *white_match_check(const struct white_match *match, const void *data);
+static bool white_query_pending(const void *data);
 
 #include "whitelist_helper.c"
+#include "whitelist_match.c"
 
 /* Also whitelist calls made by uid/euid 0 (default to false) */
 static bool also_root;
@@ -58,10 +59,14 @@ whiterow_from_string(char *str) __must_hold(whitelist_sanitylock)
 		return NULL;
 
 	/* Allocate new memory */
-	new_row = kmalloc(sizeof(struct white_process) + filename_len + argv_start_len + 2, GFP_ATOMIC);
+	new_row = kmalloc(sizeof(struct white_process) + filename_len + argv_start_len + 2, GFP_KERNEL);
 	if (unlikely(new_row == NULL))
 		return NULL;
 
+	new_row->next = NULL;
+	new_row->next_free = NULL;
+	new_row->hits = NULL;
+
 	/* Copy filename */
 	memcpy(new_row->data, str, filename_len);
 	new_row->filename_len = filename_len;
@@ -80,8 +85,36 @@ whiterow_from_string(char *str) __must_hold(whitelist_sanitylock)
 	return new_row;
 }
 
-static int
-is_already_whitelisted(struct white_process *head, struct white_process *new_row) __must_hold(whitelist_sanitylock)
+static struct white_process *
+whiterow_from_blob(const void *record, size_t size) __must_hold(whitelist_sanitylock)
+{
+	const struct whitelist_blob_execlog *blob = record;
+	struct white_process *new_row;
+
+	if (unlikely(size < sizeof(*blob) || blob->filename_len == 0 ||
+		     blob->filename_len >= MAX_EXEC_PATH ||
+		     (size_t)blob->filename_len + blob->argv_start_len > size - sizeof(*blob)))
+		return NULL;
+
+	new_row = kmalloc(sizeof(struct white_process) + blob->filename_len + blob->argv_start_len + 2, GFP_KERNEL);
+	if (unlikely(new_row == NULL))
+		return NULL;
+
+	new_row->next = NULL;
+	new_row->next_free = NULL;
+	new_row->hits = NULL;
+	memcpy(new_row->data, blob->data, blob->filename_len);
+	new_row->filename_len = blob->filename_len;
+	new_row->data[new_row->filename_len] = '\0';
+	memcpy(ARGV_START(new_row), blob->data + blob->filename_len, blob->argv_start_len);
+	new_row->argv_start_len = blob->argv_start_len;
+	*(ARGV_START(new_row) + new_row->argv_start_len) = '\0';
+
+	return new_row;
+}
+
+static struct white_process *
+whiterow_find(struct white_process *head, const struct white_process *new_row) __must_hold(whitelist_sanitylock)
 {
 	struct white_process *row = head;
 
@@ -89,10 +122,17 @@ is_already_whitelisted(struct white_process *head, struct white_process *new_row
 		if (new_row->filename_len == row->filename_len &&
 		    new_row->argv_start_len == row->argv_start_len &&
 		    (memcmp(new_row->data, row->data, new_row->filename_len + 1 + new_row->argv_start_len) == 0))
-			return 1;
+			return row;
 		row = row->next;
 	}
-	return 0;
+	return NULL;
+}
+
+static const char *
+whiterow_path(const struct white_process *row, size_t *len)
+{
+	*len = row->filename_len;
+	return row->data;
 }
 
 static bool current_is_root(void)
@@ -104,52 +144,57 @@ static bool current_is_root(void)
 #endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 5, 0) */
 }
 
-int
-is_whitelisted(const char *filename, const char *argv_start, size_t argv_size)
+/* Arguments to come: only a negative answer without them is a miss */
+static bool
+white_query_pending(const void *data)
 {
-	size_t filename_len;
-	unsigned long flags;
-	struct white_process *row;
+	const struct white_query *query = data;
 
-	filename_len = strnlen(filename, MAX_EXEC_PATH);
-
-	/*Empty or filenames greater than our limit are not whitelisted*/
-	if (unlikely(filename_len == 0) ||
-	    unlikely(filename_len == MAX_EXEC_PATH))
-		return NOT_WHITELISTED;
-
-	/*Check if the entry is whitelisted*/
-
-	read_lock_irqsave(&whitelist_rwlock, flags);
+	return query->argv_needed != NULL && *query->argv_needed > 0;
+}
 
-	if ((!also_root) && current_is_root())
-		goto not_whitelisted;
+bool
+whitelist_applies(void)
+{
+	return READ_ONCE(also_root) || !current_is_root();
+}
 
-	row = whitelist;
-	while (row != NULL) {
-		if (row->filename_len == filename_len && (memcmp(row->data, filename, filename_len) == 0)) {
-			if (row->argv_start_len == 0)
-				goto whitelisted;
-			if (argv_size >= row->argv_start_len && (memcmp(ARGV_START(row), argv_start, row->argv_start_len) == 0))
-				goto whitelisted;
-		}
-		row = row->next;
-	}
+int
+is_whitelisted_exe(const struct exe_identity *id, const char *filename,
+		   size_t *argv_needed)
+{
+	struct white_query query = {
+		.argv_start = NULL,
+		.argv_size = 0,
+		.argv_needed = argv_needed,
+	};
+
+	*argv_needed = 0;
+	if (!whitelist_applies())
+		return NOT_WHITELISTED;
 
-not_whitelisted:
-	read_unlock_irqrestore(&whitelist_rwlock, flags);
+	return whitelist_lookup(id, filename, &query);
+}
 
-	return NOT_WHITELISTED;
+int
+is_whitelisted(const struct exe_identity *id, const char *filename,
+	       const char *argv_start, size_t argv_size)
+{
+	struct white_query query = {
+		.argv_start = argv_start,
+		.argv_size = argv_size,
+		.argv_needed = NULL,
+	};
 
-whitelisted:
-	read_unlock_irqrestore(&whitelist_rwlock, flags);
+	if (!whitelist_applies())
+		return NOT_WHITELISTED;
 
-	return WHITELISTED;
+	/*Check if the entry is whitelisted*/
+	return whitelist_lookup(id, filename, &query);
 }
 
 static char *
-whitelist_print(struct white_process *row, char * buf, size_t *avail)
-__must_hold(whitelist_rwlock)
+whitelist_print(const struct white_process *row, char * buf, size_t *avail)
 {
 	int ret;
 	size_t rem = *avail;
@@ -174,6 +219,7 @@ static int
 whitelist_root_param_set(const char *buf, const struct kernel_param *kp)
 #endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
 {
+	bool value;
 	int ret;
 
 	if (buf == NULL)
@@ -181,13 +227,13 @@ whitelist_root_param_set(const char *buf, const struct kernel_param *kp)
 
 	pr_info("[+] Modifying root whitelisting");
 
-	write_lock(&whitelist_rwlock);
-	ret = strtobool(buf, &also_root);
-	write_unlock(&whitelist_rwlock);
+	ret = strtobool(buf, &value);
+	if (ret == 0)
+		WRITE_ONCE(also_root, value);
 
 	if (ret != 0)
 		pr_info("[+] Invalid input");
-	else if (also_root)
+	else if (value)
 		pr_info("[+] Root actions are ignored like other");
 	else
 		pr_info("[+] Root actions are never ignored");
@@ -204,13 +250,7 @@ static int
 whitelist_root_param_get(char *buffer, const struct kernel_param *kp)
 # endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
 {
-	int ret;
-
-	read_lock(&whitelist_rwlock);
-	ret = sprintf(buffer, "%c", also_root ? 'Y' : 'N');
-	read_unlock(&whitelist_rwlock);
-
-	return ret;
+	return sprintf(buffer, "%c", READ_ONCE(also_root) ? 'Y' : 'N');
 }
 
 #if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
@@ -4,6 +4,7 @@
 #include <linux/moduleparam.h>
 #include <linux/sched.h>
 #include <linux/version.h>
+#include "exe_identity.h"
 
 #define WHITELIST_FAIL -1
 
@@ -18,6 +19,10 @@
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
 int whitelist_param_set(const char *buf, struct kernel_param *kp);
 int whitelist_param_get(char *buffer, struct kernel_param *kp);
+int whitelist_hits_param_set(const char *buf, struct kernel_param *kp);
+int whitelist_hits_param_get(char *buffer, struct kernel_param *kp);
+int whitelist_misses_param_set(const char *buf, struct kernel_param *kp);
+int whitelist_misses_param_get(char *buffer, struct kernel_param *kp);
 int whitelist_root_param_set(const char *buf, struct kernel_param *kp);
 int whitelist_root_param_get(char *buffer, struct kernel_param *kp);
 #else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
@@ -25,8 +30,38 @@ extern const struct kernel_param_ops whitelist_param;
 extern const struct kernel_param_ops whitelist_root_param;
 #endif /* if LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
 
-int is_whitelisted(const char *filename, const char *argv_start, size_t argv_size);
+/*
+ * False for executions by root, which are never ignored, unless
+ * whitelist_include_root is set.
+ */
+bool whitelist_applies(void);
+
+/*
+ * 'filename' can be NULL, in which case only the identity of the executable
+ * is checked. 'argv_start' can be NULL if the arguments are not known yet.
+ */
+int is_whitelisted(const struct exe_identity *id, const char *filename,
+		   const char *argv_start, size_t argv_size);
+
+/*
+ * Check an executable before copying its arguments. When no rule ignores it
+ * whatever its arguments, '*argv_needed' is the length of the longest argv
+ * start of its rules: only that much of argv is needed to decide, and 0 means
+ * that no rule can ignore it.
+ */
+int is_whitelisted_exe(const struct exe_identity *id, const char *filename,
+		       size_t *argv_needed);
+
+/*
+ * Changes after every update of the whitelist: a decision taken while it
+ * had a given value is only valid as long as it keeps it.
+ */
+unsigned int whitelist_generation(void);
 
 void destroy_whitelist(void);
 
+/* /dev/<module>_whitelist, to update the whitelist rule by rule or load a binary one */
+int whitelist_device_register(void);
+void whitelist_device_unregister(void);
+
 #endif /* __EXECLOG_WHITELIST__ */
@@ -0,0 +1 @@
+../lib/whitelist_blob.h
\ No newline at end of file
@@ -0,0 +1,229 @@
+#include <linux/err.h>
+#include <linux/kernel.h>
+#include <linux/sort.h>
+#include <linux/string.h>
+#include "whitelist_match.h"
+
+/*
+ * Compilation and check of the rules of an executable, included by
+ * whitelist.c after whitelist_helper.c (for white_alloc and white_free),
+ * and by src/tools/whitelist_match_harness.c.
+ */
+
+static void
+white_match_free(struct white_match *match)
+{
+	white_free(match);
+}
+
+/* Order the rules by argv start, shorter first on equal bytes */
+static int
+whiterow_cmp(const void *a, const void *b)
+{
+	const struct white_process *row_a = *(const struct white_process * const *)a;
+	const struct white_process *row_b = *(const struct white_process * const *)b;
+	int ret;
+
+	ret = memcmp(ARGV_START(row_a), ARGV_START(row_b),
+		     min(row_a->argv_start_len, row_b->argv_start_len));
+	if (ret != 0)
+		return ret;
+	if (row_a->argv_start_len != row_b->argv_start_len)
+		return (row_a->argv_start_len < row_b->argv_start_len) ? -1 : 1;
+	return 0;
+}
+
+/* Rules below a node of the trie, still to be inserted */
+struct white_pending {
+	u32 node     /** Node */;
+	u32 first    /** First rule, in sorted order */;
+	u32 last     /** Last rule (excluded) */;
+	size_t depth /** Length of the argv start leading to the node */;
+};
+
+/*
+ * Compile a few rules of an executable: the root of the trie only holds the
+ * rule without argv start, if any.
+ */
+static struct white_match *
+white_match_build_prefixes(struct white_process *rows, size_t nr_prefixes,
+			   size_t data_len, size_t max_len)
+__must_hold(whitelist_sanitylock)
+{
+	struct white_process *row;
+	struct white_match *match;
+	char *data;
+
+	match = white_alloc(sizeof(struct white_match) + sizeof(struct white_node) +
+			    nr_prefixes * sizeof(struct white_prefix) + data_len);
+	if (unlikely(match == NULL))
+		return ERR_PTR(-ENOMEM);
+
+	match->max_len = max_len;
+	match->nr_prefixes = 0;
+	match->prefixes = (struct white_prefix *)&match->nodes[1];
+	match->nr_nodes = 1;
+	match->nodes[0].row = NULL;
+	match->nodes[0].children = 1;
+	match->nodes[0].nr_children = 0;
+	match->nodes[0].byte = 0;
+	data = (char *)&match->prefixes[nr_prefixes];
+	for (row = rows; row != NULL; row = row->next) {
+		if (row->argv_start_len == 0) {
+			if (match->nodes[0].row == NULL)
+				match->nodes[0].row = row;
+			continue;
+		}
+		memcpy(data, ARGV_START(row), row->argv_start_len);
+		match->prefixes[match->nr_prefixes].start = data;
+		match->prefixes[match->nr_prefixes].len = row->argv_start_len;
+		match->prefixes[match->nr_prefixes].row = row;
+		++match->nr_prefixes;
+		data += row->argv_start_len;
+	}
+	return match;
+}
+
+/* Compile the rules of an executable */
+static struct white_match *
+white_match_build(struct white_process *rows) __must_hold(whitelist_sanitylock)
+{
+	struct white_process **sorted = NULL;
+	struct white_pending *pending = NULL;
+	struct white_process *row;
+	struct white_match *match;
+	struct white_node *node;
+	size_t nr_rows = 0;
+	size_t nr_prefixes = 0;
+	size_t max_nodes = 1;
+	size_t max_len = 0;
+	u32 head, tail, first, last;
+	u8 byte;
+	size_t i;
+
+	for (row = rows; row != NULL; row = row->next) {
+		++nr_rows;
+		if (row->argv_start_len > 0)
+			++nr_prefixes;
+		max_nodes += row->argv_start_len;
+		max_len = max(max_len, row->argv_start_len);
+	}
+	if (nr_prefixes < WHITE_TRIE_MIN_RULES)
+		return white_match_build_prefixes(rows, nr_prefixes,
+						  max_nodes - 1, max_len);
+	if (unlikely(max_nodes > U32_MAX || nr_rows > U32_MAX))
+		return ERR_PTR(-E2BIG);
+
+	match = white_alloc(sizeof(struct white_match) +
+			    max_nodes * sizeof(struct white_node));
+	sorted = white_alloc(nr_rows * sizeof(struct white_process *));
+	pending = white_alloc(max_nodes * sizeof(struct white_pending));
+	if (unlikely(match == NULL || sorted == NULL || pending == NULL)) {
+		white_free(match);
+		match = ERR_PTR(-ENOMEM);
+		goto out;
+	}
+
+	i = 0;
+	for (row = rows; row != NULL; row = row->next)
+		sorted[i++] = row;
+	sort(sorted, nr_rows, sizeof(struct white_process *), whiterow_cmp, NULL);
+
+	/*
+	 * Breadth first: the rules below a node share the argv start leading
+	 * to it, those ending at the node come first and the others are
+	 * grouped by their next byte, one child per group.
+	 */
+	match->max_len = max_len;
+	match->nr_prefixes = 0;
+	match->prefixes = NULL;
+	match->nr_nodes = 1;
+	match->nodes[0].row = NULL;
+	match->nodes[0].byte = 0;
+	pending[0].node = 0;
+	pending[0].first = 0;
+	pending[0].last = (u32)nr_rows;
+	pending[0].depth = 0;
+	for (head = 0, tail = 1; head < tail; ++head) {
+		node = &match->nodes[pending[head].node];
+		first = pending[head].first;
+		last = pending[head].last;
+
+		for (; first < last && sorted[first]->argv_start_len == pending[head].depth; ++first)
+			if (node->row == NULL)
+				node->row = sorted[first];
+
+		node->children = match->nr_nodes;
+		node->nr_children = 0;
+		while (first < last) {
+			byte = (u8)ARGV_START(sorted[first])[pending[head].depth];
+			pending[tail].node = match->nr_nodes;
+			pending[tail].first = first;
+			pending[tail].depth = pending[head].depth + 1;
+			while (first < last && (u8)ARGV_START(sorted[first])[pending[head].depth] == byte)
+				++first;
+			pending[tail].last = first;
+			++tail;
+
+			match->nodes[match->nr_nodes].row = NULL;
+			match->nodes[match->nr_nodes].byte = byte;
+			++match->nr_nodes;
+			++node->nr_children;
+		}
+	}
+
+out:
+	white_free(sorted);
+	white_free(pending);
+	return match;
+}
+
+static const struct white_process *
+white_match_check(const struct white_match *match, const void *data)
+__must_hold(RCU)
+{
+	const struct white_query *query = data;
+	const struct white_node *node = &match->nodes[0];
+	const struct white_prefix *prefix;
+	u32 low, high, mid;
+	size_t i;
+	u8 byte;
+
+	if (node->row != NULL)
+		return node->row;
+	if (query->argv_start == NULL) {
+		if (query->argv_needed != NULL && *query->argv_needed < match->max_len)
+			*query->argv_needed = match->max_len;
+		return NULL;
+	}
+
+	for (i = 0; i < match->nr_prefixes; ++i) {
+		prefix = &match->prefixes[i];
+		if (query->argv_size >= prefix->len &&
+		    memcmp(prefix->start, query->argv_start, prefix->len) == 0)
+			return prefix->row;
+	}
+	if (match->prefixes != NULL)
+		return NULL;
+
+	for (i = 0; i < query->argv_size; ++i) {
+		byte = (u8)query->argv_start[i];
+		low = node->children;
+		high = node->children + node->nr_children;
+		while (low < high) {
+			mid = low + (high - low) / 2;
+			if (match->nodes[mid].byte < byte)
+				low = mid + 1;
+			else
+				high = mid;
+		}
+		if (low == node->children + node->nr_children ||
+		    match->nodes[low].byte != byte)
+			return NULL;
+		node = &match->nodes[low];
+		/* The shortest argv start is enough */
+		if (node->row != NULL)
+			return node->row;
+	}
+	return NULL;
+}
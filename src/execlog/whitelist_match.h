@@ -0,0 +1,66 @@
+#ifndef __EXECLOG_WHITELIST_MATCH__
+#define __EXECLOG_WHITELIST_MATCH__
+
+#include <linux/types.h>
+
+/* Whitelist */
+struct white_process {
+	struct white_process *next;
+	struct white_process *next_free /** Next rule to free after a grace period */;
+	unsigned long __percpu *hits    /** Number of events ignored thanks to this rule */;
+	size_t filename_len;
+	size_t argv_start_len;
+	char data[];
+};
+#define ARGV_START(row) (row->data + row->filename_len + 1)
+
+/*
+ * Compiled rules of an executable
+ *
+ * Many argv starts of an executable are stored in a byte trie, the children
+ * of a node being contiguous and sorted by byte. The cost of a lookup is thus
+ * bounded by the length of the argv start, not by the number of rules.
+ * A few of them are just compared one after the other, which is cheaper:
+ * each comparison is a memcmp of bytes next to each other, while each byte
+ * of the trie is a binary search among the children of a node.
+ */
+
+/*
+ * Argv starts from which the trie is cheaper than comparing them in turn,
+ * as timed by src/tools/whitelist_match_harness (which overrides it)
+ */
+#ifndef WHITE_TRIE_MIN_RULES
+#define WHITE_TRIE_MIN_RULES 12
+#endif
+
+/* Start of argv whitelisted by a rule, when compared in turn */
+struct white_prefix {
+	const char *start               /** Argv start */;
+	size_t len                      /** Length of the argv start */;
+	const struct white_process *row /** Rule */;
+};
+
+/* Node of the trie, the root being the first node */
+struct white_node {
+	const struct white_process *row /** Rule whose argv start ends here, NULL if none */;
+	u32 children                    /** Index of the first child */;
+	u16 nr_children                 /** Number of children */;
+	u8 byte                         /** Byte leading to this node */;
+};
+
+struct white_match {
+	size_t max_len             /** Length of the longest argv start */;
+	size_t nr_prefixes         /** Argv starts compared in turn, 0 if they are in the trie */;
+	struct white_prefix *prefixes /** Argv starts compared in turn, followed by their data */;
+	u32 nr_nodes               /** Nodes of the trie, only the root without argv starts in it */;
+	struct white_node nodes[];
+};
+
+/* Arguments checked against the rules */
+struct white_query {
+	const char *argv_start;
+	size_t argv_size;
+	size_t *argv_needed /** Without argv, longest argv start of the rules found, or NULL */;
+};
+
+#endif /* __EXECLOG_WHITELIST_MATCH__ */
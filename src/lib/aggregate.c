@@ -0,0 +1,415 @@
+#define pr_fmt(fmt) MODULE_NAME ": " fmt
+
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/vmalloc.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/clock.h>
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0) */
+#include "aggregate.h"
+#include "sparse_compat.h"
+
+/*
+ * Aggregation of repeated events.
+ *
+ * The first event with a given key is logged and opens a window, during which
+ * the events with the same key are only counted. Once the window is closed,
+ * the count is reported in one summary and the next event is logged again.
+ *
+ * Each CPU owns a set associative table, indexed by a hash of the key: the
+ * memory used is bounded, the least recently seen entry of a set being
+ * evicted (and reported) when a new key needs its place. A worker reports
+ * and frees the entries whose window is closed, so that no count is held
+ * longer than about one window, even if the event never happens again.
+ *
+ * Tables are only allocated once aggregation is enabled, and only freed when
+ * the module is removed. Each of them is protected by its own lock, only
+ * contended by the worker. Keys are not shared between CPUs: an event
+ * repeated on several CPUs is logged, and summarized, once per CPU.
+ */
+
+struct aggregate_entry {
+	u64 start                /** Time of the logged event, opening the window */;
+	u32 hash                 /** Hash of the key */;
+	struct aggregate_summary summary /** Key and repetitions */;
+};
+
+struct aggregate_table {
+	spinlock_t lock;
+	struct aggregate_entry sets[1 << AGGREGATE_BITS][AGGREGATE_WAYS];
+};
+
+struct aggregate_stats {
+	unsigned long aggregated /** Events counted instead of logged */;
+	unsigned long summaries  /** Summaries reported */;
+	unsigned long evictions  /** Entries evicted before their window was closed */;
+};
+
+static DEFINE_PER_CPU(struct aggregate_table *, aggregate_tables);
+static DEFINE_PER_CPU(struct aggregate_stats, aggregate_stats);
+
+/* Length of the window in ms, and in ns for the fast path (0 disables aggregation) */
+static unsigned int aggregate_window_ms;
+static u64 aggregate_window;
+
+/* Serializes the updates of the window and the allocation of the tables */
+static DEFINE_MUTEX(aggregate_lock);
+static bool aggregate_allocated;
+
+static void aggregate_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(aggregate_work, aggregate_work_fn);
+
+/**********************************/
+/*            Tools               */
+/**********************************/
+
+/* Time of the last event of an entry, for the LRU */
+static inline u64
+aggregate_seen(const struct aggregate_entry *entry)
+{
+	return (entry->summary.count == 0) ? entry->start : entry->summary.last;
+}
+
+static inline bool
+aggregate_match(const struct aggregate_entry *entry, u32 hash,
+		const void *key, size_t key_len)
+{
+	return entry->hash == hash && entry->summary.key_len == key_len &&
+	       memcmp(entry->summary.key, key, key_len) == 0;
+}
+
+/* Report the repetitions of an entry, if any, and free it */
+static void
+aggregate_close(struct aggregate_entry *entry)
+{
+	if (entry->summary.count != 0) {
+		aggregate_report(&entry->summary);
+		this_cpu_inc(aggregate_stats.summaries);
+	}
+	entry->summary.key_len = 0;
+}
+
+/* Open the window of an entry, for an event being logged */
+static void
+aggregate_open(struct aggregate_entry *entry, u32 hash,
+	       const void *key, size_t key_len, u64 nsec)
+{
+	entry->start = nsec;
+	entry->hash = hash;
+	entry->summary.count = 0;
+	entry->summary.key_len = key_len;
+	memcpy(entry->summary.key, key, key_len);
+}
+
+/**********************************/
+/*           Fast path            */
+/**********************************/
+
+bool
+aggregate_enabled(void)
+{
+	return READ_ONCE(aggregate_window) != 0;
+}
+
+bool
+aggregate_event(const void *key, size_t key_len, u64 nsec)
+{
+	struct aggregate_table *table;
+	struct aggregate_entry *set, *entry, *victim = NULL;
+	unsigned long flags;
+	u64 window;
+	u32 hash;
+	bool repeated = false;
+	unsigned int i;
+
+	window = READ_ONCE(aggregate_window);
+	if (likely(window == 0) || unlikely(key_len == 0 || key_len > AGGREGATE_KEY_SIZE))
+		return false;
+	/* Tables are allocated before the window is set */
+	smp_rmb();
+
+	hash = jhash(key, key_len, 0);
+	table = this_cpu_read(aggregate_tables);
+	if (unlikely(table == NULL))
+		return false;
+
+	spin_lock_irqsave(&table->lock, flags);
+	set = table->sets[hash & ((1 << AGGREGATE_BITS) - 1)];
+	for (i = 0; i < AGGREGATE_WAYS; ++i) {
+		entry = &set[i];
+		if (entry->summary.key_len == 0) {
+			if (victim == NULL || victim->summary.key_len != 0)
+				victim = entry;
+			continue;
+		}
+		if (aggregate_match(entry, hash, key, key_len))
+			break;
+		if (victim == NULL ||
+		    (victim->summary.key_len != 0 &&
+		     aggregate_seen(entry) < aggregate_seen(victim)))
+			victim = entry;
+	}
+
+	if (i < AGGREGATE_WAYS) {
+		/* Events can be logged late (deferred) or on another CPU: be lenient */
+		if ((s64)(nsec - entry->start) < (s64)window) {
+			if (entry->summary.count == 0) {
+				entry->summary.first = nsec;
+				entry->summary.last = nsec;
+			} else if ((s64)(nsec - entry->summary.first) < 0) {
+				entry->summary.first = nsec;
+			} else if ((s64)(nsec - entry->summary.last) > 0) {
+				entry->summary.last = nsec;
+			}
+			if (likely(entry->summary.count != U32_MAX))
+				++entry->summary.count;
+			this_cpu_inc(aggregate_stats.aggregated);
+			repeated = true;
+		} else {
+			aggregate_close(entry);
+			aggregate_open(entry, hash, key, key_len, nsec);
+		}
+	} else {
+		if (victim->summary.key_len != 0) {
+			this_cpu_inc(aggregate_stats.evictions);
+			aggregate_close(victim);
+		}
+		aggregate_open(victim, hash, key, key_len, nsec);
+	}
+	spin_unlock_irqrestore(&table->lock, flags);
+
+	return repeated;
+}
+
+/**********************************/
+/*      Closing the windows       */
+/**********************************/
+
+/* Close the entries of all the tables older than 'window', all of them if 0 */
+static void
+aggregate_flush(u64 window)
+{
+	struct aggregate_table *table;
+	struct aggregate_entry *entry;
+	unsigned long flags;
+	u64 now;
+	unsigned int i, j;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		table = per_cpu(aggregate_tables, cpu);
+		if (table == NULL)
+			continue;
+
+		spin_lock_irqsave(&table->lock, flags);
+		now = local_clock();
+		for (i = 0; i < (1 << AGGREGATE_BITS); ++i) {
+			for (j = 0; j < AGGREGATE_WAYS; ++j) {
+				entry = &table->sets[i][j];
+				if (entry->summary.key_len == 0)
+					continue;
+				if (window == 0 || (s64)(now - entry->start) >= (s64)window)
+					aggregate_close(entry);
+			}
+		}
+		spin_unlock_irqrestore(&table->lock, flags);
+	}
+}
+
+/* Period of the worker: the window, at most one second */
+static unsigned long
+aggregate_period(unsigned int window_ms)
+{
+	unsigned long period = msecs_to_jiffies(min(window_ms, 1000U));
+
+	return (period == 0) ? 1 : period;
+}
+
+static void
+aggregate_work_fn(struct work_struct *work)
+{
+	unsigned int window_ms = READ_ONCE(aggregate_window_ms);
+
+	/* Once disabled, report everything left */
+	aggregate_flush((u64)window_ms * NSEC_PER_MSEC);
+	if (window_ms != 0)
+		schedule_delayed_work(&aggregate_work, aggregate_period(window_ms));
+}
+
+static int
+aggregate_alloc(void)
+__must_hold(aggregate_lock)
+{
+	struct aggregate_table *table;
+	int cpu;
+
+	if (aggregate_allocated)
+		return 0;
+
+	for_each_possible_cpu(cpu) {
+		if (per_cpu(aggregate_tables, cpu) != NULL)
+			continue;
+		table = vmalloc(sizeof(*table));
+		if (table == NULL)
+			return -ENOMEM;
+		memset(table, 0, sizeof(*table));
+		spin_lock_init(&table->lock);
+		per_cpu(aggregate_tables, cpu) = table;
+	}
+	aggregate_allocated = true;
+	return 0;
+}
+
+void
+aggregate_destroy(void)
+{
+	struct aggregate_table *table;
+	int cpu;
+
+	mutex_lock(&aggregate_lock);
+	WRITE_ONCE(aggregate_window, 0);
+	WRITE_ONCE(aggregate_window_ms, 0);
+	mutex_unlock(&aggregate_lock);
+
+	cancel_delayed_work_sync(&aggregate_work);
+	aggregate_flush(0);
+
+	for_each_possible_cpu(cpu) {
+		table = per_cpu(aggregate_tables, cpu);
+		per_cpu(aggregate_tables, cpu) = NULL;
+		vfree(table);
+	}
+	aggregate_allocated = false;
+}
+
+/**********************************/
+/*      Module parameters         */
+/**********************************/
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+aggregate_window_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+aggregate_window_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	unsigned int value;
+	int ret;
+
+	ret = kstrtouint(buf, 0, &value);
+	if (ret < 0)
+		return ret;
+
+	mutex_lock(&aggregate_lock);
+	if (value != 0) {
+		ret = aggregate_alloc();
+		if (ret != 0) {
+			mutex_unlock(&aggregate_lock);
+			pr_err("[-] Cannot allocate the aggregation tables\n");
+			return ret;
+		}
+	}
+	/* The tables must be visible before the window */
+	smp_wmb();
+	WRITE_ONCE(aggregate_window_ms, value);
+	WRITE_ONCE(aggregate_window, (u64)value * NSEC_PER_MSEC);
+	mutex_unlock(&aggregate_lock);
+
+	/* Also run once disabled, to report the pending repetitions */
+	schedule_delayed_work(&aggregate_work, aggregate_period(value));
+	if (value == 0)
+		pr_info("[+] Aggregation disabled\n");
+	else
+		pr_info("[+] Aggregating repeated events over %u ms\n", value);
+	return 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+aggregate_window_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+aggregate_window_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return scnprintf(buffer, PAGE_SIZE, "%u", READ_ONCE(aggregate_window_ms));
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+static const struct kernel_param_ops aggregate_window_param = {
+	.set = aggregate_window_param_set,
+	.get = aggregate_window_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(aggregate_window, &aggregate_window_param_set, &aggregate_window_param_get, NULL, 0600);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(aggregate_window, &aggregate_window_param, NULL, 0600);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(aggregate_window, "Window, in ms, during which repetitions of"
+		 " a logged event are only counted, and reported in one summary"
+		 " once it is closed (0, the default, disables aggregation)."
+		 " Each CPU aggregates its own events: an event repeated on n"
+		 " CPUs is logged and summarized up to n times per window");
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+aggregate_stats_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+aggregate_stats_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return -EPERM;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+aggregate_stats_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+aggregate_stats_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	unsigned long aggregated = 0, summaries = 0, evictions = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct aggregate_stats *stats = per_cpu_ptr(&aggregate_stats, cpu);
+
+		aggregated += READ_ONCE(stats->aggregated);
+		summaries += READ_ONCE(stats->summaries);
+		evictions += READ_ONCE(stats->evictions);
+	}
+
+	return scnprintf(buffer, PAGE_SIZE, "aggregated:%lu summaries:%lu evictions:%lu",
+			 aggregated, summaries, evictions);
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+static const struct kernel_param_ops aggregate_stats_param = {
+	.set = aggregate_stats_param_set,
+	.get = aggregate_stats_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(aggregate_stats, &aggregate_stats_param_set, &aggregate_stats_param_get, NULL, 0400);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(aggregate_stats, &aggregate_stats_param, NULL, 0400);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(aggregate_stats, "Statistics of the aggregation of repeated"
+		 " events (events counted instead of logged, summaries reported and"
+		 " entries evicted before the end of their window)");
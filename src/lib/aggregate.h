@@ -0,0 +1,53 @@
+#ifndef __TOOL_AGGREGATE__
+#define __TOOL_AGGREGATE__
+
+#include <linux/moduleparam.h>
+#include <linux/types.h>
+#include <linux/version.h>
+
+/* Number of sets of the aggregation table of each CPU (power of 2) */
+#define AGGREGATE_BITS 5
+
+/* Number of entries per set, the least recently seen one is evicted */
+#define AGGREGATE_WAYS 4
+
+/* Maximum size of a key, events with larger keys are never aggregated */
+#define AGGREGATE_KEY_SIZE 256
+
+/* Repetitions of an event within its window */
+struct aggregate_summary {
+	u64 first              /** Time of the first repetition */;
+	u64 last               /** Time of the last repetition */;
+	u32 count              /** Number of repetitions, the logged event excluded */;
+	size_t key_len         /** Length of the key, 0 if the entry is free */;
+	char key[AGGREGATE_KEY_SIZE] /** Key given to aggregate_event */;
+};
+
+/* Aggregation is enabled, keys can be built */
+bool aggregate_enabled(void);
+
+/**
+ * Check if an event identified by 'key' repeats one logged less than a
+ * window ago, in which case it is counted and must not be logged.
+ * 'nsec' is the time of the event (local_clock). Can be called from probes.
+ */
+bool aggregate_event(const void *key, size_t key_len, u64 nsec);
+
+/**
+ * Implemented by the module: report the repetitions of an event, once its
+ * window is closed or when its entry is evicted. Called with a spinlock held
+ * and interrupts disabled, from the context of any event or from a worker.
+ */
+void aggregate_report(const struct aggregate_summary *summary);
+
+/* Report everything pending and free the tables, once aggregate_event can't be called anymore */
+void aggregate_destroy(void);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int aggregate_window_param_set(const char *buf, struct kernel_param *kp);
+int aggregate_window_param_get(char *buffer, struct kernel_param *kp);
+int aggregate_stats_param_set(const char *buf, struct kernel_param *kp);
+int aggregate_stats_param_get(char *buffer, struct kernel_param *kp);
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36) */
+
+#endif /* __TOOL_AGGREGATE__ */
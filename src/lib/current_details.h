@@ -1,8 +1,12 @@
 #ifndef __TOOL_CURRENT_DATA__
 #define __TOOL_CURRENT_DATA__
 
+#include <linux/cred.h>
+#include <linux/percpu.h>
+#include <linux/pid.h>
 #include <linux/tty.h>
 #include <linux/version.h>
+#include "tty_name.h"
 
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
 #include <linux/sched/signal.h>
@@ -18,59 +22,123 @@ struct current_details {
 	uid_t euid /** EUID of 'current' */;
 	uid_t gid  /** GID of 'current' */;
 	uid_t egid /** EGID of 'current' */;
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
-	const char *tty; /** TTY, if existant, used by 'current', '\0' otherwise */;
-#else /* LINUX_VERSION_CODE < KERNEL_VERSION(4, 2, 0) */
-	char tty[64] /** TTY, if existant, used by 'current', '\0' otherwise */;
-#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(4, 2, 0) */
+	dev_t tty  /** Device number of the TTY used by 'current', 0 if none. The name is resolved when printing */;
 };
 
 #define CURRENT_DETAILS_FORMAT "p:%d s:%d pp:%d u:%d g:%d eu:%d eg:%d t:%s"
-#define CURRENT_DETAILS_ARGS(details) details.pid, details.sid, details.ppid, \
-				      details.uid, details.gid, \
-				      details.euid, details.egid, \
-				      details.tty
+#define CURRENT_DETAILS_ARGS(details, tty_name) details.pid, details.sid, details.ppid, \
+						details.uid, details.gid, \
+						details.euid, details.egid, \
+						tty_name
 
-static const char null_tty[] = "NULL tty";
-static const char null_tty_short[] = "NULL";
+/* Real UID of 'current', as logged in the details */
+static inline uid_t
+get_current_uid(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 5, 0)
+	return current_uid().val;
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 5, 0) */
+	return current_uid();
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 5, 0) */
+}
+
+/* Name of the TTY used by 'current', for immediate printing */
+static inline const char *
+current_tty_name(char *buffer)
+{
+	struct tty_struct *tty = current->signal->tty;
+
+	if (tty == NULL)
+		return null_tty_short;
+	copy_tty_name(tty, buffer);
+	return buffer;
+}
+
+/*
+ * Per CPU cache of the details that are expensive to compute and nearly
+ * never change between two events of the same task. Credentials are not
+ * cached: a new cred can be allocated where an old one was freed, making
+ * them impossible to validate cheaply, and they only cost one dereference.
+ * A task can be freed and another one allocated at the same address, with
+ * the same PID once PIDs wrap: the start time of the task tells them apart.
+ */
+struct current_details_cache {
+	struct task_struct *task /** Task the cache was filled for */;
+	pid_t pid                /** PID of that task */;
+	u64 start_time           /** Start time of that task */;
+	struct pid *session      /** Session of that task */;
+	pid_t sid                /** SID of that session, as seen by that task */;
+};
+
+static DEFINE_PER_CPU(struct current_details_cache, current_details_cache);
+
+static inline u64
+current_start_time(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 17, 0)
+	return current->start_time;
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 17, 0) */
+	return timespec_to_ns(&current->start_time);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 17, 0) */
+}
 
 static inline void
 fill_current_details(struct current_details *details)
 {
-	struct task_struct * parent;
+	struct task_struct *parent;
+	struct tty_struct *tty;
+	struct pid *session;
+	struct current_details_cache *cache;
+	const struct cred *cred;
+	u64 start_time;
+
+	details->nsec = local_clock();
+	details->pid = current->pid;
+
+	cred = current_cred();
 #if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 5, 0)
-	kuid_t kuid;
-	kgid_t kgid;
-
-	current_uid_gid(&kuid, &kgid);
-	details->uid = kuid.val;
-	details->gid = kgid.val;
-	current_euid_egid(&kuid, &kgid);
-	details->euid = kuid.val;
-	details->egid = kgid.val;
+	details->uid = cred->uid.val;
+	details->gid = cred->gid.val;
+	details->euid = cred->euid.val;
+	details->egid = cred->egid.val;
 #else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 5, 0) */
-	current_uid_gid(&details->uid, &details->gid);
-	current_euid_egid(&details->euid, &details->egid);
+	details->uid = cred->uid;
+	details->gid = cred->gid;
+	details->euid = cred->euid;
+	details->egid = cred->egid;
 #endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 5, 0) */
-	details->nsec = local_clock();
-	details->pid = current->pid;
+
 	rcu_read_lock();
 	parent = rcu_dereference(current->real_parent);
 	if (likely(parent != NULL))
 		details->ppid = parent->pid;
 	else
 		details->ppid = 0;
+
+	session = task_session(current);
+	start_time = current_start_time();
+	cache = get_cpu_ptr(&current_details_cache);
+	if (likely(cache->task == current && cache->pid == current->pid &&
+		   cache->start_time == start_time &&
+		   cache->session == session)) {
+		details->sid = cache->sid;
+	} else {
+		details->sid = pid_vnr(session);
+		cache->task = current;
+		cache->pid = current->pid;
+		cache->start_time = start_time;
+		cache->session = session;
+		cache->sid = details->sid;
+	}
+	put_cpu_ptr(&current_details_cache);
 	rcu_read_unlock();
-	details->sid = task_session_vnr(current);
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
-	details->tty = tty_name(current->signal->tty);
-	if (strcmp(details->tty, null_tty) == 0)
-		details->tty = null_tty_short;
-#else /* LINUX_VERSION_CODE < KERNEL_VERSION(4, 2, 0) */
-	tty_name(current->signal->tty, details->tty);
-	if (memcmp(details->tty, null_tty, sizeof(null_tty) - 1) == 0)
-		details->tty[4] = '\0';
-#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(4, 2, 0) */
+
+	/* Only keep the device number, the name is resolved when printing */
+	tty = current->signal->tty;
+	if (tty == NULL)
+		details->tty = 0;
+	else
+		details->tty = tty_devnum(tty);
 }
 
 #endif /* __TOOL_CURRENT_DATA__ */
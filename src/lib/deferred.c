@@ -0,0 +1,96 @@
+#include <linux/version.h>
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0)
+#include <linux/atomic.h>
+#include <linux/kallsyms.h>
+#include <linux/kernel.h>
+#include <linux/kprobes.h>
+#include <linux/module.h>
+#include <linux/sched.h>
+#include <linux/task_work.h>
+#include <linux/wait.h>
+#include "deferred.h"
+#include "sparse_compat.h"
+
+/* 'notify' is a bool before 5.10, then TWA_RESUME (1) */
+typedef int (*task_work_add_t)(struct task_struct *task, struct callback_head *work, int notify);
+
+static task_work_add_t deferred_task_work_add = NULL;
+
+/* Works queued and not done yet */
+static atomic_t deferred_pending = ATOMIC_INIT(0);
+static DECLARE_WAIT_QUEUE_HEAD(deferred_wait_queue);
+
+/* kallsyms_lookup_name is not exported since 5.7: a kprobe finds the address */
+static unsigned long
+deferred_lookup(const char *name)
+{
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 7, 0)
+	return kallsyms_lookup_name(name);
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(5, 7, 0) */
+	struct kprobe probe = {
+		.symbol_name = name,
+	};
+	unsigned long addr;
+
+	if (register_kprobe(&probe) < 0)
+		return 0;
+	addr = (unsigned long) probe.addr;
+	unregister_kprobe(&probe);
+	return addr;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(5, 7, 0) */
+}
+
+int
+deferred_init(void)
+{
+	deferred_task_work_add = (task_work_add_t) deferred_lookup("task_work_add");
+	if (deferred_task_work_add == NULL) {
+		pr_err("[-] Unable to find task_work_add, deferred work disabled\n");
+		return -ENOENT;
+	}
+	return 0;
+}
+
+int
+deferred_queue(struct callback_head *work, task_work_func_t func)
+{
+	int err;
+
+	if (unlikely(deferred_task_work_add == NULL))
+		return -ENOENT;
+	/* Kernel threads never return to userspace */
+	if (unlikely(current->flags & PF_KTHREAD))
+		return -EINVAL;
+
+	init_task_work(work, func);
+	/* The module can't be removed while 'func' may run: rmmod fails with EBUSY */
+	__module_get(THIS_MODULE);
+	atomic_inc(&deferred_pending);
+	err = deferred_task_work_add(current, work, 1);
+	if (unlikely(err < 0))
+		deferred_done();
+	return err;
+}
+
+void
+deferred_done(void)
+{
+	if (atomic_dec_and_test(&deferred_pending))
+		wake_up(&deferred_wait_queue);
+	module_put(THIS_MODULE);
+}
+
+int
+deferred_wait(void)
+{
+	int err;
+
+	err = wait_event_killable(deferred_wait_queue,
+				  atomic_read(&deferred_pending) == 0);
+	if (err != 0)
+		pr_err("[-] Interrupted while waiting for %d deferred works\n",
+		       atomic_read(&deferred_pending));
+	return err;
+}
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0) */
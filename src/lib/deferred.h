@@ -0,0 +1,36 @@
+#ifndef __TOOL_DEFERRED__
+#define __TOOL_DEFERRED__
+
+#include <linux/version.h>
+
+/*
+ * Work run by the current task before it returns to userspace, where it can
+ * sleep and fault user pages in (task_work, Linux 3.7 and later).
+ * task_work_add is not exported to modules: it is looked up when the
+ * module is loaded.
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0)
+#include <linux/task_work.h>
+
+/* Look task_work_add up, return 0 if deferred work is available */
+int deferred_init(void);
+
+/*
+ * Run 'func' in the current task before it returns to userspace, or exits.
+ * A reference on the module is held until 'func' calls deferred_done, which
+ * must be its last action: it may be the last reference.
+ * Return 0 on success, a negative value if the work cannot be queued.
+ */
+int deferred_queue(struct callback_head *work, task_work_func_t func);
+
+void deferred_done(void);
+
+/*
+ * Wait for all the queued works, once nothing can queue new ones. Only
+ * needed when init fails, rmmod can't run while works are queued. Returns
+ * non 0 if the wait was killed.
+ */
+int deferred_wait(void);
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0) */
+
+#endif /* __TOOL_DEFERRED__ */
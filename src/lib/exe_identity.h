@@ -0,0 +1,128 @@
+#ifndef __TOOL_EXE_IDENTITY__
+#define __TOOL_EXE_IDENTITY__
+
+#include <linux/file.h>
+#include <linux/fs.h>
+#include <linux/mm.h>
+#include <linux/mm_types.h>
+#include <linux/namei.h>
+#include <linux/path.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/string.h>
+#include <linux/version.h>
+
+/* Identity of an executable, independent of the path used to reach it */
+struct exe_identity {
+	dev_t dev          /** Device of the inode */;
+	unsigned long ino  /** Inode number, 0 if unknown */;
+	u32 generation     /** Generation of the inode, in case the number is reused */;
+};
+
+static inline void
+exe_identity_clear(struct exe_identity *id)
+{
+	memset(id, 0, sizeof(*id));
+}
+
+static inline bool
+exe_identity_known(const struct exe_identity *id)
+{
+	return id->ino != 0;
+}
+
+static inline bool
+exe_identity_equal(const struct exe_identity *a, const struct exe_identity *b)
+{
+	return a->ino == b->ino && a->dev == b->dev &&
+	       a->generation == b->generation && a->ino != 0;
+}
+
+static inline void
+exe_identity_of_inode(struct exe_identity *id, const struct inode *inode)
+{
+	id->dev = inode->i_sb->s_dev;
+	id->ino = inode->i_ino;
+	id->generation = inode->i_generation;
+}
+
+/* Identity of an open file, 'file' can be NULL */
+static inline void
+exe_identity_of_file(struct exe_identity *id, struct file *file)
+{
+	if (unlikely(file == NULL || file->f_path.dentry->d_inode == NULL))
+		exe_identity_clear(id);
+	else
+		exe_identity_of_inode(id, file->f_path.dentry->d_inode);
+}
+
+/* Identity of the executable of 'mm', can be called from probe context */
+static inline void
+exe_identity_of_mm(struct exe_identity *id, struct mm_struct *mm)
+{
+	if (unlikely(mm == NULL)) {
+		exe_identity_clear(id);
+		return;
+	}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+	rcu_read_lock();
+	exe_identity_of_file(id, rcu_dereference(mm->exe_file));
+	rcu_read_unlock();
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(4, 1, 0) */
+	if (!down_read_trylock(&mm->mmap_sem)) {
+		/* It's lock, we can't sleep here to get it, so just give up */
+		exe_identity_clear(id);
+		return;
+	}
+	exe_identity_of_file(id, mm->exe_file);
+	up_read(&mm->mmap_sem);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(4, 1, 0) */
+}
+
+/*
+ * Identity of the executable of 'task', can be called from probe context.
+ * The mm of another task can go away at any time: a reference is held on
+ * its executable while it is read.
+ */
+static inline void
+exe_identity_of_task(struct exe_identity *id, struct task_struct *task)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 8, 0)
+	struct file *exe_file = get_task_exe_file(task);
+
+	exe_identity_of_file(id, exe_file);
+	if (exe_file != NULL)
+		fput(exe_file);
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(4, 8, 0) */
+	/* The task lock keeps its mm alive */
+	task_lock(task);
+	exe_identity_of_mm(id, task->mm);
+	task_unlock(task);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(4, 8, 0) */
+}
+
+/**
+ * Resolve the identity of the file at 'pathname'. Might sleep.
+ * Returns 0 on success, the identity is cleared on failure.
+ */
+static inline int
+exe_identity_resolve(struct exe_identity *id, const char *pathname)
+{
+	struct path path;
+	int err;
+
+	err = kern_path(pathname, LOOKUP_FOLLOW, &path);
+	if (err != 0) {
+		exe_identity_clear(id);
+		return err;
+	}
+	if (likely(path.dentry->d_inode != NULL))
+		exe_identity_of_inode(id, path.dentry->d_inode);
+	else
+		exe_identity_clear(id);
+	path_put(&path);
+	return 0;
+}
+
+#endif /* __TOOL_EXE_IDENTITY__ */
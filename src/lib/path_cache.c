@@ -0,0 +1,454 @@
+#define pr_fmt(fmt) MODULE_NAME ": " fmt
+
+#include <linux/dcache.h>
+#include <linux/fs.h>
+#include <linux/fs_struct.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mount.h>
+#include <linux/path.h>
+#include <linux/percpu.h>
+#include <linux/rculist.h>
+#include <linux/sched.h>
+#include <linux/seqlock.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+#include "path_cache.h"
+#include "sparse_compat.h"
+
+/*
+ * Cache of the paths of executables, shared by the probes.
+ *
+ * Entries are indexed by the identity of the inode (device, inode number and
+ * generation) and validated against the exact mount and dentry of the file,
+ * as well as the root of the calling process (d_path is relative to it).
+ *
+ * A path can only change when the file or one of its parents is renamed,
+ * when one of the mounts it is reached through is moved, or when the file is
+ * unlinked: every entry records a signature of the dentries from the file up
+ * to the root of the process (parent and name of each of them), crossing the
+ * mounts on the way (parent mount and mountpoint of each of them). It is
+ * considered stale as soon as it changes or the dentry gets unlinked. Renames
+ * elsewhere on the system do not invalidate it. The global rename_lock
+ * sequence only detects a rename racing a lookup, or the path being resolved.
+ * Stale entries are resolved again on their next use.
+ *
+ * Readers only use RCU, writers are serialized by path_cache_lock.
+ */
+
+struct path_cache_key {
+	dev_t dev                   /** Device of the inode */;
+	unsigned long ino           /** Inode number */;
+	u32 generation              /** Generation of the inode, in case the number is reused */;
+	struct vfsmount *mnt        /** Mount the file was accessed from */;
+	struct dentry *dentry       /** Dentry of the file */;
+	struct vfsmount *root_mnt   /** Mount of the root of the process */;
+	struct dentry *root_dentry  /** Dentry of the root of the process */;
+};
+
+struct path_cache_entry {
+	struct hlist_node hlist     /** Entry in the bucket */;
+	struct rcu_head rcu         /** Delayed free */;
+	struct path_cache_key key   /** Identity of the file */;
+	u32 signature               /** Signature of the dentries of the path when it was resolved */;
+	int len                     /** Length of the path, excluding the tailing '\0' */;
+	char path[]                 /** Path of the file */;
+};
+
+struct path_cache_stats {
+	unsigned long hits          /** Paths served from the cache */;
+	unsigned long misses        /** Paths not found in the cache */;
+	unsigned long invalidations /** Paths found stale in the cache (renamed or unlinked) */;
+};
+
+static struct hlist_head path_cache[1 << PATH_CACHE_BITS];
+static DEFINE_SPINLOCK(path_cache_lock);
+static DEFINE_PER_CPU(struct path_cache_stats, path_cache_stats);
+
+/**********************************/
+/*            Tools               */
+/**********************************/
+
+static void
+path_cache_fill_key(struct path_cache_key *key, struct file *file)
+{
+	struct inode *inode = file->f_path.dentry->d_inode;
+	struct fs_struct *fs = current->fs;
+
+	key->dev = inode->i_sb->s_dev;
+	key->ino = inode->i_ino;
+	key->generation = inode->i_generation;
+	key->mnt = file->f_path.mnt;
+	key->dentry = file->f_path.dentry;
+
+	/* Only 'current' can change its own fs_struct */
+	if (unlikely(fs == NULL)) {
+		key->root_mnt = NULL;
+		key->root_dentry = NULL;
+		return;
+	}
+	spin_lock(&fs->lock);
+	key->root_mnt = fs->root.mnt;
+	key->root_dentry = fs->root.dentry;
+	spin_unlock(&fs->lock);
+}
+
+static inline struct hlist_head *
+path_cache_bucket(const struct path_cache_key *key)
+{
+	return &path_cache[hash_long(key->ino ^ key->dev, PATH_CACHE_BITS)];
+}
+
+static inline bool
+path_cache_match(const struct path_cache_entry *entry,
+		 const struct path_cache_key *key)
+{
+	return entry->key.ino == key->ino &&
+	       entry->key.dev == key->dev &&
+	       entry->key.generation == key->generation &&
+	       entry->key.dentry == key->dentry &&
+	       entry->key.mnt == key->mnt &&
+	       entry->key.root_dentry == key->root_dentry &&
+	       entry->key.root_mnt == key->root_mnt;
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 13, 0)
+/*
+ * Beginning of struct mount (fs/mount.h), which is private to the VFS:
+ * 'mnt_hash' is a list_head or an hlist_node depending on the version, two
+ * pointers either way. Mounts are freed after an RCU grace period.
+ */
+struct path_cache_mount {
+	struct hlist_node mnt_hash;
+	struct path_cache_mount *mnt_parent;
+	struct dentry *mnt_mountpoint;
+	struct vfsmount mnt;
+};
+
+/*
+ * Cross from the root of '*mnt' to where it is mounted, adding the mount to
+ * the signature. Returns false at the top of the mount tree.
+ */
+static inline bool
+path_cache_mount_up(const struct vfsmount **mnt, const struct dentry **dentry,
+		    u32 *sig)
+{
+	const struct path_cache_mount *mount, *parent;
+
+	mount = container_of(*mnt, struct path_cache_mount, mnt);
+	parent = READ_ONCE(mount->mnt_parent);
+	if (parent == mount)
+		return false;
+	*dentry = READ_ONCE(mount->mnt_mountpoint);
+	*mnt = &parent->mnt;
+	*sig = jhash_2words((u32)(unsigned long)parent,
+			    (u32)(unsigned long)*dentry, *sig);
+	return true;
+}
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0) */
+/* Mounts are freed right away: the mount tree can't be walked under RCU */
+static inline bool
+path_cache_mount_up(const struct vfsmount **mnt, const struct dentry **dentry,
+		    u32 *sig)
+{
+	return false;
+}
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 13, 0) */
+
+/*
+ * Signature of the parents and names of the dentry of 'key' and its
+ * ancestors, and of the mounts crossed, up to the root of the process. Must
+ * be called under rcu_read_lock, and checked with the rename_lock sequence: a
+ * concurrent rename can show an inconsistent chain. Returns false if the
+ * chain is too deep (or looped while renamed), or does not reach the root of
+ * the process: such paths are not cached.
+ */
+static bool
+path_cache_signature(const struct path_cache_key *key, u32 *signature)
+{
+	const struct dentry *dentry = key->dentry, *parent;
+	const struct vfsmount *mnt = key->mnt;
+	unsigned int depth;
+	u32 sig = 0;
+
+	for (depth = 0; depth < PATH_CACHE_MAX_DEPTH; ++depth) {
+		/* d_path stops there */
+		if (dentry == key->root_dentry && mnt == key->root_mnt) {
+			*signature = sig;
+			return true;
+		}
+		if (dentry == mnt->mnt_root) {
+			if (!path_cache_mount_up(&mnt, &dentry, &sig))
+				return false;
+			continue;
+		}
+		parent = READ_ONCE(dentry->d_parent);
+		if (parent == dentry)
+			return false;
+		sig = jhash_3words((u32)(unsigned long)parent,
+				   READ_ONCE(dentry->d_name.hash),
+				   READ_ONCE(dentry->d_name.len), sig);
+		dentry = parent;
+	}
+	return false;
+}
+
+static void
+path_cache_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct path_cache_entry, rcu));
+}
+
+static inline void
+path_cache_remove(struct path_cache_entry *entry)
+__must_hold(path_cache_lock)
+{
+	hlist_del_rcu(&entry->hlist);
+	call_rcu(&entry->rcu, path_cache_free_rcu);
+}
+
+/*
+ * Replace the entry matching 'key' by 'path' (of length 'len'), or just drop
+ * it if 'path' is NULL.
+ */
+static void
+path_cache_update(const struct path_cache_key *key, u32 signature,
+		  const char *path, int len)
+{
+	struct path_cache_entry *entry, *new_entry = NULL, *last = NULL;
+	struct hlist_head *bucket;
+	struct hlist_node *next;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+	unsigned long flags;
+	unsigned int depth = 0;
+
+	if (path != NULL) {
+		new_entry = kmalloc(sizeof(*new_entry) + len + 1, GFP_ATOMIC);
+		if (likely(new_entry != NULL)) {
+			new_entry->key = *key;
+			new_entry->signature = signature;
+			new_entry->len = len;
+			memcpy(new_entry->path, path, len);
+			new_entry->path[len] = '\0';
+		}
+	}
+
+	bucket = path_cache_bucket(key);
+
+	spin_lock_irqsave(&path_cache_lock, flags);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	hlist_for_each_entry_safe(entry, tmp, next, bucket, hlist) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+	hlist_for_each_entry_safe(entry, next, bucket, hlist) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+		if (path_cache_match(entry, key)) {
+			path_cache_remove(entry);
+			continue;
+		}
+		++depth;
+		last = entry;
+	}
+	if (new_entry != NULL) {
+		/* Evict the oldest entry of a full bucket */
+		if (depth >= PATH_CACHE_DEPTH)
+			path_cache_remove(last);
+		hlist_add_head_rcu(&new_entry->hlist, bucket);
+	}
+	spin_unlock_irqrestore(&path_cache_lock, flags);
+}
+
+/**********************************/
+/*            Lookup              */
+/**********************************/
+
+const char *
+path_cache_get(struct file *file, char *buffer, int length)
+{
+	struct path_cache_key key;
+	struct path_cache_entry *entry;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+	unsigned int rename_seq;
+	u32 signature = 0;
+	bool known, stale = false;
+	char *path;
+
+	if (unlikely(file == NULL || length <= 0))
+		return NULL;
+
+	path_cache_fill_key(&key, file);
+	rename_seq = read_seqbegin(&rename_lock);
+
+	rcu_read_lock();
+	known = path_cache_signature(&key, &signature);
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	hlist_for_each_entry_rcu(entry, tmp, path_cache_bucket(&key), hlist) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+	hlist_for_each_entry_rcu(entry, path_cache_bucket(&key), hlist) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+		if (!path_cache_match(entry, &key))
+			continue;
+		if (likely(known && entry->signature == signature &&
+			   !d_unlinked(key.dentry) &&
+			   entry->len < length &&
+			   !read_seqretry(&rename_lock, rename_seq))) {
+			memcpy(buffer, entry->path, entry->len + 1);
+			rcu_read_unlock();
+			this_cpu_inc(path_cache_stats.hits);
+			return buffer;
+		}
+		stale = true;
+		break;
+	}
+	rcu_read_unlock();
+
+	if (stale)
+		this_cpu_inc(path_cache_stats.invalidations);
+	else
+		this_cpu_inc(path_cache_stats.misses);
+
+	path = d_path(&file->f_path, buffer, length);
+	if (IS_ERR(path)) {
+		if (stale)
+			path_cache_update(&key, 0, NULL, 0);
+		return NULL;
+	}
+
+	/* Only cache paths of live files, resolved without concurrent rename */
+	if (likely(known && !read_seqretry(&rename_lock, rename_seq) &&
+		   !d_unlinked(key.dentry)))
+		/* d_path fills the end of the buffer, '\0' included */
+		path_cache_update(&key, signature, path,
+				  (int)(buffer + length - 1 - path));
+	else if (stale)
+		path_cache_update(&key, 0, NULL, 0);
+
+	return path;
+}
+
+const char *
+path_cache_get_mm(struct mm_struct *mm, char *buffer, int length)
+{
+	struct file *exe_file;
+	const char *path;
+
+	if (unlikely(mm == NULL))
+		return NULL;
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 1, 0)
+	/*
+	 * exe_file is RCU protected, no need for mmap_sem. It can be replaced
+	 * and released meanwhile: hold a reference while resolving it.
+	 */
+	rcu_read_lock();
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 7, 0)
+	exe_file = get_file_rcu(&mm->exe_file);
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(6, 7, 0) */
+	exe_file = rcu_dereference(mm->exe_file);
+	if (exe_file != NULL && !get_file_rcu(exe_file))
+		exe_file = NULL;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(6, 7, 0) */
+	rcu_read_unlock();
+	if (unlikely(exe_file == NULL))
+		return NULL;
+	path = path_cache_get(exe_file, buffer, length);
+	fput(exe_file);
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(4, 1, 0) */
+	if (!down_read_trylock(&mm->mmap_sem)) {
+		/* It's lock, we can't sleep here to get it, so just give up */
+		return NULL;
+	}
+	exe_file = mm->exe_file;
+	path = path_cache_get(exe_file, buffer, length);
+	up_read(&mm->mmap_sem);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(4, 1, 0) */
+
+	return path;
+}
+
+void
+path_cache_destroy(void)
+{
+	struct path_cache_entry *entry;
+	struct hlist_node *next;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+	unsigned long flags;
+	unsigned int i;
+
+	spin_lock_irqsave(&path_cache_lock, flags);
+	for (i = 0; i < ARRAY_SIZE(path_cache); ++i) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+		hlist_for_each_entry_safe(entry, tmp, next, &path_cache[i], hlist) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+		hlist_for_each_entry_safe(entry, next, &path_cache[i], hlist) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+			path_cache_remove(entry);
+		}
+	}
+	spin_unlock_irqrestore(&path_cache_lock, flags);
+
+	/* path_cache_free_rcu must not be called after the module is gone */
+	rcu_barrier();
+}
+
+/**********************************/
+/*          Statistics            */
+/**********************************/
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+path_cache_stats_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+path_cache_stats_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return -EPERM;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+path_cache_stats_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+path_cache_stats_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	unsigned long hits = 0, misses = 0, invalidations = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct path_cache_stats *stats = per_cpu_ptr(&path_cache_stats, cpu);
+
+		hits += READ_ONCE(stats->hits);
+		misses += READ_ONCE(stats->misses);
+		invalidations += READ_ONCE(stats->invalidations);
+	}
+
+	return scnprintf(buffer, PAGE_SIZE, "hits:%lu misses:%lu invalidations:%lu",
+			 hits, misses, invalidations);
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+static const struct kernel_param_ops path_cache_stats_param = {
+	.set = path_cache_stats_param_set,
+	.get = path_cache_stats_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(path_cache_stats, &path_cache_stats_param_set, &path_cache_stats_param_get, NULL, 0400);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(path_cache_stats, &path_cache_stats_param, NULL, 0400);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(path_cache_stats, "Statistics of the cache of executable paths"
+		 " (hits, misses and invalidations due to renames or unlinks)");
@@ -0,0 +1,38 @@
+#ifndef __TOOL_PATH_CACHE__
+#define __TOOL_PATH_CACHE__
+
+#include <linux/fs.h>
+#include <linux/mm_types.h>
+#include <linux/moduleparam.h>
+#include <linux/version.h>
+
+/* Number of buckets of the path cache (power of 2) */
+#define PATH_CACHE_BITS 8
+
+/* Maximum number of entries per bucket, the oldest one is evicted */
+#define PATH_CACHE_DEPTH 4
+
+/* Maximum number of directories and mounts between a cached file and the root of the process */
+#define PATH_CACHE_MAX_DEPTH 64
+
+/**
+ * Resolve the path of 'file' into 'buffer' (of size 'length'), using the
+ * path cache when possible. Returns a pointer inside 'buffer', or NULL if the
+ * path could not be resolved. Can be called from probe (atomic) context.
+ */
+const char *path_cache_get(struct file *file, char *buffer, int length);
+
+/**
+ * Resolve the path of the executable of 'mm', see path_cache_get.
+ */
+const char *path_cache_get_mm(struct mm_struct *mm, char *buffer, int length);
+
+/* Free the whole cache, once nothing can call path_cache_get anymore */
+void path_cache_destroy(void);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int path_cache_stats_param_set(const char *buf, struct kernel_param *kp);
+int path_cache_stats_param_get(char *buffer, struct kernel_param *kp);
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36) */
+
+#endif /* __TOOL_PATH_CACHE__ */
@@ -10,5 +10,17 @@
 #ifndef __releases
 #define __releases(x)
 #endif
+#ifndef __rcu
+#define __rcu
 #endif
+#endif
+
 
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 19, 0)
+#ifndef READ_ONCE
+#define READ_ONCE(x) ACCESS_ONCE(x)
+#endif
+#ifndef WRITE_ONCE
+#define WRITE_ONCE(x, val) (ACCESS_ONCE(x) = (val))
+#endif
+#endif
@@ -0,0 +1,55 @@
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/string.h>
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+#include "sparse_compat.h"
+#include "tracepoint_helper.h"
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0)
+static void
+tracepoint_lookup(struct tracepoint *tp, void *priv)
+{
+	struct tracepoint_probe *probe = priv;
+
+	if (strcmp(tp->name, probe->name) == 0)
+		probe->tp = tp;
+}
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0) */
+
+int plant_tracepoint(struct tracepoint_probe *probe) __must_hold(probe_lock)
+{
+	int err;
+
+	pr_info("[+] Planting tracepoint probe on %s\n", probe->name);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0)
+	probe->tp = NULL;
+	for_each_kernel_tracepoint(tracepoint_lookup, probe);
+	if (probe->tp == NULL)
+		err = -ENOENT;
+	else
+		err = tracepoint_probe_register(probe->tp, probe->probe, probe->data);
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 15, 0) */
+	err = tracepoint_probe_register(probe->name, probe->probe, probe->data);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 15, 0) */
+	if (err < 0)
+		pr_err("[-] Failed to plant tracepoint probe on %s: %i\n", probe->name, err);
+	else
+		pr_info("[+] Planted tracepoint probe on %s\n", probe->name);
+
+	return err;
+}
+
+void unplant_tracepoint(struct tracepoint_probe *probe) __must_hold(probe_lock)
+{
+	pr_info("[+] Unplanting tracepoint probe on %s\n", probe->name);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 15, 0)
+	tracepoint_probe_unregister(probe->tp, probe->probe, probe->data);
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 15, 0) */
+	tracepoint_probe_unregister(probe->name, probe->probe, probe->data);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 15, 0) */
+	/* Wait for the probes still running */
+	tracepoint_synchronize_unregister();
+	pr_info("[+] Unplanted tracepoint probe on %s\n", probe->name);
+	probe->tp = NULL;
+}
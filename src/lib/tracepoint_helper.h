@@ -0,0 +1,21 @@
+#ifndef __TOOL_TRACEPOINT_HELPER__
+#define __TOOL_TRACEPOINT_HELPER__
+
+#include <linux/tracepoint.h>
+#include <linux/version.h>
+
+/*
+ * Probe on a kernel tracepoint. Most tracepoints are not exported to
+ * modules: they are found by name when planted.
+ */
+struct tracepoint_probe {
+	const char *name      /** Name of the tracepoint */;
+	void *probe           /** Probe: 'void *data' then the arguments of the tracepoint */;
+	void *data            /** First argument given to the probe */;
+	struct tracepoint *tp /** Tracepoint, once planted (3.15 and later) */;
+};
+
+int plant_tracepoint(struct tracepoint_probe *probe);
+void unplant_tracepoint(struct tracepoint_probe *probe);
+
+#endif /* __TOOL_TRACEPOINT_HELPER__ */
@@ -0,0 +1,24 @@
+#ifndef __TOOL_TTY_NAME__
+#define __TOOL_TTY_NAME__
+
+#include <linux/string.h>
+#include <linux/tty.h>
+#include <linux/version.h>
+
+/* Maximal length of a TTY name, including the tailing '\0' */
+#define TTY_NAME_LEN 64
+
+static const char null_tty_short[] = "NULL";
+
+/* Copy the name of a TTY into buffer, of size TTY_NAME_LEN */
+static inline void
+copy_tty_name(struct tty_struct *tty, char *buffer)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 2, 0)
+	strlcpy(buffer, tty_name(tty), TTY_NAME_LEN);
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(4, 2, 0) */
+	tty_name(tty, buffer);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(4, 2, 0) */
+}
+
+#endif /* __TOOL_TTY_NAME__ */
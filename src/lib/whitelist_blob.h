@@ -0,0 +1,49 @@
+#ifndef __TOOL_WHITELIST_BLOB__
+#define __TOOL_WHITELIST_BLOB__
+
+/*
+ * Binary whitelist, as produced by tools/whitelist_compiler from the text
+ * syntax and written to /dev/<module>_whitelist. Shared with userspace: only
+ * fixed size types, in the byte order of the host.
+ *
+ * The blob is a header followed by 'count' records. Each record starts with
+ * its size, a multiple of WHITELIST_BLOB_ALIGN, padding included.
+ */
+
+#include <linux/types.h>
+
+#define WHITELIST_BLOB_MAGIC 0x424c4857 /* "WHLB" */
+#define WHITELIST_BLOB_VERSION 1
+#define WHITELIST_BLOB_ALIGN 4
+
+enum whitelist_blob_type {
+	WHITELIST_BLOB_NETLOG = 1,
+	WHITELIST_BLOB_EXECLOG = 2,
+};
+
+struct whitelist_blob_header {
+	__u32 magic    /** WHITELIST_BLOB_MAGIC */;
+	__u32 version  /** WHITELIST_BLOB_VERSION */;
+	__u32 type     /** enum whitelist_blob_type */;
+	__u32 count    /** Number of records */;
+};
+
+struct whitelist_blob_netlog {
+	__u32 size        /** Size of the record */;
+	__u16 path_len    /** Length of the path */;
+	__u16 port        /** Port, 0 for any port */;
+	__u8 family       /** IP version (4 or 6), 0 for any address */;
+	__u8 prefix_len   /** Number of significant bits of the address */;
+	__u8 reserved[2];
+	__u8 ip[16]       /** Address, in network byte order */;
+	char path[]       /** Path of the executable, not terminated */;
+};
+
+struct whitelist_blob_execlog {
+	__u32 size            /** Size of the record */;
+	__u16 filename_len    /** Length of the filename */;
+	__u16 argv_start_len  /** Length of the argv start, 0 if none */;
+	char data[]           /** Filename then argv start, not terminated */;
+};
+
+#endif /* __TOOL_WHITELIST_BLOB__ */
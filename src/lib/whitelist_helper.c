@@ -1,14 +1,147 @@
 #include <linux/version.h>
 #include <linux/err.h>
+#include <linux/fs.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/jiffies.h>
+#include <linux/list.h>
+#include <linux/miscdevice.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/rculist.h>
+#include <linux/rcupdate.h>
 #include <linux/slab.h>
-#include <linux/spinlock.h>
+#include <linux/sort.h>
+#include <linux/uaccess.h>
+#include <linux/vmalloc.h>
+#include <linux/workqueue.h>
+#include "exe_identity.h"
 #include "sparse_compat.h"
+#include "whitelist_blob.h"
 
-/* Lock on the whitelist */
-static DEFINE_RWLOCK(whitelist_rwlock);
+/*
+ * Each module defines:
+ *  - struct white_process: a rule, as given by the user, with 'next',
+ *    'next_free' and 'hits' members (set to NULL when parsed). Rules are
+ *    modified by writers only, but can be read under rcu_read_lock.
+ *  - struct white_match: the rules of one executable, compiled for the
+ *    probes by white_match_build and freed by white_match_free.
+ *  - white_match_check: check compiled rules against the data given to
+ *    whitelist_lookup, under rcu_read_lock, returning the matching rule.
+ *  - white_query_pending: whether the caller checks again with more data
+ *    after a negative lookup, which is then not counted as a miss.
+ *  - whiterow_path: the path of the executable of a rule.
+ *  - whitelist_print: print a rule followed by ',', also under rcu_read_lock.
+ *  - whiterow_find: find a rule equal to another one in a list.
+ *  - whiterow_from_string/whiterow_from_blob: parse a rule.
+ *  - WHITELIST_BLOB_TYPE: the type of the binary whitelists it accepts.
+ */
+
+/* Executable of the whitelist, with all its rules */
+struct white_exe {
+	struct hlist_node by_path        /** Entry in the path hash table */;
+	struct hlist_node by_id          /** Entry in the identity hash table, if the identity is known */;
+	struct exe_identity id           /** Identity of the executable, resolved when created */;
+	struct white_match *match        /** Compiled rules, used by the probes */;
+	struct white_process *rows       /** Rules, only used by writers */;
+	struct white_process *last_row   /** Last rule, only used by writers */;
+	struct white_exe *next_free      /** Next executable to free after a grace period */;
+	unsigned long resolve_after      /** No resolution is requested by probes before (jiffies) */;
+	bool resolve_pending             /** A probe matched the path but not the identity */;
+	bool settled                     /** The path resolves to 'id': other files match it, not resolved again */;
+	size_t path_len                  /** Length of the path */;
+	char path[]                      /** Path of the executable */;
+};
+
+struct white_table {
+	unsigned int bits            /** Size of the hash tables (log2) */;
+	size_t nr_exes               /** Number of executables */;
+	struct hlist_head *by_path   /** Hash table on the paths */;
+	struct hlist_head *by_id     /** Hash table on the identities */;
+};
+
+#define WHITE_TABLE_MIN_BITS 4
+#define WHITE_TABLE_MAX_BITS 20
+
+/* Maximum size of what can be written at once to the whitelist device */
+#define WHITELIST_DEV_MAX (64 << 20)
+
+/*
+ * Current whitelist, NULL if empty.
+ * Probes only read it under rcu_read_lock. Writers either build a new table
+ * and publish it with rcu_assign_pointer, or replace a single executable in
+ * the current one (copy on write). Nothing is freed before a grace period.
+ */
+static struct white_table __rcu *whitelist = NULL;
 
 /* Sanity lock on the whitelist: only one w modification at a time ! */
-static DEFINE_SPINLOCK(whitelist_sanitylock);
+static DEFINE_MUTEX(whitelist_sanitylock);
+
+/* Bumped after each change of the whitelist, for the caches of its decisions */
+static atomic_t whitelist_gen = ATOMIC_INIT(0);
+
+unsigned int
+whitelist_generation(void)
+{
+	return (unsigned int) atomic_read(&whitelist_gen);
+}
+
+/* Current whitelist, for writers */
+#define whitelist_locked() \
+	rcu_dereference_protected(whitelist, lockdep_is_held(&whitelist_sanitylock))
+
+/* Executables and rules removed from the current whitelist, freed after a grace period */
+static struct white_exe *white_garbage = NULL;
+static struct white_process *white_row_garbage = NULL;
+
+/* Allocate memory for tables, which can be large */
+static void *
+white_alloc(size_t size)
+{
+	void *ptr = NULL;
+
+	if (size <= PAGE_SIZE << PAGE_ALLOC_COSTLY_ORDER)
+		ptr = kmalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	if (ptr == NULL)
+		ptr = vmalloc(size);
+	return ptr;
+}
+
+static void
+white_free(const void *ptr)
+{
+	if (is_vmalloc_addr(ptr))
+		vfree(ptr);
+	else
+		kfree(ptr);
+}
+
+/* Allocate the counters of a rule which is going to be used */
+static int
+white_row_init(struct white_process *row)
+{
+	row->hits = alloc_percpu(unsigned long);
+	if (unlikely(row->hits == NULL))
+		return -ENOMEM;
+	return 0;
+}
+
+static void
+white_row_free(struct white_process *row)
+{
+	if (row->hits != NULL)
+		free_percpu(row->hits);
+	kfree(row);
+}
+
+/* Free a rule once no reader can see it anymore */
+static void
+white_row_retire(struct white_process *row) __must_hold(whitelist_sanitylock)
+{
+	row->next_free = white_row_garbage;
+	white_row_garbage = row;
+}
 
 static void
 purge_whitelist(struct white_process *head) __must_hold(whitelist_sanitylock)
@@ -18,31 +151,911 @@ purge_whitelist(struct white_process *head) __must_hold(whitelist_sanitylock)
 
 	while (current_row != NULL) {
 		next_row = current_row->next;
-		kfree(current_row);
+		white_row_free(current_row);
 		current_row = next_row;
 	}
 }
 
+/**********************************/
+/*        Executables             */
+/**********************************/
+
+static inline struct hlist_head *
+white_bucket_path(const struct white_table *table, const char *path, size_t path_len)
+{
+	return &table->by_path[jhash(path, path_len, 0) & ((1U << table->bits) - 1)];
+}
+
+static inline struct hlist_head *
+white_bucket_id(const struct white_table *table, const struct exe_identity *id)
+{
+	return &table->by_id[hash_long(id->ino ^ id->dev, table->bits)];
+}
+
+/* Allocate a table for about 'expected' executables */
+static struct white_table *
+white_table_new(size_t expected)
+{
+	struct white_table *table;
+	unsigned int bits = WHITE_TABLE_MIN_BITS;
+	size_t i;
+
+	while (bits < WHITE_TABLE_MAX_BITS && (1UL << bits) < expected)
+		++bits;
+
+	table = kzalloc(sizeof(struct white_table), GFP_KERNEL);
+	if (unlikely(table == NULL))
+		return NULL;
+	table->bits = bits;
+	table->by_path = white_alloc(sizeof(struct hlist_head) << bits);
+	table->by_id = white_alloc(sizeof(struct hlist_head) << bits);
+	if (unlikely(table->by_path == NULL || table->by_id == NULL)) {
+		white_free(table->by_path);
+		white_free(table->by_id);
+		kfree(table);
+		return NULL;
+	}
+	for (i = 0; i < (1UL << bits); ++i) {
+		INIT_HLIST_HEAD(&table->by_path[i]);
+		INIT_HLIST_HEAD(&table->by_id[i]);
+	}
+	return table;
+}
+
+/*
+ * New executable, without rules. Its identity is resolved if 'id' is NULL,
+ * which might sleep.
+ */
+static struct white_exe *
+white_exe_new(const char *path, size_t path_len, const struct exe_identity *id)
+{
+	struct white_exe *exe;
+
+	exe = kmalloc(sizeof(struct white_exe) + path_len + 1, GFP_KERNEL);
+	if (unlikely(exe == NULL))
+		return NULL;
+
+	INIT_HLIST_NODE(&exe->by_path);
+	INIT_HLIST_NODE(&exe->by_id);
+	exe->match = NULL;
+	exe->rows = NULL;
+	exe->last_row = NULL;
+	exe->next_free = NULL;
+	exe->resolve_after = jiffies;
+	exe->resolve_pending = false;
+	exe->settled = false;
+	memcpy(exe->path, path, path_len);
+	exe->path[path_len] = '\0';
+	exe->path_len = path_len;
+
+	if (id != NULL)
+		exe->id = *id;
+	else
+		/* The file might not exist yet, it will be resolved again later */
+		exe_identity_resolve(&exe->id, exe->path);
+	return exe;
+}
+
+/* Free an executable, but not its rules */
+static void
+white_exe_free(struct white_exe *exe)
+{
+	if (exe->match != NULL)
+		white_match_free(exe->match);
+	kfree(exe);
+}
+
+static int
+white_exe_compile(struct white_exe *exe) __must_hold(whitelist_sanitylock)
+{
+	struct white_match *match;
+
+	match = white_match_build(exe->rows);
+	if (IS_ERR(match))
+		return PTR_ERR(match);
+	exe->match = match;
+	return 0;
+}
+
+/* The executable can be published: readers can walk its rules */
+static void
+white_exe_append(struct white_exe *exe, struct white_process *row) __must_hold(whitelist_sanitylock)
+{
+	row->next = NULL;
+	if (exe->last_row == NULL)
+		rcu_assign_pointer(exe->rows, row);
+	else
+		rcu_assign_pointer(exe->last_row->next, row);
+	exe->last_row = row;
+}
+
+/*
+ * Copy of an executable, compiled, sharing its rules. The identity is
+ * resolved again if 'resolve' is set.
+ */
+static struct white_exe *
+white_exe_clone(const struct white_exe *old, bool resolve) __must_hold(whitelist_sanitylock)
+{
+	struct white_exe *exe;
+	int err;
+
+	exe = white_exe_new(old->path, old->path_len, resolve ? NULL : &old->id);
+	if (unlikely(exe == NULL))
+		return ERR_PTR(-ENOMEM);
+	exe->rows = old->rows;
+	exe->last_row = old->last_row;
+	err = white_exe_compile(exe);
+	if (unlikely(err)) {
+		white_exe_free(exe);
+		return ERR_PTR(err);
+	}
+	return exe;
+}
+
+/* Find an executable by path, for writers */
+static struct white_exe *
+white_exe_find(struct white_table *table, const char *path, size_t path_len)
+__must_hold(whitelist_sanitylock)
+{
+	struct white_exe *exe;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	hlist_for_each_entry(exe, tmp, white_bucket_path(table, path, path_len), by_path) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+	hlist_for_each_entry(exe, white_bucket_path(table, path, path_len), by_path) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+		if (exe->path_len == path_len && memcmp(exe->path, path, path_len) == 0)
+			return exe;
+	}
+	return NULL;
+}
+
+static void
+white_exe_link(struct white_table *table, struct white_exe *exe) __must_hold(whitelist_sanitylock)
+{
+	hlist_add_head_rcu(&exe->by_path, white_bucket_path(table, exe->path, exe->path_len));
+	if (exe_identity_known(&exe->id))
+		hlist_add_head_rcu(&exe->by_id, white_bucket_id(table, &exe->id));
+	++table->nr_exes;
+}
+
+static void
+white_exe_unlink(struct white_table *table, struct white_exe *exe) __must_hold(whitelist_sanitylock)
+{
+	hlist_del_rcu(&exe->by_path);
+	if (exe_identity_known(&exe->id))
+		hlist_del_rcu(&exe->by_id);
+	--table->nr_exes;
+}
+
+/*
+ * Replace 'old' by 'exe' in the current table. Probes can briefly see both,
+ * but never none of them.
+ */
+static void
+white_exe_replace(struct white_table *table, struct white_exe *old, struct white_exe *exe)
+__must_hold(whitelist_sanitylock)
+{
+	white_exe_link(table, exe);
+	white_exe_unlink(table, old);
+	old->next_free = white_garbage;
+	white_garbage = old;
+}
+
+/* Free the replaced executables and rules, 'synced' if a grace period already elapsed */
+static void
+white_collect(bool synced) __must_hold(whitelist_sanitylock)
+{
+	struct white_process *row;
+	struct white_exe *exe;
+
+	if (white_garbage == NULL && white_row_garbage == NULL)
+		return;
+	if (!synced)
+		synchronize_rcu();
+	while (white_garbage != NULL) {
+		exe = white_garbage;
+		white_garbage = exe->next_free;
+		white_exe_free(exe);
+	}
+	while (white_row_garbage != NULL) {
+		row = white_row_garbage;
+		white_row_garbage = row->next_free;
+		white_row_free(row);
+	}
+}
+
+/* Free a table which is not used anymore, with the rules if 'free_rows' */
+static void
+white_table_free(struct white_table *table, bool free_rows) __must_hold(whitelist_sanitylock)
+{
+	struct white_exe *exe;
+	struct hlist_node *next;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+	size_t i;
+
+	for (i = 0; i < (1UL << table->bits); ++i) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+		hlist_for_each_entry_safe(exe, tmp, next, &table->by_path[i], by_path) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+		hlist_for_each_entry_safe(exe, next, &table->by_path[i], by_path) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+			if (free_rows)
+				purge_whitelist(exe->rows);
+			white_exe_free(exe);
+		}
+	}
+	white_free(table->by_path);
+	white_free(table->by_id);
+	kfree(table);
+}
+
+/*
+ * Build a table from a list of 'nr_rows' rules, taking ownership of them.
+ * Returns NULL if there is no rule.
+ */
+static struct white_table *
+white_table_build(struct white_process *rows, size_t nr_rows) __must_hold(whitelist_sanitylock)
+{
+	struct white_table *table;
+	struct white_process *row;
+	struct white_exe *exe;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+	const char *path;
+	size_t path_len;
+	size_t i;
+
+	if (rows == NULL)
+		return NULL;
+
+	table = white_table_new(nr_rows);
+	if (unlikely(table == NULL)) {
+		purge_whitelist(rows);
+		return ERR_PTR(-ENOMEM);
+	}
+
+	/* Group the rules by executable */
+	while (rows != NULL) {
+		row = rows;
+		rows = row->next;
+		path = whiterow_path(row, &path_len);
+		exe = white_exe_find(table, path, path_len);
+		if (exe == NULL) {
+			exe = white_exe_new(path, path_len, NULL);
+			if (unlikely(exe == NULL)) {
+				white_row_free(row);
+				purge_whitelist(rows);
+				goto nomem;
+			}
+			white_exe_link(table, exe);
+		}
+		white_exe_append(exe, row);
+	}
+
+	/* Then compile each of them once */
+	for (i = 0; i < (1UL << table->bits); ++i) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+		hlist_for_each_entry(exe, tmp, &table->by_path[i], by_path) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+		hlist_for_each_entry(exe, &table->by_path[i], by_path) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+			if (unlikely(white_exe_compile(exe) != 0))
+				goto nomem;
+		}
+	}
+	return table;
+
+nomem:
+	white_table_free(table, true);
+	return ERR_PTR(-ENOMEM);
+}
+
+/*
+ * Build a copy of a table, sized for its current number of executables and
+ * with their identities resolved again. The rules are shared with 'old'.
+ */
+static struct white_table *
+white_table_rebuild(const struct white_table *old) __must_hold(whitelist_sanitylock)
+{
+	struct white_table *table;
+	struct white_exe *exe, *copy;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+	size_t i;
+
+	table = white_table_new(old->nr_exes);
+	if (unlikely(table == NULL))
+		return ERR_PTR(-ENOMEM);
+
+	for (i = 0; i < (1UL << old->bits); ++i) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+		hlist_for_each_entry(exe, tmp, &old->by_path[i], by_path) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+		hlist_for_each_entry(exe, &old->by_path[i], by_path) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+			copy = white_exe_clone(exe, true);
+			if (IS_ERR(copy)) {
+				white_table_free(table, false);
+				return ERR_CAST(copy);
+			}
+			white_exe_link(table, copy);
+		}
+	}
+	return table;
+}
+
+/*
+ * Install a new table, returning the previous one.
+ * Once this returns, no probe can be using the previous table anymore.
+ */
+static struct white_table *
+swap_whitelist(struct white_table *table) __must_hold(whitelist_sanitylock)
+{
+	struct white_table *old;
+
+	old = whitelist_locked();
+	rcu_assign_pointer(whitelist, table);
+	atomic_inc(&whitelist_gen);
+	synchronize_rcu();
+
+	return old;
+}
+
+/* Replace the current table by a rebuilt copy of it */
+static int
+white_table_refresh(void) __must_hold(whitelist_sanitylock)
+{
+	struct white_table *table;
+
+	table = whitelist_locked();
+	if (table == NULL)
+		return 0;
+
+	table = white_table_rebuild(table);
+	if (IS_ERR(table))
+		return PTR_ERR(table);
+	table = swap_whitelist(table);
+	white_table_free(table, false);
+	return 0;
+}
+
+/*
+ * Rules are matched on the identity of the executable, resolved from their
+ * path when the executable is added. When a rule only matches by path, the
+ * file was replaced (or did not exist yet): the identity of this executable
+ * is resolved again from a work item, at most once per second. If its path
+ * still resolves to the same identity, the process runs another file with
+ * the same path (chroot, container, mount namespace): the executable is
+ * settled and never requested again, the rules keep matching by path.
+ */
+static void whitelist_resolve(struct work_struct *work);
+static DECLARE_WORK(whitelist_resolve_work, whitelist_resolve);
+
+/* Resolve again the executables requested by probes */
+static void
+whitelist_resolve(struct work_struct *work)
+{
+	struct white_table *table;
+	struct white_exe *exe, *copy;
+	struct exe_identity id;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp, *next;
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+	struct hlist_node *next;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+	bool changed = false;
+	size_t i;
+
+	mutex_lock(&whitelist_sanitylock);
+
+	table = whitelist_locked();
+	if (table == NULL)
+		goto unlock;
+
+	for (i = 0; i < (1UL << table->bits); ++i) {
+		/* Copies are added at the head of the bucket: never visited again */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+		hlist_for_each_entry_safe(exe, tmp, next, &table->by_path[i], by_path) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+		hlist_for_each_entry_safe(exe, next, &table->by_path[i], by_path) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+			if (!READ_ONCE(exe->resolve_pending))
+				continue;
+			WRITE_ONCE(exe->resolve_pending, false);
+
+			exe_identity_resolve(&id, exe->path);
+			if (exe_identity_equal(&id, &exe->id)) {
+				WRITE_ONCE(exe->settled, true);
+				continue;
+			}
+			/* Still missing, probes will ask again */
+			if (!exe_identity_known(&id) && !exe_identity_known(&exe->id))
+				continue;
+
+			copy = white_exe_clone(exe, false);
+			if (IS_ERR(copy)) {
+				pr_err("[-] Failed to resolve %s again\n", exe->path);
+				continue;
+			}
+			copy->id = id;
+			white_exe_replace(table, exe, copy);
+			changed = true;
+		}
+	}
+
+	/* Decisions cached for the previous identities are not valid anymore */
+	if (changed) {
+		white_collect(false);
+		atomic_inc(&whitelist_gen);
+	}
+
+unlock:
+	mutex_unlock(&whitelist_sanitylock);
+}
+
+/* Can be called from probes, under rcu_read_lock */
+static void
+whitelist_request_resolve(struct white_exe *exe)
+{
+	unsigned long after = READ_ONCE(exe->resolve_after);
+
+	if (READ_ONCE(exe->settled) || time_before(jiffies, after))
+		return;
+	WRITE_ONCE(exe->resolve_after, jiffies + HZ);
+	WRITE_ONCE(exe->resolve_pending, true);
+	schedule_work(&whitelist_resolve_work);
+}
+
 void
 destroy_whitelist(void)
 {
-	unsigned long flags;
-	struct white_process *old;
+	struct white_table *old;
 
-	spin_lock_irqsave(&whitelist_sanitylock, flags);
+	cancel_work_sync(&whitelist_resolve_work);
 
-	write_lock(&whitelist_rwlock);
-	old = whitelist;
-	whitelist = NULL;
-	write_unlock(&whitelist_rwlock);
+	mutex_lock(&whitelist_sanitylock);
+
+	old = swap_whitelist(NULL);
 
 	pr_info("[+] Whitelist cleared\n");
 
-	purge_whitelist(old);
+	if (old != NULL)
+		white_table_free(old, true);
+
+	mutex_unlock(&whitelist_sanitylock);
+}
+
+/**********************************/
+/*            Lookup              */
+/**********************************/
+
+/*
+ * Most frequent paths which were not whitelisted, per CPU, with the
+ * space-saving algorithm: a path which is not tracked replaces the least
+ * frequent one, inheriting its count. Only the local CPU writes its table,
+ * readers use the sequence number to get a consistent copy.
+ */
+#define WHITE_MISS_SLOTS 16
+#define WHITE_MISS_PATH 128
+
+struct white_miss {
+	unsigned long count             /** Number of misses (over-estimated) */;
+	u32 hash                        /** Hash of the full path */;
+	size_t path_len                 /** Length of the full path */;
+	char path[WHITE_MISS_PATH]      /** Start of the path, not terminated */;
+};
+
+struct white_misses {
+	unsigned int seq                        /** Odd while the table is being modified */;
+	struct white_miss slots[WHITE_MISS_SLOTS];
+};
+
+static DEFINE_PER_CPU(struct white_misses, white_misses);
+
+static inline bool
+white_miss_equal(const struct white_miss *miss, u32 hash, const char *path, size_t path_len)
+{
+	return miss->count != 0 && miss->hash == hash && miss->path_len == path_len &&
+	       memcmp(miss->path, path, min_t(size_t, path_len, WHITE_MISS_PATH)) == 0;
+}
+
+static void
+white_miss_record(const char *path, size_t path_len)
+{
+	struct white_misses *misses;
+	struct white_miss *miss, *victim;
+	unsigned long flags;
+	u32 hash = jhash(path, path_len, 0);
+	size_t i;
+
+	local_irq_save(flags);
+	misses = this_cpu_ptr(&white_misses);
+
+	WRITE_ONCE(misses->seq, misses->seq + 1);
+	smp_wmb();
+
+	victim = &misses->slots[0];
+	for (i = 0; i < WHITE_MISS_SLOTS; ++i) {
+		miss = &misses->slots[i];
+		if (white_miss_equal(miss, hash, path, path_len)) {
+			++miss->count;
+			goto done;
+		}
+		if (miss->count < victim->count)
+			victim = miss;
+	}
+
+	++victim->count;
+	victim->hash = hash;
+	victim->path_len = path_len;
+	memcpy(victim->path, path, min_t(size_t, path_len, WHITE_MISS_PATH));
+done:
+	smp_wmb();
+	WRITE_ONCE(misses->seq, misses->seq + 1);
+	local_irq_restore(flags);
+}
+
+/* Consistent copy of the table of 'cpu' */
+static void
+white_miss_copy(struct white_miss *slots, int cpu)
+{
+	const struct white_misses *misses = per_cpu_ptr(&white_misses, cpu);
+	unsigned int seq;
+
+	do {
+		seq = READ_ONCE(misses->seq);
+		smp_rmb();
+		memcpy(slots, misses->slots, sizeof(misses->slots));
+		smp_rmb();
+	} while ((seq & 1) != 0 || READ_ONCE(misses->seq) != seq);
+}
+
+/*
+ * Check the rules of the executable, found by identity or by path ('path'
+ * can be NULL), against 'data'.
+ */
+static int
+whitelist_lookup(const struct exe_identity *id, const char *path, const void *data)
+{
+	const struct white_table *table;
+	struct white_exe *exe;
+	const struct white_process *row;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+	size_t path_len = 0;
+	int ret = NOT_WHITELISTED;
+
+	if (path != NULL) {
+		path_len = strnlen(path, MAX_EXEC_PATH);
+
+		/*Empty or paths greater than our limit are not whitelisted*/
+		if (unlikely(path_len == 0) ||
+		    unlikely(path_len == MAX_EXEC_PATH))
+			path = NULL;
+	}
+	if (path == NULL && !exe_identity_known(id))
+		return NOT_WHITELISTED;
+
+	rcu_read_lock();
+
+	table = rcu_dereference(whitelist);
+	if (table == NULL)
+		goto unlock;
+
+	if (exe_identity_known(id)) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+		hlist_for_each_entry_rcu(exe, tmp, white_bucket_id(table, id), by_id) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+		hlist_for_each_entry_rcu(exe, white_bucket_id(table, id), by_id) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+			if (!exe_identity_equal(&exe->id, id))
+				continue;
+			row = white_match_check(exe->match, data);
+			if (row != NULL)
+				goto whitelisted;
+		}
+	}
+
+	if (path != NULL) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+		hlist_for_each_entry_rcu(exe, tmp, white_bucket_path(table, path, path_len), by_path) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+		hlist_for_each_entry_rcu(exe, white_bucket_path(table, path, path_len), by_path) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+			if (exe->path_len != path_len ||
+			    memcmp(exe->path, path, path_len) != 0)
+				continue;
+			/* Already checked if the identity matched */
+			if (exe_identity_equal(&exe->id, id))
+				break;
+			/* Matching only by path: the identity might be stale */
+			whitelist_request_resolve(exe);
+			row = white_match_check(exe->match, data);
+			if (row != NULL)
+				goto whitelisted;
+			break;
+		}
+	}
+	goto unlock;
+
+whitelisted:
+	/* Per CPU counter: no shared cache line is written */
+	this_cpu_inc(*row->hits);
+	ret = WHITELISTED;
+unlock:
+	rcu_read_unlock();
+
+	/* Without the path or the full data, the caller checks again with them */
+	if (ret == NOT_WHITELISTED && path != NULL && !white_query_pending(data))
+		white_miss_record(path, path_len);
 
-	spin_unlock_irqrestore(&whitelist_sanitylock, flags);
+	return ret;
+}
+
+/**********************************/
+/*      Incremental updates       */
+/**********************************/
+
+/* Add a rule to the current table, taking ownership of it */
+static int
+white_add_row(struct white_table *table, struct white_process *row, const char *raw)
+__must_hold(whitelist_sanitylock)
+{
+	struct white_process *prev_last;
+	struct white_exe *old, *exe;
+	const char *path;
+	size_t path_len;
+
+	if (unlikely(white_row_init(row) != 0))
+		goto fail;
+
+	path = whiterow_path(row, &path_len);
+	old = white_exe_find(table, path, path_len);
+
+	if (old == NULL) {
+		exe = white_exe_new(path, path_len, NULL);
+		if (unlikely(exe == NULL))
+			goto fail;
+		white_exe_append(exe, row);
+		if (unlikely(white_exe_compile(exe) != 0)) {
+			white_exe_free(exe);
+			goto fail;
+		}
+		white_exe_link(table, exe);
+	} else if (whiterow_find(old->rows, row) != NULL) {
+		pr_err("[-] Duplicate whitelist %s\n", raw);
+		white_row_free(row);
+		return -EEXIST;
+	} else {
+		/* Probes only see the compiled copy, the rules are shared */
+		prev_last = old->last_row;
+		white_exe_append(old, row);
+		exe = white_exe_clone(old, false);
+		if (IS_ERR(exe)) {
+			rcu_assign_pointer(prev_last->next, NULL);
+			old->last_row = prev_last;
+			pr_err("[-] Failed to whitelist %s\n", raw);
+			white_row_retire(row);
+			return PTR_ERR(exe);
+		}
+		white_exe_replace(table, old, exe);
+	}
+
+	pr_info("[+] Whitelisted %s\n", raw);
+	return 0;
+
+fail:
+	pr_err("[-] Failed to whitelist %s\n", raw);
+	white_row_free(row);
+	return -ENOMEM;
+}
+
+/* Remove the rule equal to 'row' from the current table */
+static int
+white_remove_row(struct white_table *table, struct white_process *row, const char *raw)
+__must_hold(whitelist_sanitylock)
+{
+	struct white_process *victim = NULL;
+	struct white_process *prev = NULL;
+	struct white_exe *old, *exe;
+	const char *path;
+	size_t path_len;
+
+	path = whiterow_path(row, &path_len);
+	old = white_exe_find(table, path, path_len);
+	if (old != NULL)
+		victim = whiterow_find(old->rows, row);
+	white_row_free(row);
+	if (victim == NULL) {
+		pr_err("[-] Not whitelisted %s\n", raw);
+		return -ENOENT;
+	}
+
+	/* Probes only see the compiled copy, readers of the rules skip it */
+	if (victim != old->rows)
+		for (prev = old->rows; prev->next != victim; prev = prev->next);
+	if (prev == NULL)
+		rcu_assign_pointer(old->rows, victim->next);
+	else
+		rcu_assign_pointer(prev->next, victim->next);
+	if (old->last_row == victim)
+		old->last_row = prev;
+
+	if (old->rows == NULL) {
+		white_exe_unlink(table, old);
+		old->next_free = white_garbage;
+		white_garbage = old;
+	} else {
+		exe = white_exe_clone(old, false);
+		if (IS_ERR(exe)) {
+			pr_err("[-] Failed to remove %s\n", raw);
+			if (prev == NULL)
+				rcu_assign_pointer(old->rows, victim);
+			else
+				rcu_assign_pointer(prev->next, victim);
+			if (victim->next == NULL)
+				old->last_row = victim;
+			return PTR_ERR(exe);
+		}
+		white_exe_replace(table, old, exe);
+	}
+
+	white_row_retire(victim);
+	pr_info("[+] Removed %s\n", raw);
+	return 0;
 }
 
+static const char *list_delims = ",\n";
+
+/*
+ * Apply a list of rules to the current whitelist: '-rule' removes a rule,
+ * '+rule' or 'rule' adds it. Only the executables of the rules are compiled
+ * again. Rules are applied one by one: the first error is returned, the
+ * other rules are still applied.
+ */
+static int
+whitelist_apply(char *buf)
+{
+	struct white_table *table;
+	struct white_process *row;
+	char *raw;
+	char op;
+	int err, ret = 0;
+
+	mutex_lock(&whitelist_sanitylock);
+
+	table = whitelist_locked();
+	if (table == NULL) {
+		table = white_table_new(0);
+		if (unlikely(table == NULL)) {
+			pr_err("[-] Failed to update the whitelist\n");
+			ret = -ENOMEM;
+			goto unlock;
+		}
+		rcu_assign_pointer(whitelist, table);
+	}
+
+	while ((raw = strsep(&buf, list_delims)) != NULL) {
+		op = *raw;
+		if (op == '+' || op == '-')
+			++raw;
+		if (*raw == '\0')
+			continue;
+
+		row = whiterow_from_string(raw);
+		if (row == NULL) {
+			pr_err("[-] Invalid whitelist %s\n", raw);
+			err = -EINVAL;
+		} else if (op == '-') {
+			err = white_remove_row(table, row, raw);
+		} else {
+			err = white_add_row(table, row, raw);
+		}
+		if (err != 0 && ret == 0)
+			ret = err;
+	}
+
+	/* Keep the hash tables at most twice as loaded as when built */
+	if (table->nr_exes > (2UL << table->bits) && table->bits < WHITE_TABLE_MAX_BITS) {
+		if (white_table_refresh() != 0)
+			pr_err("[-] Failed to grow the whitelist\n");
+	}
+	white_collect(false);
+	atomic_inc(&whitelist_gen);
+
+unlock:
+	mutex_unlock(&whitelist_sanitylock);
+	return ret;
+}
+
+/* Replace the whole whitelist by a binary one */
+static int
+whitelist_load_blob(const char *buf, size_t len)
+{
+	const struct whitelist_blob_header *header = (const void *)buf;
+	struct white_process *head = NULL;
+	struct white_process *last = NULL;
+	struct white_process *row;
+	struct white_table *table;
+	size_t pos = sizeof(*header);
+	size_t size;
+	u32 i;
+
+	if (len < sizeof(*header) || header->version != WHITELIST_BLOB_VERSION ||
+	    header->type != WHITELIST_BLOB_TYPE) {
+		pr_err("[-] Invalid binary whitelist\n");
+		return -EINVAL;
+	}
+
+	mutex_lock(&whitelist_sanitylock);
+
+	for (i = 0; i < header->count; ++i) {
+		if (len - pos < sizeof(u32))
+			goto invalid;
+		size = *(const u32 *)(buf + pos);
+		if (size < sizeof(u32) || size > len - pos ||
+		    size % WHITELIST_BLOB_ALIGN != 0)
+			goto invalid;
+		row = whiterow_from_blob(buf + pos, size);
+		if (row == NULL)
+			goto invalid;
+		if (unlikely(white_row_init(row) != 0)) {
+			white_row_free(row);
+			goto nomem;
+		}
+		row->next = NULL;
+		if (last == NULL)
+			head = row;
+		else
+			last->next = row;
+		last = row;
+		pos += size;
+	}
+	if (pos != len)
+		goto invalid;
+
+	/* Duplicates were removed by the compiler */
+	table = white_table_build(head, header->count);
+	if (IS_ERR(table)) {
+		pr_err("[-] Failed to build the new whitelist\n");
+		mutex_unlock(&whitelist_sanitylock);
+		return PTR_ERR(table);
+	}
+
+	table = swap_whitelist(table);
+	if (table != NULL)
+		white_table_free(table, true);
+
+	mutex_unlock(&whitelist_sanitylock);
+
+	pr_info("[+] Loaded %u whitelist rules\n", header->count);
+	return 0;
+
+invalid:
+	pr_err("[-] Invalid binary whitelist, at rule %u\n", i);
+	purge_whitelist(head);
+	mutex_unlock(&whitelist_sanitylock);
+	return -EINVAL;
+nomem:
+	pr_err("[-] Failed to build the new whitelist\n");
+	purge_whitelist(head);
+	mutex_unlock(&whitelist_sanitylock);
+	return -ENOMEM;
+}
+
+/**********************************/
+/*      Module parameter          */
+/**********************************/
+
 static struct white_process *
 add_whiterow(struct white_process **head, struct white_process *last, char *raw) __must_hold(whitelist_sanitylock)
 {
@@ -51,11 +1064,13 @@ add_whiterow(struct white_process **head, struct white_process *last, char *raw)
 		return last;
 
 	new_row = whiterow_from_string(raw);
-	if (new_row == NULL) {
+	if (new_row == NULL || white_row_init(new_row) != 0) {
 		pr_err("[-] Failed to whitelist %s\n", raw);
-	} else if (is_already_whitelisted(*head, new_row)) {
+		if (new_row != NULL)
+			white_row_free(new_row);
+	} else if (whiterow_find(*head, new_row) != NULL) {
 		pr_err("[-] Duplicate whitelist %s\n", raw);
-		kfree(new_row);
+		white_row_free(new_row);
 	} else {
 		pr_info("[+] Whitelisted %s\n", raw);
 		if (last == NULL)
@@ -68,8 +1083,6 @@ add_whiterow(struct white_process **head, struct white_process *last, char *raw)
 	return last;
 }
 
-static const char *list_delims = ",\n";
-
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
 int
 whitelist_param_set(const char *buf, struct kernel_param *kp)
@@ -79,32 +1092,43 @@ whitelist_param_set(const char *buf, const struct kernel_param *kp)
 #endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
 {
 	char *raw_orig;
+	char *raw_pos;
 	char *raw;
-	unsigned long flags;
-	struct white_process *old;
+	struct white_table *table;
 	struct white_process *last = NULL;
 	struct white_process *head = NULL;
+	size_t nr_rows = 0;
 
 	raw_orig = kstrdup(buf, GFP_KERNEL);
 	if (unlikely(raw_orig == NULL))
 		return 0;
 
-	spin_lock_irqsave(&whitelist_sanitylock, flags);
+	mutex_lock(&whitelist_sanitylock);
 
 	pr_info("[+] Creating new whitelist ...\n");
 
-	while ((raw = strsep(&raw_orig, list_delims)) != NULL)
-		if (likely(*raw != '\0' && *raw != '\n'))
+	raw_pos = raw_orig;
+	while ((raw = strsep(&raw_pos, list_delims)) != NULL) {
+		if (likely(*raw != '\0' && *raw != '\n')) {
 			last = add_whiterow(&head, last, raw);
+			++nr_rows;
+		}
+	}
+
+	table = white_table_build(head, nr_rows);
+	if (IS_ERR(table)) {
+		pr_err("[-] Failed to build the new whitelist\n");
+		mutex_unlock(&whitelist_sanitylock);
+		kfree(raw_orig);
+		return PTR_ERR(table);
+	}
 
-	write_lock(&whitelist_rwlock);
-	old = whitelist;
-	whitelist = head;
-	write_unlock(&whitelist_rwlock);
+	table = swap_whitelist(table);
 
 	pr_info("[+] New whitelist applied\n");
-	purge_whitelist(old);
-	spin_unlock_irqrestore(&whitelist_sanitylock, flags);
+	if (table != NULL)
+		white_table_free(table, true);
+	mutex_unlock(&whitelist_sanitylock);
 
 	kfree(raw_orig);
 	return 0;
@@ -123,6 +1147,43 @@ do {						\
 
 static const char whitelist_overflow[] = "!!OVERFLOW!!";
 
+/*
+ * Print all the rules, separated by ',', from 'buffer'. '*last' is set to
+ * the end of what was printed. Returns false if they did not all fit.
+ */
+static bool
+whitelist_render(char *buffer, size_t *available, char **last) __must_hold(whitelist_sanitylock)
+{
+	struct white_table *table = whitelist_locked();
+	struct white_process *row;
+	struct white_exe *exe;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+	char *pos;
+	size_t i;
+
+	*last = buffer;
+	if (table == NULL)
+		return true;
+
+	for (i = 0; i < (1UL << table->bits); ++i) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+		hlist_for_each_entry(exe, tmp, &table->by_path[i], by_path) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+		hlist_for_each_entry(exe, &table->by_path[i], by_path) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+			for (row = exe->rows; row != NULL; row = row->next) {
+				pos = whitelist_print(row, *last, available);
+				if (pos == NULL)
+					return false;
+				*last = pos;
+			}
+		}
+	}
+	return true;
+}
+
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
 int
 whitelist_param_get(char *buffer, struct kernel_param *kp)
@@ -131,26 +1192,18 @@ static int
 whitelist_param_get(char *buffer, const struct kernel_param *kp)
 #endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
 {
-	struct white_process *row;
 	char *last;
-	char *tmp;
 	/* fs/sysfs/file.c indicate that max size is PAGE_SIZE (minus trailing space) */
 	size_t available = PAGE_SIZE - 1;
 
-	read_lock(&whitelist_rwlock);
+	mutex_lock(&whitelist_sanitylock);
 
-	last = buffer;
-	row = whitelist;
-	while (row != NULL) {
-		tmp = whitelist_print(row, last, &available);
-		if (tmp == NULL) {
-			if (available < sizeof(whitelist_overflow) - 1)
-				last = buffer + (PAGE_SIZE - sizeof(whitelist_overflow));
-			last += scnprintf(buffer, sizeof(whitelist_overflow) - 1, "%s", whitelist_overflow);
-			goto done;
-		}
-		last = tmp;
-		row = row->next;
+	if (!whitelist_render(buffer, &available, &last)) {
+		/* The whole whitelist can be read from the whitelist device */
+		if (available < sizeof(whitelist_overflow) - 1)
+			last = buffer + (PAGE_SIZE - sizeof(whitelist_overflow));
+		last += scnprintf(buffer, sizeof(whitelist_overflow) - 1, "%s", whitelist_overflow);
+		goto done;
 	}
 
 	if (last > buffer) {
@@ -158,7 +1211,7 @@ whitelist_param_get(char *buffer, const struct kernel_param *kp)
 		*last = '\0';
 	}
 done:
-	read_unlock(&whitelist_rwlock);
+	mutex_unlock(&whitelist_sanitylock);
 
 	/* last - buffer < PAGE_SIZE thus does not overflow int */
 	return (int)(last - buffer);
@@ -170,3 +1223,467 @@ const struct kernel_param_ops whitelist_param = {
 	.get = whitelist_param_get,
 };
 #endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+/**********************************/
+/*          Statistics            */
+/**********************************/
+
+/*
+ * Both statistics are read without the update lock: rules are walked under
+ * rcu_read_lock and the per CPU counters are summed while reading.
+ */
+
+/* Number of rules shown by the 'whitelist_hits' parameter */
+#define WHITE_HITS_TOP 32
+
+struct white_hits {
+	unsigned long hits                /** Events ignored thanks to the rule */;
+	const struct white_process *row   /** Rule */;
+};
+
+static unsigned long
+white_row_hits(const struct white_process *row)
+{
+	unsigned long hits = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		hits += READ_ONCE(*per_cpu_ptr(row->hits, cpu));
+	return hits;
+}
+
+/* Insert a rule in the top, sorted by decreasing hits */
+static void
+white_hits_insert(struct white_hits *top, size_t *nr, unsigned long hits,
+		  const struct white_process *row)
+{
+	size_t i;
+
+	/* An executable being replaced is briefly seen twice */
+	for (i = 0; i < *nr; ++i)
+		if (top[i].row == row)
+			return;
+
+	if (*nr < WHITE_HITS_TOP) {
+		i = (*nr)++;
+	} else {
+		if (top[WHITE_HITS_TOP - 1].hits >= hits)
+			return;
+		i = WHITE_HITS_TOP - 1;
+	}
+	while (i > 0 && top[i - 1].hits < hits) {
+		top[i] = top[i - 1];
+		--i;
+	}
+	top[i].hits = hits;
+	top[i].row = row;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+whitelist_hits_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+whitelist_hits_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return -EPERM;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+whitelist_hits_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+whitelist_hits_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	const struct white_table *table;
+	const struct white_process *row;
+	const struct white_exe *exe;
+	struct white_hits *top;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+	/* fs/sysfs/file.c indicate that max size is PAGE_SIZE (minus trailing space) */
+	size_t available = PAGE_SIZE - 1;
+	size_t rem;
+	size_t nr = 0;
+	size_t i;
+	char *last = buffer;
+	char *pos;
+	int ret;
+
+	top = kmalloc(WHITE_HITS_TOP * sizeof(struct white_hits), GFP_KERNEL);
+	if (unlikely(top == NULL))
+		return -ENOMEM;
+
+	rcu_read_lock();
+
+	table = rcu_dereference(whitelist);
+	for (i = 0; table != NULL && i < (1UL << table->bits); ++i) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+		hlist_for_each_entry_rcu(exe, tmp, &table->by_path[i], by_path) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+		hlist_for_each_entry_rcu(exe, &table->by_path[i], by_path) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+			for (row = rcu_dereference(exe->rows); row != NULL;
+			     row = rcu_dereference(row->next))
+				white_hits_insert(top, &nr, white_row_hits(row), row);
+		}
+	}
+
+	/* One rule per line, after its number of hits */
+	for (i = 0; i < nr && top[i].hits > 0; ++i) {
+		ret = scnprintf(last, available, "%lu ", top[i].hits);
+		if (ret == 0)
+			break;
+		rem = available - (size_t)ret;
+		pos = whitelist_print(top[i].row, last + ret, &rem);
+		if (pos == NULL)
+			break;
+		*(pos - 1) = '\n';
+		available = rem;
+		last = pos;
+	}
+
+	rcu_read_unlock();
+	kfree(top);
+
+	if (last > buffer) {
+		--last;
+		*last = '\0';
+	}
+	/* last - buffer < PAGE_SIZE thus does not overflow int */
+	return (int)(last - buffer);
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+static const struct kernel_param_ops whitelist_hits_param = {
+	.set = whitelist_hits_param_set,
+	.get = whitelist_hits_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(whitelist_hits, &whitelist_hits_param_set, &whitelist_hits_param_get, NULL, 0400);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(whitelist_hits, &whitelist_hits_param, NULL, 0400);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(whitelist_hits, "The whitelist rules which ignored the most events,"
+		 " with the number of events they ignored");
+
+static int
+white_miss_cmp(const void *a, const void *b)
+{
+	const struct white_miss *miss_a = a;
+	const struct white_miss *miss_b = b;
+
+	if (miss_a->count != miss_b->count)
+		return (miss_a->count > miss_b->count) ? -1 : 1;
+	return 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+whitelist_misses_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+whitelist_misses_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return -EPERM;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+whitelist_misses_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+whitelist_misses_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	struct white_miss *slots;
+	struct white_miss *merged;
+	struct white_miss *miss;
+	size_t nr = 0;
+	size_t i, j;
+	size_t available = PAGE_SIZE - 1;
+	char *last = buffer;
+	int cpu;
+	int ret;
+
+	slots = kmalloc(sizeof(struct white_miss) * WHITE_MISS_SLOTS, GFP_KERNEL);
+	merged = white_alloc(sizeof(struct white_miss) * WHITE_MISS_SLOTS * nr_cpu_ids);
+	if (unlikely(slots == NULL || merged == NULL)) {
+		kfree(slots);
+		white_free(merged);
+		return -ENOMEM;
+	}
+
+	/* Sum the counts of the same path on all CPUs */
+	for_each_possible_cpu(cpu) {
+		white_miss_copy(slots, cpu);
+		for (i = 0; i < WHITE_MISS_SLOTS; ++i) {
+			miss = &slots[i];
+			if (miss->count == 0)
+				continue;
+			for (j = 0; j < nr; ++j) {
+				if (white_miss_equal(&merged[j], miss->hash, miss->path, miss->path_len)) {
+					merged[j].count += miss->count;
+					break;
+				}
+			}
+			if (j == nr)
+				merged[nr++] = *miss;
+		}
+	}
+	sort(merged, nr, sizeof(struct white_miss), white_miss_cmp, NULL);
+
+	/* One path per line, after its (over-estimated) number of misses */
+	for (i = 0; i < nr; ++i) {
+		miss = &merged[i];
+		ret = scnprintf(last, available, "%lu %.*s%s\n", miss->count,
+				(int)min_t(size_t, miss->path_len, WHITE_MISS_PATH), miss->path,
+				(miss->path_len > WHITE_MISS_PATH) ? "..." : "");
+		/* Only print complete lines */
+		if (ret == 0 || last[ret - 1] != '\n')
+			break;
+		last += ret;
+		available -= (size_t)ret;
+	}
+
+	kfree(slots);
+	white_free(merged);
+
+	if (last > buffer) {
+		--last;
+		*last = '\0';
+	}
+	/* last - buffer < PAGE_SIZE thus does not overflow int */
+	return (int)(last - buffer);
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+static const struct kernel_param_ops whitelist_misses_param = {
+	.set = whitelist_misses_param_set,
+	.get = whitelist_misses_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(whitelist_misses, &whitelist_misses_param_set, &whitelist_misses_param_get, NULL, 0400);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(whitelist_misses, &whitelist_misses_param, NULL, 0400);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(whitelist_misses, "The most frequent executables which were"
+		 " not whitelisted, with an estimation of their number of events");
+
+/**********************************/
+/*       Whitelist device         */
+/**********************************/
+
+/*
+ * /dev/<module>_whitelist: reading it prints the whole whitelist, one rule
+ * per line. What is written is applied when the file is closed: either a
+ * list of rules to add or remove (see whitelist_apply), or a binary
+ * whitelist replacing the current one.
+ */
+struct whitelist_dev_data {
+	struct mutex lock  /** Serializes the writes */;
+	char *buf          /** Data written, or whitelist to read */;
+	size_t len         /** Length of the data */;
+	size_t size        /** Size of the buffer */;
+};
+
+static int
+whitelist_dev_render(struct whitelist_dev_data *data)
+{
+	size_t size = PAGE_SIZE;
+	size_t available;
+	char *last;
+	bool done;
+
+	for (;;) {
+		data->buf = white_alloc(size);
+		if (unlikely(data->buf == NULL))
+			return -ENOMEM;
+
+		mutex_lock(&whitelist_sanitylock);
+		available = size;
+		done = whitelist_render(data->buf, &available, &last);
+		mutex_unlock(&whitelist_sanitylock);
+
+		if (done)
+			break;
+		white_free(data->buf);
+		data->buf = NULL;
+		if (size >= WHITELIST_DEV_MAX)
+			return -EFBIG;
+		size *= 2;
+	}
+
+	/* One rule per line */
+	data->len = (size_t)(last - data->buf);
+	data->size = size;
+	for (last = data->buf; last < data->buf + data->len; ++last)
+		if (*last == ',')
+			*last = '\n';
+	return 0;
+}
+
+static int
+whitelist_dev_open(struct inode *inode, struct file *file)
+{
+	struct whitelist_dev_data *data;
+	int err;
+
+	/* Reading and writing at the same time makes no sense */
+	if ((file->f_mode & FMODE_READ) && (file->f_mode & FMODE_WRITE))
+		return -EINVAL;
+
+	data = kzalloc(sizeof(*data), GFP_KERNEL);
+	if (unlikely(data == NULL))
+		return -ENOMEM;
+	mutex_init(&data->lock);
+
+	if (file->f_mode & FMODE_READ) {
+		err = whitelist_dev_render(data);
+		if (err != 0) {
+			mutex_destroy(&data->lock);
+			kfree(data);
+			return err;
+		}
+	}
+
+	file->private_data = data;
+	return nonseekable_open(inode, file);
+}
+
+static ssize_t
+whitelist_dev_read(struct file *file, char __user *buf, size_t count, loff_t *ppos)
+{
+	struct whitelist_dev_data *data = file->private_data;
+
+	return simple_read_from_buffer(buf, count, ppos, data->buf, data->len);
+}
+
+static ssize_t
+whitelist_dev_write(struct file *file, const char __user *buf, size_t count, loff_t *ppos)
+{
+	struct whitelist_dev_data *data = file->private_data;
+	size_t size;
+	char *new_buf;
+	ssize_t ret;
+
+	mutex_lock(&data->lock);
+
+	if (count > WHITELIST_DEV_MAX - data->len) {
+		ret = -EFBIG;
+		goto out;
+	}
+
+	/* Keep room for a trailing '\0' */
+	if (data->len + count >= data->size) {
+		size = max_t(size_t, PAGE_SIZE, 2 * data->size);
+		size = max_t(size_t, size, data->len + count + 1);
+		new_buf = white_alloc(size);
+		if (unlikely(new_buf == NULL)) {
+			ret = -ENOMEM;
+			goto out;
+		}
+		if (data->len > 0)
+			memcpy(new_buf, data->buf, data->len);
+		white_free(data->buf);
+		data->buf = new_buf;
+		data->size = size;
+	}
+
+	if (copy_from_user(data->buf + data->len, buf, count)) {
+		ret = -EFAULT;
+		goto out;
+	}
+	data->len += count;
+	/* count <= WHITELIST_DEV_MAX, can't overflow */
+	ret = (ssize_t)count;
+out:
+	mutex_unlock(&data->lock);
+	return ret;
+}
+
+/*
+ * Apply what was written when the file is closed: unlike release, the
+ * return value of flush reaches close(2). Duplicated descriptors are
+ * flushed too, only the first one applies the rules.
+ */
+static int
+whitelist_dev_flush(struct file *file, fl_owner_t id)
+{
+	struct whitelist_dev_data *data = file->private_data;
+	int ret = 0;
+
+	if (data == NULL || !(file->f_mode & FMODE_WRITE))
+		return 0;
+
+	mutex_lock(&data->lock);
+	if (data->len > 0) {
+		data->buf[data->len] = '\0';
+		if (data->len >= sizeof(u32) &&
+		    *(const u32 *)data->buf == WHITELIST_BLOB_MAGIC)
+			ret = whitelist_load_blob(data->buf, data->len);
+		else
+			ret = whitelist_apply(data->buf);
+		data->len = 0;
+	}
+	mutex_unlock(&data->lock);
+
+	return ret;
+}
+
+static int
+whitelist_dev_release(struct inode *inode, struct file *file)
+{
+	struct whitelist_dev_data *data = file->private_data;
+
+	if (data == NULL)
+		return 0;
+
+	white_free(data->buf);
+	mutex_destroy(&data->lock);
+	kfree(data);
+	return 0;
+}
+
+static const struct file_operations whitelist_dev_fops = {
+	.owner = THIS_MODULE,
+	.open = whitelist_dev_open,
+	.read = whitelist_dev_read,
+	.write = whitelist_dev_write,
+	.flush = whitelist_dev_flush,
+	.release = whitelist_dev_release,
+};
+
+static struct miscdevice whitelist_dev = {
+	.minor = MISC_DYNAMIC_MINOR,
+	.name = MODULE_NAME "_whitelist",
+	.fops = &whitelist_dev_fops,
+};
+
+int
+whitelist_device_register(void)
+{
+	int err;
+
+	err = misc_register(&whitelist_dev);
+	if (err != 0)
+		pr_err("[-] Failed to create /dev/%s\n", whitelist_dev.name);
+	else
+		pr_info("[+] Created /dev/%s for whitelist updates\n", whitelist_dev.name);
+	return err;
+}
+
+void
+whitelist_device_unregister(void)
+{
+	misc_deregister(&whitelist_dev);
+}
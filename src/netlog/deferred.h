@@ -0,0 +1 @@
+../lib/deferred.h
\ No newline at end of file
@@ -7,9 +7,12 @@
 #include <linux/syscalls.h>
 #include <linux/kallsyms.h>
 #include "whitelist.h"
+#include "prefilter.h"
 #include "probes.h"
 #include "internal.h"
 #include "netlog.h"
+#include "path_cache.h"
+#include "aggregate.h"
 
 /****************************************************************/
 /* Kernel module information (submitted at the end of the file) */
@@ -51,6 +54,37 @@ DEFINE_PROBE_PARAM(udp_connect, 3)
 DEFINE_PROBE_PARAM(udp_bind,    4)
 DEFINE_PROBE_PARAM(udp_close,   5)
 
+# if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(backend, &backend_param_set, &backend_param_get, NULL, 0444);
+# else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(backend, &backend_param, NULL, 0444);
+# endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(backend, " Source of the TCP connect and close events, set"
+		 " when loading the module: 'kprobe' (default) or 'tracepoint'"
+		 " (inet_sock_set_state, Linux 4.16 and later).");
+
+# if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(deferred, &deferred_param_set, &deferred_param_get, NULL, 0600);
+module_param_call(deferred_stats, &deferred_stats_param_set, &deferred_stats_param_get, NULL, 0400);
+# else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(deferred, &deferred_param, NULL, 0600);
+module_param_cb(deferred_stats, &deferred_stats_param, NULL, 0400);
+# endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(deferred, " A boolean indicating if connections are logged by"
+		 " their task before it returns to userspace instead of from"
+		 " the probes (Linux 3.7 and later, default to false).");
+MODULE_PARM_DESC(deferred_stats, " Number of events logged from task_work, and"
+		 " logged from the probes because all the preallocated entries"
+		 " of the CPU were queued");
+
+# if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(sock_cache_stats, &sock_cache_stats_param_set, &sock_cache_stats_param_get, NULL, 0400);
+# else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(sock_cache_stats, &sock_cache_stats_param, NULL, 0400);
+# endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(sock_cache_stats, " Statistics of the cache of the decisions"
+		 " taken per socket (hits, misses and invalidations on close)");
+
 # if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
 module_param_call(whitelist, &whitelist_param_set, &whitelist_param_get, NULL, 0600);
 # else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
@@ -61,6 +95,22 @@ MODULE_PARM_DESC(whitelist, " A coma separated list of strings that contains"
 		 " The format of the string must be '${executable}|i<${ip}>|<${port}>'."
 		 " The ip and port parts are optional.");
 
+# if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(prefilter, &prefilter_param_set, &prefilter_param_get, NULL, 0600);
+module_param_call(prefilter_stats, &prefilter_stats_param_set, &prefilter_stats_param_get, NULL, 0400);
+# else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(prefilter, &prefilter_param, NULL, 0600);
+module_param_cb(prefilter_stats, &prefilter_stats_param, NULL, 0400);
+# endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(prefilter, " A coma separated list of rules dropping events"
+		 " before the executable is looked at. A rule is a '|' separated"
+		 " list of fields which must all match: 't<tcp>' or 't<udp>',"
+		 " 'f<4>' or 'f<6>', 'a<loopback>' or 'a<linklocal>',"
+		 " 'p<remote port[-max]>',"
+		 " 'l<local port[-max]>', 'u<uid[-max]>', 'g<gid[-max]>',"
+		 " 'n<netns inode>'.");
+MODULE_PARM_DESC(prefilter_stats, " Number of events dropped by the prefilter");
+
 /************************************/
 /*             INIT MODULE          */
 /************************************/
@@ -71,14 +121,28 @@ static int __init netlog_init(void)
 
 	pr_info("Light monitoring tool for inet connections by CERN Security Team\n");
 
+	ret = whitelist_device_register();
+	if (ret != 0)
+		goto free_params;
+
+	deferred_logging_init();
 	ret = probes_init();
 	if (ret != 0) {
 		unplant_all();
-		destroy_whitelist();
-	} else {
-		pr_info("[+] "MODULE_NAME" version "MOD_VER" deployed\n");
+		deferred_logging_wait();
+		whitelist_device_unregister();
+		goto free_params;
 	}
 
+	pr_info("[+] "MODULE_NAME" version "MOD_VER" deployed\n");
+	return 0;
+
+free_params:
+	/* Parameters given at load time were already applied */
+	destroy_whitelist();
+	destroy_prefilter();
+	aggregate_destroy();
+	path_cache_destroy();
 	return ret;
 }
 
@@ -89,7 +153,12 @@ static int __init netlog_init(void)
 static void __exit netlog_exit(void)
 {
 	unplant_all();
+	deferred_logging_wait();
+	whitelist_device_unregister();
 	destroy_whitelist();
+	destroy_prefilter();
+	aggregate_destroy();
+	path_cache_destroy();
 }
 
 
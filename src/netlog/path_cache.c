@@ -0,0 +1 @@
+../lib/path_cache.c
\ No newline at end of file
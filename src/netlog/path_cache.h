@@ -0,0 +1 @@
+../lib/path_cache.h
\ No newline at end of file
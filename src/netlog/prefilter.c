@@ -0,0 +1,467 @@
+#include <linux/cred.h>
+#include <linux/in.h>
+#include <linux/in6.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/percpu.h>
+#include <linux/rcupdate.h>
+#include <linux/slab.h>
+#include <linux/socket.h>
+#include <linux/string.h>
+#include <linux/version.h>
+#include <net/net_namespace.h>
+#include <net/sock.h>
+#include "prefilter.h"
+#include "print_netlog.h"
+#include "netlog.h"
+#include "internal.h"
+#include "sparse_compat.h"
+
+/* Maximum number of rules */
+#define PREFILTER_MAX_RULES 64
+
+/* Fields of a rule, all the fields set must match */
+#define PF_PROTOCOL (1 << 0)
+#define PF_FAMILY   (1 << 1)
+#define PF_SCOPE    (1 << 2)
+#define PF_DST_PORT (1 << 3)
+#define PF_SRC_PORT (1 << 4)
+#define PF_UID      (1 << 5)
+#define PF_GID      (1 << 6)
+#define PF_NETNS    (1 << 7)
+
+/* Scope of the address of the peer, or the local one if there is no peer */
+enum prefilter_scope {
+	SCOPE_OTHER = 0,
+	SCOPE_LOOPBACK,
+	SCOPE_LINKLOCAL,
+};
+
+struct prefilter_rule {
+	unsigned int fields      /** PF_* fields set */;
+	u8 protocol              /** enum netlog_protocol */;
+	unsigned short family    /** AF_INET or AF_INET6 */;
+	u8 scope                 /** enum prefilter_scope */;
+	u32 dst_port[2]          /** Range of remote ports, bounds included */;
+	u32 src_port[2]          /** Range of local ports, bounds included */;
+	u32 uid[2]               /** Range of real UIDs, bounds included */;
+	u32 gid[2]               /** Range of real GIDs, bounds included */;
+	unsigned int netns       /** Inode number of the network namespace */;
+};
+
+struct prefilter {
+	size_t nr_rules;
+	char *raw                /** Rules as set, for the parameter */;
+	struct prefilter_rule rules[];
+};
+
+/* Current rules, NULL if none. Probes only read them under rcu_read_lock */
+static struct prefilter __rcu *prefilter = NULL;
+
+/* Only one update at a time */
+static DEFINE_MUTEX(prefilter_lock);
+
+/* Events dropped by the prefilter */
+static DEFINE_PER_CPU(unsigned long, prefilter_rejected);
+
+/**********************************/
+/*           Matching             */
+/**********************************/
+
+static enum prefilter_scope
+prefilter_scope_of(unsigned short family, const void *ip)
+{
+	const u8 *raw = ip;
+	static const u8 v4_mapped[12] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff };
+	static const u8 v6_loopback[16] = { 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 };
+
+	if (family == AF_INET6) {
+		if (memcmp(raw, v6_loopback, sizeof(v6_loopback)) == 0)
+			return SCOPE_LOOPBACK;
+		if (raw[0] == 0xfe && (raw[1] & 0xc0) == 0x80)
+			return SCOPE_LINKLOCAL;
+		if (memcmp(raw, v4_mapped, sizeof(v4_mapped)) != 0)
+			return SCOPE_OTHER;
+		raw += sizeof(v4_mapped);
+	}
+
+	/* 127.0.0.0/8 and 169.254.0.0/16 */
+	if (raw[0] == 127)
+		return SCOPE_LOOPBACK;
+	if (raw[0] == 169 && raw[1] == 254)
+		return SCOPE_LINKLOCAL;
+	return SCOPE_OTHER;
+}
+
+static bool
+prefilter_ip_unspecified(unsigned short family, const void *ip)
+{
+	static const u8 zero[16];
+
+	return memcmp(ip, zero, (family == AF_INET) ? 4 : 16) == 0;
+}
+
+static inline bool
+prefilter_in_range(const u32 *range, u32 value)
+{
+	return value >= range[0] && value <= range[1];
+}
+
+/* Inode number of the network namespace, as in /proc/<pid>/ns/net (3.8 and later) */
+static unsigned int
+prefilter_netns_of(const struct sock *sk)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 19, 0)
+	return sock_net(sk)->ns.inum;
+#elif LINUX_VERSION_CODE >= KERNEL_VERSION(3, 8, 0)
+	return sock_net(sk)->proc_inum;
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 8, 0) */
+	return 0;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 19, 0) */
+}
+
+bool
+prefilter_reject(const struct sock *sk, u8 protocol, unsigned short family,
+		 const void *src_ip, int src_port,
+		 const void *dst_ip, int dst_port)
+{
+	const struct prefilter *filter;
+	const struct prefilter_rule *rule;
+	const struct cred *cred;
+	const void *scope_ip;
+	unsigned int netns = 0;
+	u32 uid, gid;
+	int scope = -1;
+	bool rejected = false;
+	size_t i;
+
+	rcu_read_lock();
+	filter = rcu_dereference(prefilter);
+	if (likely(filter == NULL))
+		goto out;
+
+	cred = current_cred();
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 5, 0)
+	uid = cred->uid.val;
+	gid = cred->gid.val;
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 5, 0) */
+	uid = cred->uid;
+	gid = cred->gid;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 5, 0) */
+
+	for (i = 0; i < filter->nr_rules && !rejected; ++i) {
+		rule = &filter->rules[i];
+		if ((rule->fields & PF_PROTOCOL) && rule->protocol != protocol)
+			continue;
+		if ((rule->fields & PF_FAMILY) && rule->family != family)
+			continue;
+		if ((rule->fields & PF_DST_PORT) &&
+		    !prefilter_in_range(rule->dst_port, (u32) dst_port))
+			continue;
+		if ((rule->fields & PF_SRC_PORT) &&
+		    !prefilter_in_range(rule->src_port, (u32) src_port))
+			continue;
+		if ((rule->fields & PF_UID) && !prefilter_in_range(rule->uid, uid))
+			continue;
+		if ((rule->fields & PF_GID) && !prefilter_in_range(rule->gid, gid))
+			continue;
+		if (rule->fields & PF_SCOPE) {
+			if (scope < 0) {
+				if (family != AF_INET && family != AF_INET6) {
+					scope = SCOPE_OTHER;
+				} else {
+					scope_ip = dst_ip;
+					if (prefilter_ip_unspecified(family, dst_ip))
+						scope_ip = src_ip;
+					scope = prefilter_scope_of(family, scope_ip);
+				}
+			}
+			if (rule->scope != scope)
+				continue;
+		}
+		if (rule->fields & PF_NETNS) {
+			if (netns == 0)
+				netns = prefilter_netns_of(sk);
+			if (rule->netns != netns)
+				continue;
+		}
+		rejected = true;
+	}
+
+out:
+	rcu_read_unlock();
+	if (rejected)
+		this_cpu_inc(prefilter_rejected);
+	return rejected;
+}
+
+/**********************************/
+/*            Parsing             */
+/**********************************/
+
+/* Parse 'value' or 'low-high' */
+static int
+prefilter_parse_range(char *str, u32 *range, u32 max)
+{
+	char *high;
+	int ret;
+
+	high = strchr(str, '-');
+	if (high != NULL)
+		*high++ = '\0';
+	ret = kstrtou32(str, 0, &range[0]);
+	if (ret != 0)
+		return ret;
+	if (high == NULL)
+		range[1] = range[0];
+	else if ((ret = kstrtou32(high, 0, &range[1])) != 0)
+		return ret;
+	if (range[0] > range[1] || range[1] > max)
+		return -EINVAL;
+	return 0;
+}
+
+/* Parse 'key<value>|key<value>...' */
+static int
+prefilter_parse_rule(char *str, struct prefilter_rule *rule)
+{
+	char *field, *value;
+	size_t len;
+	unsigned int bit;
+	int ret = 0;
+
+	memset(rule, 0, sizeof(*rule));
+	while ((field = strsep(&str, "|")) != NULL) {
+		if (field[0] == '\0' || field[1] == '\0')
+			return -EINVAL;
+		value = field + 1;
+		if (*value == '<')
+			++value;
+		len = strlen(value);
+		if (len > 0 && value[len - 1] == '>')
+			value[--len] = '\0';
+		if (len == 0)
+			return -EINVAL;
+
+		switch (field[0]) {
+		case 't':
+			bit = PF_PROTOCOL;
+			if (strcmp(value, "tcp") == 0)
+				rule->protocol = PROTO_TCP;
+			else if (strcmp(value, "udp") == 0)
+				rule->protocol = PROTO_UDP;
+			else
+				ret = -EINVAL;
+			break;
+		case 'f':
+			bit = PF_FAMILY;
+			if (strcmp(value, "4") == 0)
+				rule->family = AF_INET;
+			else if (strcmp(value, "6") == 0)
+				rule->family = AF_INET6;
+			else
+				ret = -EINVAL;
+			break;
+		case 'a':
+			bit = PF_SCOPE;
+			if (strcmp(value, "loopback") == 0)
+				rule->scope = SCOPE_LOOPBACK;
+			else if (strcmp(value, "linklocal") == 0)
+				rule->scope = SCOPE_LINKLOCAL;
+			else
+				ret = -EINVAL;
+			break;
+		case 'p':
+			bit = PF_DST_PORT;
+			ret = prefilter_parse_range(value, rule->dst_port, 65535);
+			break;
+		case 'l':
+			bit = PF_SRC_PORT;
+			ret = prefilter_parse_range(value, rule->src_port, 65535);
+			break;
+		case 'u':
+			bit = PF_UID;
+			ret = prefilter_parse_range(value, rule->uid, (u32) ~0U);
+			break;
+		case 'g':
+			bit = PF_GID;
+			ret = prefilter_parse_range(value, rule->gid, (u32) ~0U);
+			break;
+		case 'n':
+			bit = PF_NETNS;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 8, 0)
+			ret = kstrtouint(value, 0, &rule->netns);
+			if (ret == 0 && rule->netns == 0)
+				ret = -EINVAL;
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 8, 0) */
+			ret = -EINVAL;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 8, 0) */
+			break;
+		default:
+			return -EINVAL;
+		}
+		if (ret != 0 || (rule->fields & bit))
+			return -EINVAL;
+		rule->fields |= bit;
+	}
+
+	/* A rule without any field would drop everything */
+	return (rule->fields == 0) ? -EINVAL : 0;
+}
+
+static void
+prefilter_free(struct prefilter *filter)
+{
+	if (filter == NULL)
+		return;
+	kfree(filter->raw);
+	kfree(filter);
+}
+
+/* Install new rules, NULL for none, and free the previous ones */
+static void
+prefilter_swap(struct prefilter *filter)
+{
+	struct prefilter *old;
+
+	mutex_lock(&prefilter_lock);
+	old = rcu_dereference_protected(prefilter, lockdep_is_held(&prefilter_lock));
+	rcu_assign_pointer(prefilter, filter);
+	mutex_unlock(&prefilter_lock);
+
+	synchronize_rcu();
+	prefilter_free(old);
+}
+
+void
+destroy_prefilter(void)
+{
+	prefilter_swap(NULL);
+}
+
+/**********************************/
+/*      Module parameters         */
+/**********************************/
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+prefilter_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+prefilter_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	struct prefilter *filter;
+	char *copy, *pos, *raw;
+	size_t nr_rules = 0;
+	int ret;
+
+	if (buf == NULL)
+		return -EINVAL;
+
+	filter = kzalloc(sizeof(*filter) + PREFILTER_MAX_RULES * sizeof(filter->rules[0]),
+			 GFP_KERNEL);
+	copy = kstrdup(buf, GFP_KERNEL);
+	if (filter != NULL)
+		filter->raw = kstrdup(buf, GFP_KERNEL);
+	if (unlikely(filter == NULL || copy == NULL || filter->raw == NULL)) {
+		ret = -ENOMEM;
+		goto fail;
+	}
+
+	pos = copy;
+	while ((raw = strsep(&pos, ",\n")) != NULL) {
+		if (*raw == '\0')
+			continue;
+		if (nr_rules == PREFILTER_MAX_RULES) {
+			pr_err("[-] Too many prefilter rules (max %d)\n", PREFILTER_MAX_RULES);
+			ret = -E2BIG;
+			goto fail;
+		}
+		ret = prefilter_parse_rule(raw, &filter->rules[nr_rules]);
+		if (ret != 0) {
+			pr_err("[-] Invalid prefilter rule %zu\n", nr_rules + 1);
+			goto fail;
+		}
+		++nr_rules;
+	}
+	kfree(copy);
+
+	if (nr_rules == 0) {
+		prefilter_free(filter);
+		filter = NULL;
+	} else {
+		filter->nr_rules = nr_rules;
+	}
+	prefilter_swap(filter);
+	pr_info("[+] %zu prefilter rules applied\n", nr_rules);
+	return 0;
+
+fail:
+	kfree(copy);
+	prefilter_free(filter);
+	return ret;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+prefilter_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+prefilter_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	const struct prefilter *filter;
+	int ret;
+
+	mutex_lock(&prefilter_lock);
+	filter = rcu_dereference_protected(prefilter, lockdep_is_held(&prefilter_lock));
+	ret = scnprintf(buffer, PAGE_SIZE, "%s", (filter == NULL) ? "" : filter->raw);
+	mutex_unlock(&prefilter_lock);
+
+	return ret;
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+const struct kernel_param_ops prefilter_param = {
+	.set = prefilter_param_set,
+	.get = prefilter_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+prefilter_stats_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+prefilter_stats_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return -EPERM;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+prefilter_stats_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+prefilter_stats_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	unsigned long rejected = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu)
+		rejected += READ_ONCE(*per_cpu_ptr(&prefilter_rejected, cpu));
+
+	return scnprintf(buffer, PAGE_SIZE, "rejected:%lu", rejected);
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+const struct kernel_param_ops prefilter_stats_param = {
+	.set = prefilter_stats_param_set,
+	.get = prefilter_stats_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
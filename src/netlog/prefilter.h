@@ -0,0 +1,34 @@
+#ifndef __NETLOG_PREFILTER__
+#define __NETLOG_PREFILTER__
+
+#include <linux/moduleparam.h>
+#include <linux/types.h>
+#include <linux/version.h>
+#include <net/sock.h>
+
+/*
+ * Rules dropping events before the executable is even looked at, from the
+ * socket and the credentials of 'current' only.
+ */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int prefilter_param_set(const char *buf, struct kernel_param *kp);
+int prefilter_param_get(char *buffer, struct kernel_param *kp);
+int prefilter_stats_param_set(const char *buf, struct kernel_param *kp);
+int prefilter_stats_param_get(char *buffer, struct kernel_param *kp);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+extern const struct kernel_param_ops prefilter_param;
+extern const struct kernel_param_ops prefilter_stats_param;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+
+/*
+ * Can be called from probes. Addresses are in network byte order, ports in
+ * host byte order. Return true if a rule drops the event.
+ */
+bool prefilter_reject(const struct sock *sk, u8 protocol, unsigned short family,
+		      const void *src_ip, int src_port,
+		      const void *dst_ip, int dst_port);
+
+void destroy_prefilter(void);
+
+#endif /* __NETLOG_PREFILTER__ */
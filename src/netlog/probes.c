@@ -1,4 +1,5 @@
 #include <linux/file.h>
+#include <linux/hash.h>
 #include <linux/in.h>
 #include <linux/init.h>
 #include <linux/ipv6.h>
@@ -6,12 +7,22 @@
 #include <linux/kprobes.h>
 #include <linux/module.h>
 #include <linux/net.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
 #include <linux/socket.h>
+#include <linux/spinlock.h>
 #include <linux/syscalls.h>
 #include <linux/version.h>
+#include <linux/vmalloc.h>
 #include <linux/unistd.h>
 #include <net/ip.h>
+#include <net/sock.h>
+#include <net/tcp_states.h>
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0)
+#include <linux/sched/clock.h>
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 11, 0) */
 #include "whitelist.h"
+#include "prefilter.h"
 #include "netlog.h"
 #ifdef USE_PRINK
 #include "current_details.h"
@@ -23,7 +34,11 @@
 #include "sparse_compat.h"
 #include "retro-compat.h"
 #include "internal.h"
+#include "path_cache.h"
 #include "probes_helper.h"
+#include "deferred.h"
+#include "tracepoint_helper.h"
+#include "aggregate.h"
 
 /********************************/
 /*          Variables           */
@@ -39,6 +54,19 @@ static DEFINE_SEMAPHORE(probe_lock);
 static DECLARE_MUTEX(probe_lock);
 #endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 36, 0) */
 
+enum netlog_backend {
+	BACKEND_KPROBE     /** Kprobes and kretprobes only */,
+	BACKEND_TRACEPOINT /** TCP connect and close from the inet_sock_set_state tracepoint (4.16 and later) */,
+};
+
+static const char * const backend_names[] = {
+	[BACKEND_KPROBE] = "kprobe",
+	[BACKEND_TRACEPOINT] = "tracepoint",
+};
+
+/* Only set before the probes are planted */
+static enum netlog_backend backend = BACKEND_KPROBE;
+
 struct probes probe_list[] = {
 	{ "tcp_connect", 1 << PROBE_TCP_CONNECT },
 	{ "tcp_accept",  1 << PROBE_TCP_ACCEPT},
@@ -52,106 +80,719 @@ struct probes probe_list[] = {
 /*            Tools             */
 /********************************/
 
-static char *path_from_mm(struct mm_struct *mm, char *buffer, int length)
+static const char *default_exec_name = "@Unknown";
+
+union netlog_ip {
+	struct in_addr ip4;
+	struct in6_addr ip6;
+	u8 raw[16];
+};
+
+/* What the probes know about a network event, enough to log it later */
+struct netlog_event {
+	u64 nsec                 /** Timestamp of the event */;
+	const struct sock *sk    /** Socket, only a key for the decision cache once the probe returns */;
+	struct exe_identity id   /** Identity of the executable of 'current' */;
+	bool logged              /** Not whitelisted, as already decided for this socket */;
+	u8 protocol              /** enum netlog_protocol */;
+	u8 action                /** enum netlog_action */;
+	unsigned short family    /** Family of the socket */;
+	int src_port             /** Source port (local) */;
+	int dst_port             /** Destination port (distant) */;
+	union netlog_ip src      /** Source address (local), only valid for AF_INET and AF_INET6 */;
+	union netlog_ip dst      /** Destination address (distant), only valid for AF_INET and AF_INET6 */;
+};
+
+static void
+netlog_event_capture(struct netlog_event *event, struct sock *sk,
+		     u8 protocol, u8 action)
 {
-	char *p = NULL;
-	struct file * exe_file = NULL;
+	/* sk needs to be non null */
+
+	event->nsec = local_clock();
+	event->sk = sk;
+	event->logged = false;
+	event->protocol = protocol;
+	event->action = action;
+	event->family = sk->sk_family;
+	event->dst_port = ntohs(inet_sk(sk)->DPORT);
+	event->src_port = ntohs(inet_sk(sk)->SPORT);
+	/* Compared as a whole by the decision cache */
+	memset(&event->src, 0, sizeof(event->src));
+	memset(&event->dst, 0, sizeof(event->dst));
+	switch (event->family) {
+	case AF_INET:
+		event->dst.ip4.s_addr = inet_sk(sk)->DADDR;
+		event->src.ip4.s_addr = inet_sk(sk)->SADDR;
+		break;
+	case AF_INET6:
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 13, 0)
+		event->dst.ip6 = sk->sk_v6_daddr;
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0) */
+# ifdef RHEL_MAJOR
+#  if RHEL_MAJOR >= 7
+		event->dst.ip6 = sk->sk_v6_daddr;
+#  else /* RHEL_MAJOR < 7 */
+		event->dst.ip6 = inet6_sk(sk)->daddr;
+#  endif /* RHEL_MAJOR ? 7 */
+# else /* !RHEL_MAJOR */
+		event->dst.ip6 = inet6_sk(sk)->daddr;
+# endif /* ?RHEL_MAJOR */
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 13, 0) */
+		event->src.ip6 = inet6_sk(sk)->saddr;
+		break;
+	default:
+		break;
+	}
+	exe_identity_of_mm(&event->id, current->mm);
+}
 
-	if (unlikely(mm == NULL))
+static inline const void *
+netlog_event_src(const struct netlog_event *event)
+{
+	if (event->family != AF_INET && event->family != AF_INET6)
 		return NULL;
+	return event->src.raw;
+}
 
-	if (!down_read_trylock(&mm->mmap_sem)) {
-		/* It's lock, we can't sleep here to get it, so just give up */
+static inline const void *
+netlog_event_dst(const struct netlog_event *event)
+{
+	if (event->family != AF_INET && event->family != AF_INET6)
 		return NULL;
+	return event->dst.raw;
+}
+
+/**********************************/
+/*     socket decision cache      */
+/**********************************/
+
+/*
+ * Decision taken for the first event of a socket, reused by the next ones
+ * (close) while the executable, the destination and the whitelist are the
+ * same. Slots are recycled round robin: a stale slot can only be hit by a
+ * new socket at the same address, with the same executable and destination,
+ * for which the decision is the same.
+ */
+#define SOCK_CACHE_BITS 8
+#define SOCK_CACHE_WAYS 4
+
+struct sock_decision {
+	const struct sock *sk    /** Socket, NULL if the slot is free */;
+	struct exe_identity id   /** Executable the decision was taken for */;
+	unsigned int generation  /** Generation of the whitelist used */;
+	unsigned short family    /** Family of the destination */;
+	int dst_port             /** Destination port */;
+	union netlog_ip dst      /** Destination address */;
+	bool whitelisted         /** The decision */;
+};
+
+struct sock_cache_bucket {
+	spinlock_t lock;
+	unsigned int next        /** Slot replaced by the next insertion */;
+	struct sock_decision slots[SOCK_CACHE_WAYS];
+};
+
+static struct sock_cache_bucket sock_cache[1 << SOCK_CACHE_BITS];
+
+struct sock_cache_stats {
+	unsigned long hits          /** Events decided from the cache */;
+	unsigned long misses        /** Events decided from the whitelist */;
+	unsigned long invalidations /** Cached decisions dropped on close */;
+};
+
+static DEFINE_PER_CPU(struct sock_cache_stats, sock_cache_stats);
+
+static void
+sock_cache_init(void)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(sock_cache); ++i)
+		spin_lock_init(&sock_cache[i].lock);
+}
+
+static inline struct sock_cache_bucket *
+sock_cache_bucket(const struct sock *sk)
+{
+	return &sock_cache[hash_ptr((void *)sk, SOCK_CACHE_BITS)];
+}
+
+static inline bool
+sock_decision_valid(const struct sock_decision *slot,
+		    const struct netlog_event *event, unsigned int generation)
+{
+	return slot->generation == generation &&
+	       slot->family == event->family &&
+	       slot->dst_port == event->dst_port &&
+	       exe_identity_equal(&slot->id, &event->id) &&
+	       memcmp(&slot->dst, &event->dst, sizeof(slot->dst)) == 0;
+}
+
+/*
+ * Find the decision taken for an earlier event of the socket. Return 1 if it
+ * was whitelisted, 0 if it was logged, -1 if unknown. Closes drop it.
+ */
+static int
+sock_cache_lookup(const struct netlog_event *event, unsigned int generation)
+{
+	struct sock_cache_bucket *bucket = sock_cache_bucket(event->sk);
+	struct sock_decision *slot;
+	int ret = -1;
+	size_t i;
+
+	spin_lock(&bucket->lock);
+	for (i = 0; i < SOCK_CACHE_WAYS; ++i) {
+		slot = &bucket->slots[i];
+		if (slot->sk != event->sk)
+			continue;
+		if (sock_decision_valid(slot, event, generation))
+			ret = slot->whitelisted;
+		if (event->action == ACTION_CLOSE) {
+			slot->sk = NULL;
+			this_cpu_inc(sock_cache_stats.invalidations);
+		}
+		break;
 	}
-	rcu_read_lock();
-	exe_file = rcu_dereference(mm->exe_file);
+	spin_unlock(&bucket->lock);
 
-	if (unlikely(exe_file == NULL)) {
-		p = NULL;
-	} else {
-		p = d_path(&exe_file->f_path, buffer, length);
-		if (IS_ERR(p))
-			p = NULL;
+	if (ret < 0)
+		this_cpu_inc(sock_cache_stats.misses);
+	else
+		this_cpu_inc(sock_cache_stats.hits);
+	return ret;
+}
+
+static void
+sock_cache_store(const struct netlog_event *event, unsigned int generation,
+		 bool whitelisted)
+{
+	struct sock_cache_bucket *bucket;
+	struct sock_decision *slot = NULL;
+	size_t i;
+
+	/* Nothing comes after a close */
+	if (event->action == ACTION_CLOSE || !exe_identity_known(&event->id))
+		return;
+
+	bucket = sock_cache_bucket(event->sk);
+	spin_lock(&bucket->lock);
+	for (i = 0; i < SOCK_CACHE_WAYS; ++i) {
+		if (bucket->slots[i].sk == event->sk) {
+			slot = &bucket->slots[i];
+			break;
+		}
 	}
-	rcu_read_unlock();
-	up_read(&mm->mmap_sem);
-	return p;
+	if (slot == NULL) {
+		slot = &bucket->slots[bucket->next];
+		bucket->next = (bucket->next + 1) % SOCK_CACHE_WAYS;
+	}
+	slot->sk = event->sk;
+	slot->id = event->id;
+	slot->generation = generation;
+	slot->family = event->family;
+	slot->dst_port = event->dst_port;
+	slot->dst = event->dst;
+	slot->whitelisted = whitelisted;
+	spin_unlock(&bucket->lock);
 }
 
-static const char *default_exec_name = "@Unknown";
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+sock_cache_stats_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+sock_cache_stats_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return -EPERM;
+}
 
-static void log_if_not_whitelisted(struct socket *sock, u8 protocol, u8 action)
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+sock_cache_stats_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+sock_cache_stats_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
 {
-	/* sock & sock->sk need to be non null */
+	unsigned long hits = 0, misses = 0, invalidations = 0;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct sock_cache_stats *stats = per_cpu_ptr(&sock_cache_stats, cpu);
+
+		hits += READ_ONCE(stats->hits);
+		misses += READ_ONCE(stats->misses);
+		invalidations += READ_ONCE(stats->invalidations);
+	}
+
+	return scnprintf(buffer, PAGE_SIZE, "hits:%lu misses:%lu invalidations:%lu",
+			 hits, misses, invalidations);
+}
 
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+const struct kernel_param_ops sock_cache_stats_param = {
+	.set = sock_cache_stats_param_set,
+	.get = sock_cache_stats_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+/**********************************/
+/*       repeated events          */
+/**********************************/
+
+/* What makes two events the same in the logs, the key of the aggregation */
+struct netlog_flow {
+	uid_t uid                /** Real UID of the process */;
+	u8 protocol              /** enum netlog_protocol */;
+	u8 action                /** enum netlog_action */;
+	unsigned short family    /** Family of the socket */;
+	int dst_port             /** Destination port (distant) */;
+	union netlog_ip dst      /** Destination address (distant) */;
+	char path[]              /** Path of the executable */;
+};
+
+/* Check if the event repeats one logged less than a window ago */
+static bool
+netlog_event_repeated(const struct netlog_event *event, const char *path)
+{
+	union {
+		struct netlog_flow flow;
+		char raw[AGGREGATE_KEY_SIZE];
+	} key;
+	size_t path_len;
+
+	if (likely(!aggregate_enabled()))
+		return false;
+
+	/* Too long to be aggregated */
+	path_len = strlen(path) + 1;
+	if (path_len > sizeof(key) - sizeof(key.flow))
+		return false;
+
+	/* Keys are compared as a whole, padding included */
+	memset(&key.flow, 0, sizeof(key.flow));
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 5, 0)
+	key.flow.uid = current_uid().val;
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 5, 0) */
+	key.flow.uid = current_uid();
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 5, 0) */
+	key.flow.protocol = event->protocol;
+	key.flow.action = event->action;
+	key.flow.family = event->family;
+	key.flow.dst_port = event->dst_port;
+	key.flow.dst = event->dst;
+	memcpy(key.flow.path, path, path_len);
+
+	return aggregate_event(&key, sizeof(key.flow) + path_len, event->nsec);
+}
+
+void
+aggregate_report(const struct aggregate_summary *summary)
+{
+	const struct netlog_flow *flow = (const struct netlog_flow *)summary->key;
+	const void *dst_ip = NULL;
+#ifdef USE_PRINK
+	char print_buffer[NETLOG_PRINT_SIZE];
+	static const u8 any_ip[16];
+#endif /* USE_PRINK */
+
+	if (flow->family == AF_INET || flow->family == AF_INET6)
+		dst_ip = flow->dst.raw;
+
+#ifdef USE_PRINK
+	if (print_netlog(print_buffer, NETLOG_PRINT_SIZE, flow->protocol,
+			 flow->family, flow->action, any_ip, 0,
+			 dst_ip, flow->dst_port) < 0)
+		pr_err("Impossible to print netlog data\n");
+	else
+		printk(KERN_DEBUG pr_fmt("Repeated %u times by uid %u: %s %s\n"),
+		       summary->count, flow->uid, flow->path, print_buffer);
+#else /* ! USE_PRINK */
+	store_netlog_repeated(summary->first, summary->last, summary->count,
+			      flow->uid, flow->path, flow->action, flow->protocol,
+			      flow->family, dst_ip, flow->dst_port);
+#endif /* ? USE_PRINK */
+}
+
+/**********************************/
+/*            logging             */
+/**********************************/
+
+/* Resolve the path of the executable, check the whitelist and log */
+static void
+netlog_event_log(const struct netlog_event *event)
+{
 	char buffer[MAX_EXEC_PATH + 1];
 	const char *path;
-	unsigned short family;
-	const void *dst_ip;
-	const void *src_ip;
-	int dst_port;
-	int src_port;
+	const void *dst_ip = netlog_event_dst(event);
+	unsigned int generation;
+	bool whitelisted;
 #ifdef USE_PRINK
 	char print_buffer[NETLOG_PRINT_SIZE];
+	char tty_buffer[TTY_NAME_LEN];
 	struct current_details details;
 #endif /* USE_PRINK */
 
-	path = path_from_mm(current->mm, buffer, MAX_EXEC_PATH);
+	path = path_cache_get_mm(current->mm, buffer, MAX_EXEC_PATH);
 	buffer[MAX_EXEC_PATH] = '\0';
-	if (unlikely(path == NULL))
+	if (unlikely(path == NULL)) {
 		path = default_exec_name;
-
-	/* Get everything */
-	family = sock->sk->sk_family;
-	dst_port = ntohs(inet_sk(sock->sk)->DPORT);
-	src_port = ntohs(inet_sk(sock->sk)->SPORT);
-	switch (family) {
-	case AF_INET:
-		dst_ip = &inet_sk(sock->sk)->DADDR;
-		src_ip = &inet_sk(sock->sk)->SADDR;
-		break;
-	case AF_INET6:
-#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 13, 0)
-		dst_ip = &sock->sk->sk_v6_daddr;
-#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 13, 0) */
-# ifdef RHEL_MAJOR
-#  if RHEL_MAJOR >= 7
-		dst_ip = &sock->sk->sk_v6_daddr;
-#  else /* RHEL_MAJOR < 7 */
-		dst_ip = &inet6_sk(sock->sk)->daddr;
-#  endif /* RHEL_MAJOR ? 7 */
-# else /* !RHEL_MAJOR */
-		dst_ip = &inet6_sk(sock->sk)->daddr;
-# endif /* ?RHEL_MAJOR */
-#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 13, 0) */
-		src_ip = &inet6_sk(sock->sk)->saddr;
-		break;
-	default:
-		dst_ip = NULL;
-		src_ip = NULL;
-		break;
+	} else if (!event->logged) {
+		generation = whitelist_generation();
+		whitelisted = is_whitelisted(&event->id, path, event->family,
+					     dst_ip, event->dst_port);
+		sock_cache_store(event, generation, whitelisted);
+		if (whitelisted)
+			return;
 	}
 
-	/* Are we whitelisted ? */
-	if (is_whitelisted(path, family, dst_ip, dst_port))
+	/* Only counted, until its window is closed */
+	if (netlog_event_repeated(event, path))
 		return;
 
 #ifdef USE_PRINK
 	fill_current_details(&details);
-	if (print_netlog(print_buffer, NETLOG_PRINT_SIZE, protocol,
-			 family, action, src_ip, src_port, dst_ip,
-			 dst_port) < 0)
+	if (print_netlog(print_buffer, NETLOG_PRINT_SIZE, event->protocol,
+			 event->family, event->action, netlog_event_src(event),
+			 event->src_port, dst_ip, event->dst_port) < 0)
 		pr_err("Impossible to print netlog data\n");
 	else
 		printk(KERN_DEBUG pr_fmt(CURRENT_DETAILS_FORMAT" %s %s\n"),
-		       CURRENT_DETAILS_ARGS(details), path, print_buffer);
+		       CURRENT_DETAILS_ARGS(details, current_tty_name(tty_buffer)),
+		       path, print_buffer);
 #else /* ! USE_PRINK */
-	store_netlog_record(path, action, protocol,
-			    family, src_ip, src_port, dst_ip, dst_port);
+	store_netlog_record_at(event->nsec, path, event->action, event->protocol,
+			       event->family, netlog_event_src(event),
+			       event->src_port, dst_ip, event->dst_port);
 #endif /* ? USE_PRINK */
 }
 
+/**********************************/
+/*        deferred logging        */
+/**********************************/
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0)
+/* Log from task_work instead of from the probes (default to false) */
+static bool deferred_logging;
+
+/* task_work_add was found when the module was loaded */
+static bool deferred_available;
+
+/* Event logged by its task before it returns to userspace */
+struct netlog_deferred {
+	struct callback_head work;
+	unsigned long busy  /** Bit 0 set from the probe until the work ran */;
+	union {
+		struct netlog_event event  /** Event to log */;
+		struct {
+			struct sock *sk    /** Socket, referenced */;
+			u64 nsec           /** Timestamp of the connection */;
+		} connect                  /** TCP connection waiting for its source port */;
+	};
+};
+
+/*
+ * Items are taken from the ring of the CPU running the probe, and given back
+ * by the task running the work, wherever it was migrated to. When all the
+ * items of a CPU are queued, events are logged from the probe.
+ */
+#define NETLOG_DEFERRED_SLOTS 128
+
+struct netlog_deferred_ring {
+	unsigned int next        /** Slot tried first by the next event */;
+	struct netlog_deferred slots[NETLOG_DEFERRED_SLOTS];
+};
+
+static DEFINE_PER_CPU(struct netlog_deferred_ring *, netlog_deferred_rings);
+
+struct netlog_deferred_stats {
+	unsigned long queued     /** Events logged from task_work */;
+	unsigned long full       /** Events logged from the probe, the ring being full */;
+};
+
+static DEFINE_PER_CPU(struct netlog_deferred_stats, netlog_deferred_stats);
+
+static void
+netlog_deferred_free(void)
+{
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		vfree(per_cpu(netlog_deferred_rings, cpu));
+		per_cpu(netlog_deferred_rings, cpu) = NULL;
+	}
+}
+
+static int
+netlog_deferred_alloc(void)
+{
+	struct netlog_deferred_ring *ring;
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		ring = vmalloc(sizeof(*ring));
+		if (ring == NULL) {
+			netlog_deferred_free();
+			return -ENOMEM;
+		}
+		memset(ring, 0, sizeof(*ring));
+		per_cpu(netlog_deferred_rings, cpu) = ring;
+	}
+	return 0;
+}
+
+/* Take a free item of the ring of this CPU, NULL if they are all queued */
+static struct netlog_deferred *
+netlog_deferred_get(void)
+{
+	struct netlog_deferred_ring *ring = this_cpu_read(netlog_deferred_rings);
+	unsigned int i, slot;
+
+	for (i = 0; i < NETLOG_DEFERRED_SLOTS; ++i) {
+		slot = (ring->next + i) % NETLOG_DEFERRED_SLOTS;
+		if (!test_and_set_bit(0, &ring->slots[slot].busy)) {
+			ring->next = slot + 1;
+			this_cpu_inc(netlog_deferred_stats.queued);
+			return &ring->slots[slot];
+		}
+	}
+	this_cpu_inc(netlog_deferred_stats.full);
+	return NULL;
+}
+
+static inline void
+netlog_deferred_put(struct netlog_deferred *item)
+{
+	clear_bit_unlock(0, &item->busy);
+}
+
+static void
+netlog_deferred_run(struct callback_head *work)
+{
+	struct netlog_deferred *item = container_of(work, struct netlog_deferred, work);
+
+	netlog_event_log(&item->event);
+	netlog_deferred_put(item);
+	deferred_done();
+}
+
+/* Defer the logging of 'event' to task_work, return false if not possible */
+static bool
+netlog_defer(const struct netlog_event *event)
+{
+	struct netlog_deferred *item;
+
+	if (!deferred_available || !READ_ONCE(deferred_logging))
+		return false;
+
+	item = netlog_deferred_get();
+	if (unlikely(item == NULL))
+		return false;
+	item->event = *event;
+	if (unlikely(deferred_queue(&item->work, netlog_deferred_run) < 0)) {
+		netlog_deferred_put(item);
+		return false;
+	}
+	return true;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+deferred_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+deferred_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	bool value;
+	int ret;
+
+	if (buf == NULL)
+		return -EBADF;
+
+	ret = strtobool(buf, &value);
+	if (ret == 0)
+		WRITE_ONCE(deferred_logging, value);
+	return ret;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+deferred_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+deferred_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return sprintf(buffer, "%c", READ_ONCE(deferred_logging) ? 'Y' : 'N');
+}
+
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 7, 0) */
+/* No task_work */
+static inline bool
+netlog_defer(const struct netlog_event *event)
+{
+	return false;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+deferred_param_set(const char *buf, struct kernel_param *kp)
+{
+	return -EINVAL;
+}
+
+int
+deferred_param_get(char *buffer, struct kernel_param *kp)
+{
+	return sprintf(buffer, "N");
+}
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+deferred_param_set(const char *buf, const struct kernel_param *kp)
+{
+	return -EINVAL;
+}
+
+static int
+deferred_param_get(char *buffer, const struct kernel_param *kp)
+{
+	return sprintf(buffer, "N");
+}
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 7, 0) */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+deferred_stats_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+deferred_stats_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return -EPERM;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+deferred_stats_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+deferred_stats_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	unsigned long queued = 0, full = 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0)
+	int cpu;
+
+	for_each_possible_cpu(cpu) {
+		struct netlog_deferred_stats *stats = per_cpu_ptr(&netlog_deferred_stats, cpu);
+
+		queued += READ_ONCE(stats->queued);
+		full += READ_ONCE(stats->full);
+	}
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0) */
+
+	return scnprintf(buffer, PAGE_SIZE, "queued:%lu full:%lu", queued, full);
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+const struct kernel_param_ops deferred_param = {
+	.set = deferred_param_set,
+	.get = deferred_param_get,
+};
+
+const struct kernel_param_ops deferred_stats_param = {
+	.set = deferred_stats_param_set,
+	.get = deferred_stats_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+/*
+ * Look task_work_add up and allocate the rings of deferred events, deferred
+ * logging stays unavailable on failure
+ */
+void
+deferred_logging_init(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0)
+	deferred_available = (deferred_init() == 0 &&
+			      netlog_deferred_alloc() == 0);
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0) */
+}
+
+/*
+ * Wait for the deferred events once the probes are unplanted, and free the
+ * rings. They are leaked if the wait is killed, works may still use them.
+ */
+void
+deferred_logging_wait(void)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0)
+	if (!deferred_available)
+		return;
+	if (deferred_wait() == 0)
+		netlog_deferred_free();
+	deferred_available = false;
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 7, 0) */
+}
+
+static void log_if_not_whitelisted(struct sock *sk, u8 protocol, u8 action)
+{
+	/* sk needs to be non null */
+
+	struct netlog_event event;
+	unsigned int generation;
+
+	netlog_event_capture(&event, sk, protocol, action);
+	if (prefilter_reject(sk, protocol, event.family,
+			     netlog_event_src(&event), event.src_port,
+			     netlog_event_dst(&event), event.dst_port))
+		return;
+
+	/* Decided for an earlier event of the socket ? */
+	generation = whitelist_generation();
+	switch (sock_cache_lookup(&event, generation)) {
+	case 1:
+		return;
+	case 0:
+		event.logged = true;
+		break;
+	default:
+		/* Are we whitelisted ? Try without resolving the path first */
+		if (is_whitelisted(&event.id, NULL, event.family,
+				   netlog_event_dst(&event), event.dst_port)) {
+			sock_cache_store(&event, generation, true);
+			return;
+		}
+		break;
+	}
+
+	if (netlog_defer(&event))
+		return;
+	netlog_event_log(&event);
+}
+
+
+/* Probes relying on the kprobe on inet_release */
+static inline unsigned long
+close_kprobe_probes(void)
+{
+	if (backend == BACKEND_TRACEPOINT)
+		return 1 << PROBE_UDP_CLOSE;
+	return (1 << PROBE_TCP_CLOSE) | (1 << PROBE_UDP_CLOSE);
+}
+
+/* Probes relying on the inet_sock_set_state tracepoint */
+static inline unsigned long
+tracepoint_probes(void)
+{
+	if (backend == BACKEND_TRACEPOINT)
+		return (1 << PROBE_TCP_CONNECT) | (1 << PROBE_TCP_CLOSE);
+	return 0;
+}
 
 /**********************************/
 /*           PROBES               */
@@ -183,7 +824,7 @@ static int post_inet_stream_connect(struct kretprobe_instance *ri, struct pt_reg
 	    likely(sock->sk->sk_family == AF_INET ||
 		   sock->sk->sk_family == AF_INET6) &&
 	    likely(sock->sk->sk_protocol == IPPROTO_TCP))
-		log_if_not_whitelisted(sock, PROTO_TCP, ACTION_CONNECT);
+		log_if_not_whitelisted(sock->sk, PROTO_TCP, ACTION_CONNECT);
 
 	return 0;
 }
@@ -199,104 +840,193 @@ static int post_inet_dgram_connect(struct kretprobe_instance *ri, struct pt_regs
 	    likely(sock->sk->sk_family == AF_INET ||
 		   sock->sk->sk_family == AF_INET6) &&
 	    likely(sock->sk->sk_protocol == IPPROTO_UDP))
-		log_if_not_whitelisted(sock, PROTO_UDP, ACTION_CONNECT);
+		log_if_not_whitelisted(sock->sk, PROTO_UDP, ACTION_CONNECT);
 
 	return 0;
 }
 
-/* post_sys_accept probe is called right after the accept system call returns.
- * In the return register is placed the socket file descriptor. So with the
- * user of regs_register_status we can get the socket file descriptor and log
- * the data that we want for the socket.
+/*
+ * inet_csk_accept returns the new TCP socket (IPv4 or IPv6) accepted by
+ * accept(), accept4() or the kernel, NULL on error.
  */
-
-static int post_sys_accept(struct kretprobe_instance *ri, struct pt_regs *regs)
+static int post_inet_csk_accept(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
-	struct socket *sock;
-	int err;
-
-	/* sys_accept/sys_accept4 always return an int */
-	sock = sockfd_lookup((int)regs_return_value(regs), &err);
-
-	if (likely(sock != NULL)) {
-		if (likely(sock->sk != NULL) &&
-		    likely(sock->sk->sk_family == AF_INET ||
-			   sock->sk->sk_family == AF_INET6) &&
-		    likely(sock->sk->sk_protocol == IPPROTO_TCP))
-			log_if_not_whitelisted(sock, PROTO_TCP, ACTION_ACCEPT);
-		sockfd_put(sock);
-	}
+	struct sock *sk = (struct sock *) regs_return_value(regs);
+
+	/* Kernel threads: no executable to log */
+	if (likely(current != NULL) &&
+	    likely(current->mm != NULL) &&
+	    likely(!(current->flags & PF_KTHREAD)) &&
+	    likely(sk != NULL) &&
+	    likely(sk->sk_family == AF_INET ||
+		   sk->sk_family == AF_INET6) &&
+	    likely(sk->sk_protocol == IPPROTO_TCP))
+		log_if_not_whitelisted(sk, PROTO_TCP, ACTION_ACCEPT);
+
 	return 0;
 }
 
 
-static int pre_sys_close(struct kprobe *p, struct pt_regs *regs)
+/*
+ * inet_release is called when the last reference to an inet socket (IPv4 or
+ * IPv6) is dropped, whichever way it happens: only inet sockets reach it,
+ * unlike close(), which is called for every kind of file.
+ */
+static int pre_inet_release(struct kprobe *p, struct pt_regs *regs)
 {
-	struct socket *sock;
-	int fd, err;
-
-	fd = (int) GET_ARG_1(regs);
-	sock = sockfd_lookup(fd, &err);
+	struct socket *sock = (struct socket *) GET_ARG_1(regs);
 
+	/* Kernel threads and exiting tasks: no executable to log */
 	if (unlikely(current == NULL) ||
+	    unlikely(current->mm == NULL) ||
 	    unlikely(sock == NULL) ||
 	    unlikely(sock->sk == NULL) ||
-	    likely(sock->sk->sk_family != AF_INET &&
-		   sock->sk->sk_family != AF_INET6))
-		goto out;
+	    unlikely(sock->sk->sk_family != AF_INET &&
+		     sock->sk->sk_family != AF_INET6))
+		return 0;
 
-	if ((loaded_probes & (1 << PROBE_TCP_CLOSE)) &&
+	if ((loaded_probes & close_kprobe_probes() & (1 << PROBE_TCP_CLOSE)) &&
 	    sock->sk->sk_protocol == IPPROTO_TCP &&
 	    likely(inet_sk(sock->sk)->DPORT != 0))
-		log_if_not_whitelisted(sock, PROTO_TCP, ACTION_CLOSE);
+		log_if_not_whitelisted(sock->sk, PROTO_TCP, ACTION_CLOSE);
 	else if ((loaded_probes & (1 << PROBE_UDP_CLOSE)) &&
 		 sock->sk->sk_protocol == IPPROTO_UDP &&
 		 inet_sk(sock->sk)->SPORT != 0)
-		log_if_not_whitelisted(sock, PROTO_UDP, ACTION_CLOSE);
+		log_if_not_whitelisted(sock->sk, PROTO_UDP, ACTION_CLOSE);
 
-out:
-	if (likely(sock != NULL))
-		sockfd_put(sock);
 	return 0;
 }
 
-static int pre_sys_bind(struct kretprobe_instance *ri, struct pt_regs *regs)
+/*
+ * inet_bind and inet6_bind only see inet sockets, of any protocol, and
+ * return 0 on success. Sockets of the kernel (tunnels, NFS...) are bound
+ * by kernel threads or from module code, with no executable to log.
+ */
+static int post_inet_bind(struct kretprobe_instance *ri, struct pt_regs *regs)
 {
-	int err;
 	struct probe_data *priv = (struct probe_data*)ri->data;
-	struct socket *sock;
+	struct socket *sock = priv->sock;
 
-	if (unlikely(current == NULL))
-		return 1;
+	if (likely(regs_return_value(regs) == 0) &&
+	    likely(current != NULL) &&
+	    likely(current->mm != NULL) &&
+	    likely(!(current->flags & PF_KTHREAD)) &&
+	    likely(sock != NULL) &&
+	    likely(sock->sk != NULL) &&
+	    likely(sock->sk->sk_family == AF_INET ||
+		   sock->sk->sk_family == AF_INET6) &&
+	    likely(sock->sk->sk_protocol == IPPROTO_UDP))
+		log_if_not_whitelisted(sock->sk, PROTO_UDP, ACTION_BIND);
+
+	return 0;
+}
 
-	sock = sockfd_lookup((int)GET_ARG_1(regs), &err);
+/* UDP protocol is connectionless protocol, so we probe bind */
 
-	if (likely(sock != NULL)) {
-		priv->sock = sock;
-		return 0;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+/*
+ * TCP connections entering SYN_SENT don't have a source port yet: it is
+ * allocated later in connect. They are logged by the task before it
+ * returns to userspace, where the port is known.
+ */
+static void
+netlog_connect_run(struct callback_head *work)
+{
+	struct netlog_deferred *item = container_of(work, struct netlog_deferred, work);
+	struct netlog_event event;
+	unsigned int generation = whitelist_generation();
+	bool rejected;
+
+	netlog_event_capture(&event, item->connect.sk, PROTO_TCP, ACTION_CONNECT);
+	event.nsec = item->connect.nsec;
+	rejected = prefilter_reject(item->connect.sk, PROTO_TCP, event.family,
+				    netlog_event_src(&event), event.src_port,
+				    netlog_event_dst(&event), event.dst_port);
+	sock_put(item->connect.sk);
+
+	if (rejected)
+		goto out;
+	if (is_whitelisted(&event.id, NULL, event.family,
+			   netlog_event_dst(&event), event.dst_port))
+		sock_cache_store(&event, generation, true);
+	else
+		netlog_event_log(&event);
+
+out:
+	netlog_deferred_put(item);
+	deferred_done();
+}
+
+static void
+netlog_connect_started(struct sock *sk)
+{
+	struct netlog_deferred *item;
+
+	if (likely(deferred_available)) {
+		item = netlog_deferred_get();
+		if (likely(item != NULL)) {
+			sock_hold(sk);
+			item->connect.sk = sk;
+			item->connect.nsec = local_clock();
+			if (likely(deferred_queue(&item->work, netlog_connect_run) == 0))
+				return;
+			sock_put(sk);
+			netlog_deferred_put(item);
+		}
 	}
+	/* Log it now, without source port */
+	log_if_not_whitelisted(sk, PROTO_TCP, ACTION_CONNECT);
+}
 
-	return 1;
+/*
+ * Only the transitions made by the task using the socket are logged, the
+ * others run in softirq, on behalf of any task:
+ *  - connect: CLOSE to SYN_SENT
+ *  - close: ESTABLISHED, CLOSE_WAIT, SYN_SENT or SYN_RECV to FIN_WAIT1,
+ *    LAST_ACK or CLOSE, once both directions are shut down. Only the first
+ *    of these changes is seen: shutdown(SHUT_RDWR) is logged as the close,
+ *    the close() following it is not logged again.
+ * Connections reset by the peer reach CLOSE in softirq, and a socket already
+ * closed does not change state when the task closes it: they are not logged.
+ */
+static inline bool
+netlog_tcp_closing(int oldstate, int newstate)
+{
+	if (oldstate == newstate)
+		return false;
+	if (oldstate != TCP_ESTABLISHED && oldstate != TCP_CLOSE_WAIT &&
+	    oldstate != TCP_SYN_SENT && oldstate != TCP_SYN_RECV)
+		return false;
+	return newstate == TCP_FIN_WAIT1 || newstate == TCP_LAST_ACK ||
+	       newstate == TCP_CLOSE;
 }
 
-static int post_sys_bind(struct kretprobe_instance *ri, struct pt_regs *regs)
+static void
+probe_inet_sock_set_state(void *data, const struct sock *const_sk,
+			  const int oldstate, const int newstate)
 {
-	struct probe_data *priv = (struct probe_data*)ri->data;
-	struct socket *sock = priv->sock;
+	struct sock *sk = (struct sock *) const_sk;
+
+	/* Kernel threads and exiting tasks: no executable to log */
+	if (sk->sk_protocol != IPPROTO_TCP ||
+	    (sk->sk_family != AF_INET && sk->sk_family != AF_INET6) ||
+	    !in_task() || current->mm == NULL ||
+	    (current->flags & PF_KTHREAD))
+		return;
 
-	if (likely(sock != NULL)) {
-		if (likely(sock->sk != NULL) &&
-		    likely(sock->sk->sk_family == AF_INET ||
-			   sock->sk->sk_family == AF_INET6) &&
-		    likely(sock->sk->sk_protocol == IPPROTO_UDP))
-			log_if_not_whitelisted(sock, PROTO_UDP, ACTION_BIND);
-		sockfd_put(sock);
+	if (oldstate == TCP_CLOSE && newstate == TCP_SYN_SENT) {
+		if (loaded_probes & (1 << PROBE_TCP_CONNECT))
+			netlog_connect_started(sk);
+		return;
 	}
 
-	return 0;
+	if ((loaded_probes & (1 << PROBE_TCP_CLOSE)) &&
+	    netlog_tcp_closing(oldstate, newstate) &&
+	    sk->sk_shutdown == SHUTDOWN_MASK &&
+	    inet_sk(sk)->DPORT != 0)
+		log_if_not_whitelisted(sk, PROTO_TCP, ACTION_CLOSE);
 }
-
-/* UDP protocol is connectionless protocol, so we probe the bind system call */
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0) */
 
 /*************************************/
 /*         probe definitions        */
@@ -325,61 +1055,117 @@ static struct kretprobe dgram_connect_kretprobe = {
 };
 
 static struct kretprobe accept_kretprobe = {
-	.handler = post_sys_accept,
+	.handler = post_inet_csk_accept,
 	.maxactive = 16 * NR_CPUS,
 	.kp = {
-		#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 32)
-		.symbol_name = "sys_accept",
-		#else
-		.symbol_name = "sys_accept4",
-		#endif
+		.symbol_name = "inet_csk_accept",
 		.fault_handler = handler_fault,
 	},
 };
 
 static struct kprobe close_kprobe = {
-	.pre_handler = pre_sys_close,
-	.symbol_name = "sys_close",
+	.pre_handler = pre_inet_release,
+	.symbol_name = "inet_release",
 	.fault_handler = handler_fault,
 };
 
 static struct kretprobe bind_kretprobe = {
-	.entry_handler = pre_sys_bind,
-	.handler = post_sys_bind,
+	.entry_handler = pre_handler_store_sock,
+	.handler = post_inet_bind,
+	.data_size = sizeof(struct probe_data),
+	.maxactive = 16 * NR_CPUS,
+	.kp = {
+		.symbol_name = "inet_bind",
+		.fault_handler = handler_fault,
+	},
+};
+
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+static struct kretprobe bind6_kretprobe = {
+	.entry_handler = pre_handler_store_sock,
+	.handler = post_inet_bind,
 	.data_size = sizeof(struct probe_data),
 	.maxactive = 16 * NR_CPUS,
 	.kp = {
-		.symbol_name = "sys_bind",
+		.symbol_name = "inet6_bind",
 		.fault_handler = handler_fault,
 	},
 };
 
+/* inet6_bind is missing while the ipv6 module is not loaded */
+static bool bind6_planted;
+#endif /* CONFIG_IPV6 || CONFIG_IPV6_MODULE */
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+static struct tracepoint_probe state_tracepoint = {
+	.name = "inet_sock_set_state",
+	.probe = probe_inet_sock_set_state,
+	.data = NULL,
+};
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0) */
+
 
 /****************************************/
 /*     Planting/unplanting probes       */
 /****************************************/
 
+/* The probes shared by several bits are planted once, for the first one */
+static int
+plant_close_kprobe(void)
+__must_hold(probe_lock)
+{
+	if (loaded_probes & close_kprobe_probes())
+		return 0;
+	return plant_kprobe(&close_kprobe);
+}
+
+static int
+plant_state_tracepoint(void)
+__must_hold(probe_lock)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+	if (loaded_probes & tracepoint_probes())
+		return 0;
+	return plant_tracepoint(&state_tracepoint);
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0) */
+	return -ENOENT;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(4, 16, 0) */
+}
+
 static void
 unplant_probes(unsigned long removed_probes)
 __must_hold(probe_lock)
 {
 	loaded_probes &= ~removed_probes;
 
-	if (removed_probes & (1 << PROBE_TCP_CONNECT))
+	if ((removed_probes & (1 << PROBE_TCP_CONNECT)) &&
+	    !(tracepoint_probes() & (1 << PROBE_TCP_CONNECT)))
 		unplant_kretprobe(&stream_connect_kretprobe);
 
 	if (removed_probes & (1 << PROBE_TCP_ACCEPT))
 		unplant_kretprobe(&accept_kretprobe);
 
-	if (removed_probes & ((1 << PROBE_TCP_CLOSE) | (1 << PROBE_UDP_CLOSE))) {
-		if (!(loaded_probes & ((1 << PROBE_TCP_CLOSE) | (1 << PROBE_UDP_CLOSE))))
-			unplant_kprobe(&close_kprobe);
-	}
+	if ((removed_probes & close_kprobe_probes()) &&
+	    !(loaded_probes & close_kprobe_probes()))
+		unplant_kprobe(&close_kprobe);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+	if ((removed_probes & tracepoint_probes()) &&
+	    !(loaded_probes & tracepoint_probes()))
+		unplant_tracepoint(&state_tracepoint);
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0) */
+
 	if (removed_probes & (1 << PROBE_UDP_CONNECT))
 		unplant_kretprobe(&dgram_connect_kretprobe);
 
-	if (removed_probes & (1 << PROBE_UDP_BIND))
+	if (removed_probes & (1 << PROBE_UDP_BIND)) {
 		unplant_kretprobe(&bind_kretprobe);
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+		if (bind6_planted)
+			unplant_kretprobe(&bind6_kretprobe);
+		bind6_planted = false;
+#endif /* CONFIG_IPV6 || CONFIG_IPV6_MODULE */
+	}
 }
 
 void unplant_all(void)
@@ -398,7 +1184,10 @@ __must_hold(&probe_lock)
 	int err = 0;
 
 	if (new_probes & (1 << PROBE_TCP_CONNECT)) {
-		err = plant_kretprobe(&stream_connect_kretprobe);
+		if (tracepoint_probes() & (1 << PROBE_TCP_CONNECT))
+			err = plant_state_tracepoint();
+		else
+			err = plant_kretprobe(&stream_connect_kretprobe);
 		if (err < 0)
 			return -CONNECT_PROBE_FAILED;
 		loaded_probes |= 1 << PROBE_TCP_CONNECT;
@@ -412,11 +1201,12 @@ __must_hold(&probe_lock)
 	}
 
 	if (new_probes & (1 << PROBE_TCP_CLOSE)) {
-		if (!(loaded_probes & (1 << PROBE_UDP_CLOSE))) {
-			err = plant_kprobe(&close_kprobe);
-			if (err < 0)
-				return -CLOSE_PROBE_FAILED;
-		}
+		if (tracepoint_probes() & (1 << PROBE_TCP_CLOSE))
+			err = plant_state_tracepoint();
+		else
+			err = plant_close_kprobe();
+		if (err < 0)
+			return -CLOSE_PROBE_FAILED;
 		loaded_probes |= 1 << PROBE_TCP_CLOSE;
 	}
 	if (new_probes & (1 << PROBE_UDP_CONNECT)) {
@@ -430,15 +1220,19 @@ __must_hold(&probe_lock)
 		err = plant_kretprobe(&bind_kretprobe);
 		if (err < 0)
 			return -BIND_PROBE_FAILED;
+#if defined(CONFIG_IPV6) || defined(CONFIG_IPV6_MODULE)
+		bind6_planted = (plant_kretprobe(&bind6_kretprobe) == 0);
+		if (!bind6_planted)
+			pr_err("[-] IPv6 UDP binds will not be logged\n");
+		err = 0;
+#endif /* CONFIG_IPV6 || CONFIG_IPV6_MODULE */
 		loaded_probes |= 1 << PROBE_UDP_BIND;
 	}
 
 	if (new_probes & (1 << PROBE_UDP_CLOSE)) {
-		if (!(loaded_probes & (1 << PROBE_TCP_CLOSE))) {
-			err = plant_kprobe(&close_kprobe);
-			if (err < 0)
-				return -CLOSE_PROBE_FAILED;
-		}
+		err = plant_close_kprobe();
+		if (err < 0)
+			return -CLOSE_PROBE_FAILED;
 		loaded_probes |= 1 << PROBE_UDP_CLOSE;
 	}
 
@@ -478,6 +1272,12 @@ probes_init(void)
 
 	down(&probe_lock);
 	if (!initialized) {
+		sock_cache_init();
+		pr_info("[+] Using the %s backend\n", backend_names[backend]);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+		if (backend == BACKEND_TRACEPOINT && !deferred_available)
+			pr_err("[-] Source ports of TCP connect will not be logged\n");
+#endif /* LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0) */
 		if (setter_called)
 			ret = plant_probes(pre_init_probes);
 		else
@@ -645,3 +1445,51 @@ const struct kernel_param_ops one_probe_param = {
 	.get = one_probe_param_get,
 };
 #endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+backend_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+backend_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	if (buf == NULL)
+		return -EINVAL;
+
+	if (sysfs_streq(buf, backend_names[BACKEND_KPROBE])) {
+		backend = BACKEND_KPROBE;
+		return 0;
+	}
+	if (sysfs_streq(buf, backend_names[BACKEND_TRACEPOINT])) {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(4, 16, 0)
+		backend = BACKEND_TRACEPOINT;
+		return 0;
+#else /* LINUX_VERSION_CODE < KERNEL_VERSION(4, 16, 0) */
+		pr_err("The tracepoint backend needs Linux 4.16 or later");
+		return -EINVAL;
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(4, 16, 0) */
+	}
+
+	pr_err("Invalid backend %s", buf);
+	return -EINVAL;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+backend_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+backend_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	return scnprintf(buffer, PAGE_SIZE, "%s", backend_names[backend]);
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+const struct kernel_param_ops backend_param = {
+	.set = backend_param_set,
+	.get = backend_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
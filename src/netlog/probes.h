@@ -22,12 +22,27 @@ int all_probes_param_set(const char *buf, struct kernel_param *kp);
 int all_probes_param_get(char *buffer, struct kernel_param *kp);
 int one_probe_param_set(const char *buf, struct kernel_param *kp);
 int one_probe_param_get(char *buffer, struct kernel_param *kp);
+int deferred_param_set(const char *buf, struct kernel_param *kp);
+int deferred_param_get(char *buffer, struct kernel_param *kp);
+int deferred_stats_param_set(const char *buf, struct kernel_param *kp);
+int deferred_stats_param_get(char *buffer, struct kernel_param *kp);
+int backend_param_set(const char *buf, struct kernel_param *kp);
+int backend_param_get(char *buffer, struct kernel_param *kp);
+int sock_cache_stats_param_set(const char *buf, struct kernel_param *kp);
+int sock_cache_stats_param_get(char *buffer, struct kernel_param *kp);
 #else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
 extern const struct kernel_param_ops all_probes_param;
 extern const struct kernel_param_ops one_probe_param;
+extern const struct kernel_param_ops deferred_param;
+extern const struct kernel_param_ops deferred_stats_param;
+extern const struct kernel_param_ops backend_param;
+extern const struct kernel_param_ops sock_cache_stats_param;
 #endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
 
 int probes_init(void);
 void unplant_all(void);
 
+void deferred_logging_init(void);
+void deferred_logging_wait(void);
+
 #endif /* __NETLOG_PROBES__ */
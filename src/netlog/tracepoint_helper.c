@@ -0,0 +1 @@
+../lib/tracepoint_helper.c
\ No newline at end of file
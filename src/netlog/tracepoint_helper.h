@@ -0,0 +1 @@
+../lib/tracepoint_helper.h
\ No newline at end of file
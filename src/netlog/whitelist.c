@@ -4,20 +4,25 @@
 #include <linux/version.h>
 #include <linux/inet.h>
 #include <linux/err.h>
+#include <linux/sort.h>
 #include <linux/spinlock.h>
 #include "whitelist.h"
 #include "netlog.h"
 #include "internal.h"
 #include "retro-compat.h"
 #include "sparse_compat.h"
+#include "exe_identity.h"
 
 #define IP_RAW_SIZE 16
 
 /* Whitelist */
 struct white_process {
 	struct white_process *next;
+	struct white_process *next_free /** Next rule to free after a grace period */;
+	unsigned long __percpu *hits    /** Number of events ignored thanks to this rule */;
 	int port;
 	unsigned short family;
+	unsigned int prefix_len /** Number of significant bits of the address */;
 	union {
 		struct in_addr ip4;
 		struct in6_addr ip6;
@@ -27,21 +32,79 @@ struct white_process {
 	char path[];
 };
 
-static struct white_process *whitelist = NULL;
+/*
+ * Compiled rules of an executable
+ *
+ * Each executable has a sorted set of ports (NO_PORT, i-e any port, first)
+ * and each port a binary trie per address family, containing the
+ * whitelisted prefixes. The cost of a lookup is thus independent of the
+ * number of rules.
+ */
+
+/* Node of the address tries, stored in a pool: index 0 means no node */
+struct white_node {
+	u32 child[2]                    /** Children for the next bit being 0 or 1 */;
+	const struct white_process *row /** Rule whose prefix ends here, NULL if none */;
+};
+
+struct white_port {
+	int port                           /** Port, NO_PORT for any port */;
+	const struct white_process *any_ip /** Rule whitelisting any address, NULL if none */;
+	u32 root4                          /** Root of the IPv4 trie */;
+	u32 root6                          /** Root of the IPv6 trie */;
+};
+
+struct white_match {
+	struct white_port *ports  /** Ports, sorted */;
+	unsigned int nr_ports     /** Number of ports */;
+	struct white_node *nodes  /** Pool of nodes of the tries */;
+	u32 nr_nodes;
+	u32 max_nodes;
+};
+
+/* Connection checked against the rules */
+struct white_query {
+	unsigned short family;
+	const void *ip;
+	int port;
+};
+
+#define WHITELIST_BLOB_TYPE WHITELIST_BLOB_NETLOG
 
 static struct white_process* whiterow_from_string(char *str);
-static int is_already_whitelisted(struct white_process *head, struct white_process *new_row);
-static char * whitelist_print(struct white_process *row, char * buf, size_t *avail);
+static struct white_process *whiterow_from_blob(const void *record, size_t size);
+static struct white_process *whiterow_find(struct white_process *head, const struct white_process *row);
+static const char *whiterow_path(const struct white_process *row, size_t *len);
+static char * whitelist_print(const struct white_process *row, char * buf, size_t *avail);
+static struct white_match *white_match_build(struct white_process *rows);
+static void white_match_free(struct white_match *match);
+static const struct white_process *white_match_check(const struct white_match *match, const void *data);
+static bool white_query_pending(const void *data);
 
 #include "whitelist_helper.c"
 
+/* Bit 'i' of an address, starting from the most significant one */
+#define WHITE_BIT(ip, i) ((((const u8 *)(ip))[(i) >> 3] >> (7 - ((i) & 7))) & 1)
+
+/* Clear the bits of an address after its prefix */
+static void
+white_mask_ip(u8 *raw, unsigned int prefix_len)
+{
+	unsigned int i;
+
+	for (i = prefix_len; i < IP_RAW_SIZE * 8; ++i)
+		raw[i >> 3] &= (u8)~(0x80 >> (i & 7));
+}
+
 static struct white_process*
 whiterow_from_string(char *str) __must_hold(whitelist_sanitylock)
 {
 	struct white_process *new_row = NULL;
+	const char *prefix;
 	char *pos;
 	size_t len;
-	ssize_t slen;
+	ssize_t slen, alen;
+	unsigned int max_prefix;
 	char temp;
 	int ret;
 
@@ -56,15 +119,18 @@ whiterow_from_string(char *str) __must_hold(whitelist_sanitylock)
 		return NULL;
 
 	/* Allocate new memory */
-	new_row = kmalloc(sizeof(struct white_process) + len + 1, GFP_ATOMIC);
+	new_row = kmalloc(sizeof(struct white_process) + len + 1, GFP_KERNEL);
 	if (unlikely(new_row == NULL))
 		return NULL;
 
 	/* Initialize */
 	new_row->next = NULL;
+	new_row->next_free = NULL;
+	new_row->hits = NULL;
 	new_row->port = NO_PORT;
 	memset(new_row->ip.raw, 0, IP_RAW_SIZE);
 	new_row->family = AF_UNSPEC;
+	new_row->prefix_len = 0;
 
 	/* Fill it with the path */
 	memcpy(new_row->path, str, len);
@@ -89,13 +155,31 @@ whiterow_from_string(char *str) __must_hold(whitelist_sanitylock)
 			goto fail;
 		switch (temp) {
 		case 'i':
+			/* Optional prefix length, CIDR style */
+			prefix = memchr(str, '/', slen);
+			alen = (prefix == NULL) ? slen : prefix - str;
 			/* Because on restrictions on the whole whitelist, slen can't overflow int */
-			if (in4_pton(str, (int)slen, new_row->ip.raw, -1, NULL) == 1)
+			if (in4_pton(str, (int)alen, new_row->ip.raw, -1, NULL) == 1) {
 				new_row->family = AF_INET;
-			else if (in6_pton(str, (int)slen, new_row->ip.raw, -1, NULL) == 1)
+				max_prefix = 32;
+			} else if (in6_pton(str, (int)alen, new_row->ip.raw, -1, NULL) == 1) {
 				new_row->family = AF_INET6;
-			else
+				max_prefix = 128;
+			} else {
 				goto fail;
+			}
+			new_row->prefix_len = max_prefix;
+			if (prefix != NULL) {
+				temp = *(str + slen);
+				*(str + slen) = '\0';
+				ret = kstrtouint(prefix + 1, 10, &new_row->prefix_len);
+				*(str + slen) = temp;
+				if (unlikely(ret))
+					goto fail;
+				if (unlikely(new_row->prefix_len > max_prefix))
+					goto fail;
+				white_mask_ip(new_row->ip.raw, new_row->prefix_len);
+			}
 			break;
 		case 'p':
 			temp = *(str + slen);
@@ -119,78 +203,318 @@ fail:
 	return NULL;
 }
 
-static int
-is_already_whitelisted(struct white_process *head, struct white_process *new_row) __must_hold(whitelist_sanitylock)
+static struct white_process *
+whiterow_from_blob(const void *record, size_t size) __must_hold(whitelist_sanitylock)
+{
+	const struct whitelist_blob_netlog *blob = record;
+	struct white_process *new_row;
+	unsigned short family;
+	unsigned int max_prefix;
+
+	if (unlikely(size < sizeof(*blob) || blob->path_len == 0 ||
+		     blob->path_len >= MAX_EXEC_PATH ||
+		     blob->path_len > size - sizeof(*blob)))
+		return NULL;
+
+	switch (blob->family) {
+	case 0:
+		family = AF_UNSPEC;
+		max_prefix = 0;
+		break;
+	case 4:
+		family = AF_INET;
+		max_prefix = 32;
+		break;
+	case 6:
+		family = AF_INET6;
+		max_prefix = 128;
+		break;
+	default:
+		return NULL;
+	}
+	if (unlikely(blob->prefix_len > max_prefix))
+		return NULL;
+
+	new_row = kmalloc(sizeof(struct white_process) + blob->path_len + 1, GFP_KERNEL);
+	if (unlikely(new_row == NULL))
+		return NULL;
+
+	new_row->next = NULL;
+	new_row->next_free = NULL;
+	new_row->hits = NULL;
+	new_row->port = (blob->port == 0) ? NO_PORT : blob->port;
+	new_row->family = family;
+	new_row->prefix_len = blob->prefix_len;
+	memcpy(new_row->ip.raw, blob->ip, IP_RAW_SIZE);
+	white_mask_ip(new_row->ip.raw, new_row->prefix_len);
+	memcpy(new_row->path, blob->path, blob->path_len);
+	new_row->path_len = blob->path_len;
+	new_row->path[new_row->path_len] = '\0';
+
+	return new_row;
+}
+
+static struct white_process *
+whiterow_find(struct white_process *head, const struct white_process *new_row) __must_hold(whitelist_sanitylock)
 {
 	struct white_process *row = head;
 
 	while (row != NULL) {
 		if (new_row->port == row->port &&
 		    new_row->family == row->family &&
+		    new_row->prefix_len == row->prefix_len &&
 		    new_row->path_len == row->path_len &&
 		    (memcmp(new_row->ip.raw, row->ip.raw, IP_RAW_SIZE) == 0) &&
 		    (memcmp(new_row->path, row->path, new_row->path_len) == 0))
-			return 1;
+			return row;
 		row = row->next;
 	}
+	return NULL;
+}
+
+static const char *
+whiterow_path(const struct white_process *row, size_t *len)
+{
+	*len = row->path_len;
+	return row->path;
+}
+
+/**********************************/
+/*          Compilation           */
+/**********************************/
+
+static int
+whiterow_cmp(const void *a, const void *b)
+{
+	const struct white_process *row_a = *(const struct white_process * const *)a;
+	const struct white_process *row_b = *(const struct white_process * const *)b;
+
+	if (row_a->port != row_b->port)
+		return (row_a->port < row_b->port) ? -1 : 1;
 	return 0;
 }
 
-int
-is_whitelisted(const char *path, unsigned short family, const void *ip, int port)
+/* Get a new node from the pool, 0 on allocation failure */
+static u32
+white_node_new(struct white_match *match) __must_hold(whitelist_sanitylock)
 {
-	size_t path_len;
-	unsigned long flags;
+	struct white_node *nodes;
+
+	if (match->nr_nodes == match->max_nodes) {
+		nodes = white_alloc(2 * match->max_nodes * sizeof(struct white_node));
+		if (unlikely(nodes == NULL))
+			return 0;
+		memcpy(nodes, match->nodes, match->nr_nodes * sizeof(struct white_node));
+		white_free(match->nodes);
+		match->nodes = nodes;
+		match->max_nodes *= 2;
+	}
+	memset(&match->nodes[match->nr_nodes], 0, sizeof(struct white_node));
+	return match->nr_nodes++;
+}
+
+static int
+white_trie_insert(struct white_match *match, u32 *root,
+		  const struct white_process *row)
+__must_hold(whitelist_sanitylock)
+{
+	const u8 *ip = row->ip.raw;
+	unsigned int i;
+	u32 node, next;
+
+	if (*root == 0) {
+		*root = white_node_new(match);
+		if (unlikely(*root == 0))
+			return -ENOMEM;
+	}
+
+	node = *root;
+	for (i = 0; i < row->prefix_len; ++i) {
+		/* A shorter prefix already covers this one */
+		if (match->nodes[node].row != NULL)
+			return 0;
+		next = match->nodes[node].child[WHITE_BIT(ip, i)];
+		if (next == 0) {
+			next = white_node_new(match);
+			if (unlikely(next == 0))
+				return -ENOMEM;
+			match->nodes[node].child[WHITE_BIT(ip, i)] = next;
+		}
+		node = next;
+	}
+	if (match->nodes[node].row == NULL)
+		match->nodes[node].row = row;
+	return 0;
+}
+
+static void
+white_match_free(struct white_match *match)
+{
+	white_free(match->ports);
+	white_free(match->nodes);
+	kfree(match);
+}
+
+/* Compile the rules of an executable */
+static struct white_match *
+white_match_build(struct white_process *rows) __must_hold(whitelist_sanitylock)
+{
+	struct white_process **sorted = NULL;
 	struct white_process *row;
+	struct white_match *match;
+	struct white_port *wport = NULL;
+	size_t nr_rows = 0;
+	size_t i;
+	int err = 0;
 
-	path_len = strnlen(path, MAX_EXEC_PATH);
+	for (row = rows; row != NULL; row = row->next)
+		++nr_rows;
 
-	/*Empty or paths greater than our limit are not whitelisted*/
-	if (unlikely(path_len == 0) ||
-	    unlikely(path_len == MAX_EXEC_PATH))
-		return NOT_WHITELISTED;
+	match = kzalloc(sizeof(struct white_match), GFP_KERNEL);
+	if (unlikely(match == NULL))
+		return ERR_PTR(-ENOMEM);
 
-	/*Check if the execution path and the ip and port are whitelisted*/
+	/* Sort the rules by port, to group them */
+	sorted = white_alloc(nr_rows * sizeof(struct white_process *));
+	match->ports = white_alloc(nr_rows * sizeof(struct white_port));
+	match->max_nodes = 16;
+	match->nodes = white_alloc(match->max_nodes * sizeof(struct white_node));
+	if (unlikely(sorted == NULL || match->ports == NULL || match->nodes == NULL))
+		goto nomem;
+	/* Node 0 is never used: it means 'no node' */
+	match->nr_nodes = 1;
 
-	read_lock_irqsave(&whitelist_rwlock, flags);
+	i = 0;
+	for (row = rows; row != NULL; row = row->next)
+		sorted[i++] = row;
+	sort(sorted, nr_rows, sizeof(struct white_process *), whiterow_cmp, NULL);
 
-	row = whitelist;
-	while (row != NULL) {
-		if ((row->port == NO_PORT || row->port == port) &&
-		    row->path_len == path_len && (memcmp(row->path, path, path_len) == 0)) {
-			if (row->family == AF_UNSPEC)
-				goto whitelisted;
-			if (row->family == family) {
-				switch (row->family) {
-				case AF_INET:
-					if (memcmp(&row->ip.ip4, ip, sizeof(struct in_addr)) == 0)
-						goto whitelisted;
-					break;
-				case AF_INET6:
-					if (memcmp(&row->ip.ip6, ip, sizeof(struct in6_addr)) == 0)
-						goto whitelisted;
-					break;
-				default:
-					break;
-				}
-			}
+	for (i = 0; i < nr_rows; ++i) {
+		row = sorted[i];
+		if (wport == NULL || wport->port != row->port) {
+			wport = &match->ports[match->nr_ports++];
+			wport->port = row->port;
+			wport->any_ip = NULL;
+			wport->root4 = 0;
+			wport->root6 = 0;
 		}
-		row = row->next;
+		switch (row->family) {
+		case AF_INET:
+			err = white_trie_insert(match, &wport->root4, row);
+			break;
+		case AF_INET6:
+			err = white_trie_insert(match, &wport->root6, row);
+			break;
+		default:
+			if (wport->any_ip == NULL)
+				wport->any_ip = row;
+			break;
+		}
+		if (unlikely(err))
+			goto nomem;
+	}
+
+	white_free(sorted);
+	return match;
+
+nomem:
+	white_free(sorted);
+	white_match_free(match);
+	return ERR_PTR(-ENOMEM);
+}
+
+/**********************************/
+/*            Lookup              */
+/**********************************/
+
+/* Rule of the first prefix containing 'ip', NULL if none */
+static inline const struct white_process *
+white_trie_match(const struct white_match *match, u32 node,
+		 const void *ip, unsigned int bits)
+__must_hold(RCU)
+{
+	unsigned int i = 0;
+
+	while (node != 0) {
+		if (match->nodes[node].row != NULL)
+			return match->nodes[node].row;
+		if (i == bits)
+			return NULL;
+		node = match->nodes[node].child[WHITE_BIT(ip, i)];
+		++i;
 	}
+	return NULL;
+}
 
-	read_unlock_irqrestore(&whitelist_rwlock, flags);
+static inline const struct white_process *
+white_port_match(const struct white_match *match, const struct white_port *wport,
+		 const struct white_query *query)
+__must_hold(RCU)
+{
+	if (wport->any_ip != NULL)
+		return wport->any_ip;
+	if (query->ip == NULL)
+		return NULL;
+	switch (query->family) {
+	case AF_INET:
+		return white_trie_match(match, wport->root4, query->ip, 32);
+	case AF_INET6:
+		return white_trie_match(match, wport->root6, query->ip, 128);
+	default:
+		return NULL;
+	}
+}
+
+static const struct white_process *
+white_match_check(const struct white_match *match, const void *data)
+__must_hold(RCU)
+{
+	const struct white_query *query = data;
+	const struct white_process *row;
+	unsigned int low = 0, high = match->nr_ports, middle;
 
-	return NOT_WHITELISTED;
+	/* Rules for any port are sorted first */
+	if (match->ports[0].port == NO_PORT) {
+		row = white_port_match(match, &match->ports[0], query);
+		if (row != NULL)
+			return row;
+	}
 
-whitelisted:
-	read_unlock_irqrestore(&whitelist_rwlock, flags);
+	while (low < high) {
+		middle = low + (high - low) / 2;
+		if (match->ports[middle].port < query->port)
+			low = middle + 1;
+		else
+			high = middle;
+	}
+	if (low < match->nr_ports && match->ports[low].port == query->port)
+		return white_port_match(match, &match->ports[low], query);
+	return NULL;
+}
+
+/* Connections are always checked at once */
+static bool
+white_query_pending(const void *data)
+{
+	return false;
+}
+
+int
+is_whitelisted(const struct exe_identity *id, const char *path,
+	       unsigned short family, const void *ip, int port)
+{
+	struct white_query query = {
+		.family = family,
+		.ip = ip,
+		.port = port,
+	};
 
-	return WHITELISTED;
+	/*Check if the executable and the ip and port are whitelisted*/
+	return whitelist_lookup(id, path, &query);
 }
 
 static char *
-whitelist_print(struct white_process *row, char * buf, size_t *avail)
-__must_hold(whitelist_rwlock)
+whitelist_print(const struct white_process *row, char * buf, size_t *avail)
 {
 	int ret;
 	size_t rem = *avail;
@@ -199,11 +523,17 @@ __must_hold(whitelist_rwlock)
 	VERIFY_SNPRINTF(buf, rem, ret);
 	switch (row->family) {
 	case AF_INET:
-		ret = scnprintf(buf, rem, "|i<%pI4>", &row->ip.ip4);
+		if (row->prefix_len == 32)
+			ret = scnprintf(buf, rem, "|i<%pI4>", &row->ip.ip4);
+		else
+			ret = scnprintf(buf, rem, "|i<%pI4/%u>", &row->ip.ip4, row->prefix_len);
 		VERIFY_SNPRINTF(buf, rem, ret);
 		break;
 	case AF_INET6:
-		ret = scnprintf(buf, rem, "|i<%pI6c>", &row->ip.ip6);
+		if (row->prefix_len == 128)
+			ret = scnprintf(buf, rem, "|i<%pI6c>", &row->ip.ip6);
+		else
+			ret = scnprintf(buf, rem, "|i<%pI6c/%u>", &row->ip.ip6, row->prefix_len);
 		VERIFY_SNPRINTF(buf, rem, ret);
 		break;
 	default:
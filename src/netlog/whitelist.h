@@ -4,6 +4,7 @@
 #include <linux/moduleparam.h>
 #include <linux/sched.h>
 #include <linux/version.h>
+#include "exe_identity.h"
 
 #define WHITELIST_FAIL -1
 
@@ -13,12 +14,28 @@
 #if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
 int whitelist_param_set(const char *buf, struct kernel_param *kp);
 int whitelist_param_get(char *buffer, struct kernel_param *kp);
+int whitelist_hits_param_set(const char *buf, struct kernel_param *kp);
+int whitelist_hits_param_get(char *buffer, struct kernel_param *kp);
+int whitelist_misses_param_set(const char *buf, struct kernel_param *kp);
+int whitelist_misses_param_get(char *buffer, struct kernel_param *kp);
 #else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
 extern const struct kernel_param_ops whitelist_param;
 #endif /* if LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
 
-int is_whitelisted(const char *path, unsigned short family, const void *ip, int port);
+/* 'path' can be NULL, in which case only the identity of the executable is checked */
+int is_whitelisted(const struct exe_identity *id, const char *path,
+		   unsigned short family, const void *ip, int port);
+
+/*
+ * Changes after every update of the whitelist: a decision taken while it
+ * had a given value is only valid as long as it keeps it.
+ */
+unsigned int whitelist_generation(void);
 
 void destroy_whitelist(void);
 
+/* /dev/<module>_whitelist, to update the whitelist rule by rule or load a binary one */
+int whitelist_device_register(void);
+void whitelist_device_unregister(void);
+
 #endif /* __NETLOG_WHITELIST__ */
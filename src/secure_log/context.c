@@ -0,0 +1,181 @@
+#include <linux/hash.h>
+#include <linux/kernel.h>
+#include <linux/rculist.h>
+#include <linux/rcupdate.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/string.h>
+#include <linux/version.h>
+#include "context.h"
+#include "sparse_compat.h"
+
+/*
+ * Process contexts, indexed by (tgid, exec generation).
+ *
+ * Writers look contexts up and allocate new ones under RCU, before taking
+ * the buffer lock: only references are taken and dropped, and contexts
+ * linked or unlinked, with the buffer lock held. Contexts are reference
+ * counted by the records of the buffer, references being dropped when
+ * records are evicted, which guarantees that every record in the buffer can
+ * be resolved. Once unreferenced, they are freed after a grace period.
+ *
+ * At most CONTEXT_MAX_LIVE contexts are shared, records of other processes
+ * store their own context.
+ */
+
+static struct hlist_head context_hash[1 << CONTEXT_HASH_BITS];
+
+/* Number of contexts in the hash table, protected by the buffer lock */
+static unsigned int context_count;
+
+static inline struct hlist_head *
+context_bucket(pid_t tgid, u64 exec_id)
+{
+	return &context_hash[hash_32((u32)tgid ^ (u32)exec_id, CONTEXT_HASH_BITS)];
+}
+
+static inline bool
+context_match(const struct proc_context *context, pid_t tgid, u64 exec_id,
+	      const struct process_details *details,
+	      const char *path, size_t path_len)
+{
+	return context->tgid == tgid &&
+	       context->exec_id == exec_id &&
+	       context->path_len == path_len &&
+	       memcmp(&context->details, details, sizeof(*details)) == 0 &&
+	       memcmp(context->path, path, path_len) == 0;
+}
+
+static void
+context_free_rcu(struct rcu_head *head)
+{
+	kfree(container_of(head, struct proc_context, rcu));
+}
+
+static void
+context_init(struct proc_context *context, pid_t tgid, u64 exec_id,
+	     const struct process_details *details,
+	     const char *path, size_t path_len)
+{
+	INIT_HLIST_NODE(&context->hlist);
+	context->refs = 1;
+	context->in_buffer = false;
+	context->tgid = tgid;
+	context->exec_id = exec_id;
+	context->details = *details;
+	context->path_len = path_len;
+	memcpy(context->path, path, path_len);
+	/* The path might have been truncated */
+	context->path[path_len - 1] = '\0';
+}
+
+struct proc_context *
+context_lookup(const struct process_details *details,
+	       const char *path, size_t path_len)
+{
+	struct proc_context *context;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+	pid_t tgid = current->tgid;
+	u64 exec_id = current->self_exec_id;
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	hlist_for_each_entry_rcu(context, tmp, context_bucket(tgid, exec_id), hlist) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+	hlist_for_each_entry_rcu(context, context_bucket(tgid, exec_id), hlist) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+		if (context_match(context, tgid, exec_id, details, path, path_len))
+			return context;
+	}
+	return NULL;
+}
+
+struct proc_context *
+context_alloc(const struct process_details *details,
+	      const char *path, size_t path_len)
+{
+	struct proc_context *context;
+
+	/* Checked again when linked */
+	if (READ_ONCE(context_count) >= CONTEXT_MAX_LIVE)
+		return NULL;
+
+	context = kmalloc(context_size(path_len), GFP_ATOMIC);
+	if (unlikely(context == NULL))
+		return NULL;
+	context_init(context, current->tgid, current->self_exec_id,
+		     details, path, path_len);
+	return context;
+}
+
+struct proc_context *
+context_get(struct proc_context *found, struct proc_context *fresh)
+{
+	/* Unreferenced since it was found: being freed */
+	if (found != NULL && found->refs != 0) {
+		++found->refs;
+		kfree(fresh);
+		return found;
+	}
+	if (fresh == NULL)
+		return NULL;
+	if (unlikely(context_count >= CONTEXT_MAX_LIVE)) {
+		kfree(fresh);
+		return NULL;
+	}
+	hlist_add_head_rcu(&fresh->hlist,
+			   context_bucket(fresh->tgid, fresh->exec_id));
+	WRITE_ONCE(context_count, context_count + 1);
+	return fresh;
+}
+
+struct proc_context *
+context_init_in_buffer(void *where, const struct process_details *details,
+		       const char *path, size_t path_len)
+{
+	struct proc_context *context = where;
+
+	context_init(context, current->tgid, current->self_exec_id,
+		     details, path, path_len);
+	context->in_buffer = true;
+	return context;
+}
+
+void
+context_put(struct proc_context *context)
+{
+	if (context->in_buffer)
+		return;
+	if (--context->refs != 0)
+		return;
+	hlist_del_rcu(&context->hlist);
+	WRITE_ONCE(context_count, context_count - 1);
+	call_rcu(&context->rcu, context_free_rcu);
+}
+
+void
+context_destroy_all(void)
+{
+	struct proc_context *context;
+	struct hlist_node *next;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+	struct hlist_node *tmp;
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0) */
+	unsigned int i;
+
+	/* context_free_rcu must not be called after the module is gone */
+	rcu_barrier();
+
+	for (i = 0; i < ARRAY_SIZE(context_hash); ++i) {
+#if LINUX_VERSION_CODE < KERNEL_VERSION(3, 9, 0)
+		hlist_for_each_entry_safe(context, tmp, next, &context_hash[i], hlist) {
+#else /* LINUX_VERSION_CODE >= KERNEL_VERSION(3, 9, 0) */
+		hlist_for_each_entry_safe(context, next, &context_hash[i], hlist) {
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(3, 9, 0) */
+			hlist_del(&context->hlist);
+			kfree(context);
+		}
+	}
+	context_count = 0;
+}
@@ -0,0 +1,93 @@
+#ifndef __SECURE_LOG_CONTEXT__
+#define __SECURE_LOG_CONTEXT__
+
+#include <linux/list.h>
+#include <linux/rcupdate.h>
+#include <linux/types.h>
+
+/* Number of buckets of the context hash table (power of 2) */
+#define CONTEXT_HASH_BITS 10
+
+/* Maximum number of contexts shared between records */
+#define CONTEXT_MAX_LIVE (1 << (CONTEXT_HASH_BITS + 2))
+
+/* Details of a process that are shared by all its events */
+struct process_details {
+	pid_t sid  /** SID of the process */;
+	pid_t ppid /** PID of the parent of the process */;
+	uid_t uid  /** UID of the process */;
+	uid_t euid /** EUID of the process */;
+	uid_t gid  /** GID of the process */;
+	uid_t egid /** EGID of the process */;
+	dev_t tty  /** Device number of the TTY used by the process, 0 if none */;
+};
+
+/**
+ * Process context: everything netlog records would otherwise repeat.
+ * A context is shared by all the records of a thread group during one
+ * execution generation, as long as the details and path do not change.
+ * It lives as long as records of the buffer reference it.
+ */
+struct proc_context {
+	struct hlist_node hlist        /** Entry in the context hash table */;
+	struct rcu_head rcu            /** Delayed free */;
+	unsigned int refs              /** Number of records of the buffer referencing this context */;
+	bool in_buffer                 /** Context stored inside its record (allocation failure) */;
+	pid_t tgid                     /** Thread group of the process */;
+	u64 exec_id                    /** Execution generation of the process */;
+	struct process_details details /** Details of the process */;
+	size_t path_len                /** Length of the path of the executable, including the tailing '\0' */;
+	char path[]                    /** Path of the executable */;
+};
+
+/* Size needed to store a context inside a record */
+static inline size_t
+context_size(size_t path_len)
+{
+	return sizeof(struct proc_context) + path_len;
+}
+
+/**
+ * Find the context matching 'current' and the given details and path,
+ * without taking a reference. Must be called under rcu_read_lock, which must
+ * be held until context_get.
+ */
+struct proc_context *
+context_lookup(const struct process_details *details,
+	       const char *path, size_t path_len);
+
+/**
+ * Allocate a context for 'current' and the given details and path, when
+ * none was found. Returns NULL if too many contexts are alive or if the
+ * allocation failed. Can be called from atomic context.
+ */
+struct proc_context *
+context_alloc(const struct process_details *details,
+	      const char *path, size_t path_len);
+
+/**
+ * Get a reference on the context 'found' by context_lookup, or link the
+ * 'fresh' one allocated by context_alloc (freed if not needed). Returns NULL
+ * if neither can be used. Must be called with the buffer lock held.
+ */
+struct proc_context *
+context_get(struct proc_context *found, struct proc_context *fresh);
+
+/**
+ * Initialize a context stored at 'where', of size context_size(path_len),
+ * for records that could not get a shared one.
+ */
+struct proc_context *
+context_init_in_buffer(void *where, const struct process_details *details,
+		       const char *path, size_t path_len);
+
+/**
+ * Release a reference, taken by context_get, when the record using it is
+ * dropped from the buffer. Must be called with the buffer lock held.
+ */
+void context_put(struct proc_context *context);
+
+/* Free all the remaining contexts, when the buffer is destroyed */
+void context_destroy_all(void);
+
+#endif /* __SECURE_LOG_CONTEXT__ */
@@ -3,10 +3,14 @@
 #include <linux/in.h>
 #include <linux/ipv6.h>
 #include <linux/module.h>
+#include <linux/rcupdate.h>
 #include <linux/version.h>
 #include "log.h"
+#include "context.h"
+#include "ratelimit.h"
 #include "sparse_compat.h"
 #include "current_details.h"
+#include "tty_names.h"
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Vincent Brillault <vincent.brillault@cern.ch>");
@@ -45,13 +49,14 @@ MODULE_PARM_DESC(send_eof, "Return a EOF at the current end of the buffer, only
 /* Log structures of records stored the buffer */
 struct sec_log {
 	size_t len /** Total size of the record, including the strings at the end and padding */;
-	struct current_details process /* Details of the process */;
+	u64 nsec   /** Timestamp of the record */;
+	pid_t pid  /** PID of the process responsible for the record */;
 	enum secure_log_type type /** Type of this record (for cast)*/;
 };
 
 struct netlog_log {
 	struct sec_log header    /** Mandatory header */;
-	size_t path_len          /** Length of the path of the executable responsible for the activity, including the tailing '\0'. The string is accessible via get_netlog_path */;
+	struct proc_context *context /** Context of the process responsible for the activity (details and path of the executable). Shared between records, see context.h */;
 	enum netlog_protocol protocol /** Network protocol used (currently supported: UDP & TCP */;
 	enum netlog_action action /** Type of call used (currently supported: bind, connect, accept, close */;
 	unsigned short family    /** Familly of the socket used (currently supported: AF_INET, AF_INET6 */;
@@ -71,10 +76,38 @@ struct netlog_log {
 
 struct execlog_log {
 	struct sec_log header /** Mandatory header */;
+	struct process_details process /** Details of the process */;
 	size_t path_len       /** Length of the path of the executable, including the tailing '\0'. The string is accessible via get_netlog_path */;
 	size_t argv_len       /** Length of the arguments given to the executable including the tailing '\0'. The string is accessible via get_netlog_argv. MUST be set after the 'path_len' */;
 };
 
+struct suppressed_log {
+	struct sec_log header /** Mandatory header */;
+	enum secure_log_type suppressed_type /** Type of the suppressed records */;
+	uid_t uid             /** UID of the process(es) whose records were suppressed */;
+	u32 count             /** Number of suppressed records */;
+};
+
+struct repeated_log {
+	struct sec_log header /** Mandatory header */;
+	enum secure_log_type repeated_type /** Type of the repeated record */;
+	uid_t uid             /** UID of the process(es) repeating the record */;
+	u32 count             /** Number of repetitions, the logged record excluded */;
+	u64 first_nsec        /** Timestamp of the first repetition */;
+	u64 last_nsec         /** Timestamp of the last repetition */;
+	enum netlog_protocol protocol /** Network protocol used, for netlog records */;
+	enum netlog_action action /** Type of call used, for netlog records */;
+	unsigned short family /** Familly of the socket used, for netlog records */;
+	int dst_port          /** Destination port (distant), for netlog records */;
+	union {
+		struct in_addr ip4;
+		struct in6_addr ip6;
+		u8 raw[16];
+	} dst                 /** Destination address (distant), for netlog records */;
+	size_t path_len       /** Length of the path of the executable, including the tailing '\0'. The string is accessible via get_repeated_path */;
+	size_t argv_len       /** Length of the arguments, for execlog records, including the tailing '\0'. The string is accessible via get_repeated_argv. MUST be set after the 'path_len' */;
+};
+
 /* The bigger structure is definitely the netlog_log one */
 #define LOG_ALIGN __alignof__(struct netlog_log)
 
@@ -116,24 +149,31 @@ static struct class *secure_class;
 
 /* Get the path of a log */
 static char *
-get_netlog_path(struct netlog_log *log)
+get_execlog_path(struct execlog_log *log)
 __must_hold(log_lock)
 {
-	return ((char *)log) + sizeof(struct netlog_log);
+	return ((char *)log) + sizeof(struct execlog_log);
 }
 
 static char *
-get_execlog_path(struct execlog_log *log)
+get_execlog_argv(struct execlog_log *log)
 __must_hold(log_lock)
 {
-	return ((char *)log) + sizeof(struct execlog_log);
+	return ((char *)log) + sizeof(struct execlog_log) + log->path_len;
 }
 
 static char *
-get_execlog_argv(struct execlog_log *log)
+get_repeated_path(struct repeated_log *log)
 __must_hold(log_lock)
 {
-	return ((char *)log) + sizeof(struct execlog_log) + log->path_len;
+	return ((char *)log) + sizeof(struct repeated_log);
+}
+
+static char *
+get_repeated_argv(struct repeated_log *log)
+__must_hold(log_lock)
+{
+	return ((char *)log) + sizeof(struct repeated_log) + log->path_len;
 }
 
 /* get record by index; idx must point to valid msg */
@@ -170,6 +210,15 @@ __must_hold(log_lock)
 	return (u32)(idx + msg->len);
 }
 
+/* Release what a record holds outside of the buffer, before dropping it */
+static inline void
+release_record(struct sec_log *record)
+__must_hold(log_lock)
+{
+	if (record->type == LOG_NETWORK_INTERACTION)
+		context_put(((struct netlog_log *)record)->context);
+}
+
 /* Small tool */
 static void
 copy_ip(void *dst, const void *src, unsigned short family)
@@ -202,6 +251,7 @@ __must_hold(log_lock)
 			break;
 
 		/* Drop old messages until we have enough contiuous space */
+		release_record(log_from_idx(log_first_idx));
 		log_first_idx = log_next(log_first_idx);
 		log_first_seq++;
 	}
@@ -219,17 +269,112 @@ __must_hold(log_lock)
 	}
 }
 
+/* Capture the details of 'current', outside of the buffer lock */
+static inline void
+capture_current_details(struct current_details *details,
+			struct process_details *process)
+{
+	fill_current_details(details);
+	tty_names_learn(details->tty);
+
+	process->sid = details->sid;
+	process->ppid = details->ppid;
+	process->uid = details->uid;
+	process->euid = details->euid;
+	process->gid = details->gid;
+	process->egid = details->egid;
+	process->tty = details->tty;
+}
+
+static inline void
+fill_header(struct sec_log *header, const struct current_details *details,
+	    enum secure_log_type type, size_t record_size)
+__must_hold(log_lock)
+{
+	header->nsec = details->nsec;
+	header->pid = details->pid;
+	header->type = type;
+	header->len = record_size;
+}
+
+static void
+store_suppressed_record(enum secure_log_type type,
+			const struct ratelimit_summary *summary)
+{
+	struct suppressed_log *record;
+	size_t record_size;
+	unsigned long flags;
+	u64 now = local_clock();
+
+	record_size = sizeof(struct suppressed_log);
+	/* Align record size to next block */
+	record_size += (-record_size) & (LOG_ALIGN - 1);
+
+	spin_lock_irqsave(&log_lock, flags);
+
+	find_new_record_place(record_size);
+	record = (struct suppressed_log *)(log_buf + log_next_idx);
+	/* Store basic information, the summary is not made by the process */
+	record->header.nsec = now;
+	record->header.pid = 0;
+	record->header.type = LOG_SUPPRESSED;
+	record->header.len = record_size;
+
+	/* Store advanced information */
+	record->suppressed_type = type;
+	record->uid = summary->uid;
+	record->count = summary->count;
+
+	/* Update the next position */
+	log_next_idx += record_size;
+	log_next_seq++;
+
+	spin_unlock_irqrestore(&log_lock, flags);
+
+	/* Wake-up reading threads */
+	wake_up_interruptible(&log_wait);
+}
 
 void
-store_netlog_record(const char *path, enum netlog_action action,
-		    enum netlog_protocol protocol, unsigned short family,
-		    const void *src_ip, int src_port,
-		    const void *dst_ip, int dst_port)
+ratelimit_report(enum secure_log_type type,
+		 const struct ratelimit_summary *summary)
+{
+	store_suppressed_record(type, summary);
+}
+
+/* Check the rate limiting, reporting any suppressed records */
+static inline bool
+ratelimit_record(enum secure_log_type type)
+{
+	struct ratelimit_summary summary;
+	bool allowed;
+
+	allowed = ratelimit_allow(type, get_current_uid(), &summary);
+	if (unlikely(summary.count != 0))
+		store_suppressed_record(type, &summary);
+	return allowed;
+}
+
+void
+store_netlog_record_at(u64 nsec, const char *path, enum netlog_action action,
+		       enum netlog_protocol protocol, unsigned short family,
+		       const void *src_ip, int src_port,
+		       const void *dst_ip, int dst_port)
 {
 	struct netlog_log *record;
+	struct proc_context *context, *fresh = NULL;
+	struct current_details details;
+	struct process_details process;
 	size_t path_len, record_size;
 	unsigned long flags;
 
+	if (!ratelimit_record(LOG_NETWORK_INTERACTION))
+		return;
+
+	capture_current_details(&details, &process);
+	/* The event may have been captured earlier, by a probe */
+	details.nsec = nsec;
+
 	path_len = strlen(path) + 1;
 	if (unlikely(path_len > (LOG_BUF_LEN >> 4) ||
 		     path_len > INT_MAX)) {
@@ -237,19 +382,32 @@ store_netlog_record(const char *path, enum netlog_action action,
 			 path_len, min((LOG_BUF_LEN >> 4), (unsigned int)INT_MAX));
 		path_len = min((LOG_BUF_LEN >> 4), (unsigned int)INT_MAX);
 	}
-	record_size = sizeof(struct netlog_log) + path_len;
-	/* Align record size to next block */
-        record_size += (-record_size) & (LOG_ALIGN - 1);
+
+	/* Path and details are only stored once per process context */
+	rcu_read_lock();
+	context = context_lookup(&process, path, path_len);
+	if (context == NULL)
+		fresh = context_alloc(&process, path, path_len);
 
 	spin_lock_irqsave(&log_lock, flags);
 
+	context = context_get(context, fresh);
+	rcu_read_unlock();
+
+	record_size = sizeof(struct netlog_log);
+	/* Without shared context, store it inside the record */
+	if (unlikely(context == NULL))
+		record_size += context_size(path_len);
+	/* Align record size to next block */
+	record_size += (-record_size) & (LOG_ALIGN - 1);
+
 	find_new_record_place(record_size);
 	record = (struct netlog_log *)(log_buf + log_next_idx);
 	/* Store basic information */
-	fill_current_details(&(record->header.process));
-	record->header.type = LOG_NETWORK_INTERACTION;
-	record->header.len = record_size;
-	record->path_len = path_len;
+	fill_header(&record->header, &details, LOG_NETWORK_INTERACTION, record_size);
+	if (unlikely(context == NULL))
+		context = context_init_in_buffer(record + 1, &process, path, path_len);
+	record->context = context;
 
 	/* Store advanced information */
 	record->action = action;
@@ -265,7 +423,6 @@ store_netlog_record(const char *path, enum netlog_action action,
 		copy_ip(record->dst.raw, dst_ip, family);
 	record->src_port = src_port;
 	record->dst_port = dst_port;
-	memcpy(get_netlog_path(record), path, path_len);
 
 	/* Update the next position */
 	log_next_idx += record_size;
@@ -276,17 +433,97 @@ store_netlog_record(const char *path, enum netlog_action action,
 	/* Wake-up reading threads */
 	wake_up_interruptible(&log_wait);
 }
+EXPORT_SYMBOL(store_netlog_record_at);
+
+void
+store_netlog_record(const char *path, enum netlog_action action,
+		    enum netlog_protocol protocol, unsigned short family,
+		    const void *src_ip, int src_port,
+		    const void *dst_ip, int dst_port)
+{
+	store_netlog_record_at(local_clock(), path, action, protocol, family,
+			       src_ip, src_port, dst_ip, dst_port);
+}
 EXPORT_SYMBOL(store_netlog_record);
 
+void
+store_netlog_repeated(u64 first, u64 last, u32 count, uid_t uid,
+		      const char *path, enum netlog_action action,
+		      enum netlog_protocol protocol, unsigned short family,
+		      const void *dst_ip, int dst_port)
+{
+	struct repeated_log *record;
+	size_t path_len, record_size;
+	unsigned long flags;
+	u64 now = local_clock();
+
+	path_len = strlen(path) + 1;
+	if (unlikely(path_len > (LOG_BUF_LEN >> 4) ||
+		     path_len > INT_MAX)) {
+		dev_warn(dev, "troncating path (size %zu > %i)\n",
+			 path_len, min((LOG_BUF_LEN >> 4), (unsigned int)INT_MAX));
+		path_len = min((LOG_BUF_LEN >> 4), (unsigned int)INT_MAX);
+	}
+	record_size = sizeof(struct repeated_log) + path_len;
+	/* Align record size to next block */
+	record_size += (-record_size) & (LOG_ALIGN - 1);
+
+	spin_lock_irqsave(&log_lock, flags);
+
+	find_new_record_place(record_size);
+	record = (struct repeated_log *)(log_buf + log_next_idx);
+	/* Store basic information, the summary is not made by the process */
+	record->header.nsec = now;
+	record->header.pid = 0;
+	record->header.type = LOG_REPEATED;
+	record->header.len = record_size;
+
+	/* Store advanced information */
+	record->repeated_type = LOG_NETWORK_INTERACTION;
+	record->uid = uid;
+	record->count = count;
+	record->first_nsec = first;
+	record->last_nsec = last;
+	record->action = action;
+	record->protocol = protocol;
+	record->family = family;
+	if (dst_ip == NULL)
+		memset(record->dst.raw, 0, 16);
+	else
+		copy_ip(record->dst.raw, dst_ip, family);
+	record->dst_port = dst_port;
+	record->path_len = path_len;
+	memcpy(get_repeated_path(record), path, path_len);
+	get_repeated_path(record)[path_len - 1] = '\0';
+	record->argv_len = 0;
+
+	/* Update the next position */
+	log_next_idx += record_size;
+	log_next_seq++;
+
+	spin_unlock_irqrestore(&log_lock, flags);
+
+	/* Wake-up reading threads */
+	wake_up_interruptible(&log_wait);
+}
+EXPORT_SYMBOL(store_netlog_repeated);
+
 
 void
 store_execlog_record(const char *path,
 		     const char *argv, size_t argv_size)
 {
 	struct execlog_log *record;
+	struct current_details details;
+	struct process_details process;
 	size_t path_len, record_size;
 	unsigned long flags;
 
+	if (!ratelimit_record(LOG_EXECUTION))
+		return;
+
+	capture_current_details(&details, &process);
+
 	path_len = strlen(path) + 1;
 	if (unlikely(path_len > (LOG_BUF_LEN >> 5) ||
 		     path_len > INT_MAX)) {
@@ -309,9 +546,8 @@ store_execlog_record(const char *path,
 	find_new_record_place(record_size);
 	record = (struct execlog_log *)(log_buf + log_next_idx);
 	/* Store basic information */
-	fill_current_details(&(record->header.process));
-	record->header.type = LOG_EXECUTION;
-	record->header.len = record_size;
+	fill_header(&record->header, &details, LOG_EXECUTION, record_size);
+	record->process = process;
 
 	/* Store advanced information */
 	record->path_len = path_len;
@@ -330,6 +566,65 @@ store_execlog_record(const char *path,
 }
 EXPORT_SYMBOL(store_execlog_record);
 
+void
+store_execlog_repeated(u64 first, u64 last, u32 count, uid_t uid,
+		       const char *path, const char *argv, size_t argv_size)
+{
+	struct repeated_log *record;
+	size_t path_len, record_size;
+	unsigned long flags;
+	u64 now = local_clock();
+
+	path_len = strlen(path) + 1;
+	if (unlikely(path_len > (LOG_BUF_LEN >> 5) ||
+		     path_len > INT_MAX)) {
+		dev_warn(dev, "Troncating path (size %zu > %i)\n",
+			 path_len, min((LOG_BUF_LEN >> 5), (unsigned int)INT_MAX));
+		path_len = min((LOG_BUF_LEN >> 5), (unsigned int)INT_MAX);
+	}
+	if (unlikely(argv_size > (LOG_BUF_LEN >> 5) ||
+		     argv_size > INT_MAX)) {
+		dev_warn(dev, "Troncating argv (size %zu > %i)\n",
+			 argv_size, min((LOG_BUF_LEN >> 5), (unsigned int)INT_MAX));
+		argv_size = min((LOG_BUF_LEN >> 5), (unsigned int)INT_MAX);
+	}
+	record_size = sizeof(struct repeated_log) + path_len + argv_size;
+	/* Align record size to next block */
+	record_size += (-record_size) & (LOG_ALIGN - 1);
+
+	spin_lock_irqsave(&log_lock, flags);
+
+	find_new_record_place(record_size);
+	record = (struct repeated_log *)(log_buf + log_next_idx);
+	/* Store basic information, the summary is not made by the process */
+	record->header.nsec = now;
+	record->header.pid = 0;
+	record->header.type = LOG_REPEATED;
+	record->header.len = record_size;
+
+	/* Store advanced information */
+	record->repeated_type = LOG_EXECUTION;
+	record->uid = uid;
+	record->count = count;
+	record->first_nsec = first;
+	record->last_nsec = last;
+	record->path_len = path_len;
+	memcpy(get_repeated_path(record), path, path_len);
+	get_repeated_path(record)[path_len - 1] = '\0';
+	record->argv_len = argv_size;
+	memcpy(get_repeated_argv(record), argv, argv_size);
+
+	/* Update the next position */
+	log_next_idx += record_size;
+	log_next_seq++;
+
+	spin_unlock_irqrestore(&log_lock, flags);
+
+	/* Wake-up reading threads */
+	wake_up_interruptible(&log_wait);
+}
+EXPORT_SYMBOL(store_execlog_repeated);
+
 
 struct user_data {
 	u64 log_curr_seq;
@@ -403,7 +698,7 @@ __must_hold(log_lock)
 	}
 
 	change = snprintf(data + len, remaining, "%.*s ",
-			  (int)record->path_len, get_netlog_path(record));
+			  (int)record->context->path_len, record->context->path);
 	UPDATE_POINTERS(change, remaining, len);
 
 	change = print_netlog(data + len, remaining,
@@ -437,9 +732,79 @@ __must_hold(log_lock)
 	return len;
 }
 
+static size_t
+suppressed_print(struct suppressed_log *record, char *data, size_t len)
+__must_hold(log_lock)
+{
+	size_t remaining = USER_BUFFER_SIZE - len;
+	long change;
+
+	change = snprintf(data + len, remaining, "Suppressed %u records from uid %u",
+			  record->count, record->uid);
+	UPDATE_POINTERS(change, remaining, len);
+	return len;
+}
+
+static size_t
+repeated_print(struct repeated_log *record, char *data, size_t len)
+__must_hold(log_lock)
+{
+	size_t remaining = USER_BUFFER_SIZE - len;
+	long change;
+	u64 first = record->first_nsec;
+	u64 last = record->last_nsec;
+	unsigned long first_rem, last_rem;
+	static const u8 any_ip[16];
+
+	if (WARN_ON(record->header.len < sizeof(struct repeated_log))) {
+		change = snprintf(data + len, remaining, "BROKEN RECCORD");
+		UPDATE_POINTERS(change, remaining, len);
+		return len;
+	}
+
+	/* Same format as the timestamps of the headers */
+	first_rem = do_div(first, 1000000000);
+	last_rem = do_div(last, 1000000000);
+	change = snprintf(data + len, remaining,
+			  "Repeated %u times by uid %u between %lu.%06lu and %lu.%06lu: %.*s",
+			  record->count, record->uid,
+			  (unsigned long)first, first_rem / 1000,
+			  (unsigned long)last, last_rem / 1000,
+			  (int) record->path_len, get_repeated_path(record));
+	UPDATE_POINTERS(change, remaining, len);
+
+	if (record->repeated_type == LOG_EXECUTION) {
+		change = snprintf(data + len, remaining, " %.*s",
+				  (int) record->argv_len, get_repeated_argv(record));
+		UPDATE_POINTERS(change, remaining, len);
+		return len;
+	}
+	if (record->repeated_type != LOG_NETWORK_INTERACTION)
+		return len;
+
+	/* The source port changes with every connection, the address is not kept */
+	change = snprintf(data + len, remaining, " ");
+	UPDATE_POINTERS(change, remaining, len);
+	change = print_netlog(data + len, remaining,
+			      record->protocol, record->family, record->action,
+			      any_ip, 0, &record->dst, record->dst_port);
+	if (change < 0)
+		return 0;
+	UPDATE_POINTERS(change, remaining, len);
+	return len;
+}
+
 static inline char *
-get_module_name(enum secure_log_type type)
+get_module_name(struct sec_log *record)
 {
+	enum secure_log_type type = record->type;
+
+	/* Summaries are reported as coming from the suppressed module */
+	if (type == LOG_SUPPRESSED)
+		type = ((struct suppressed_log *)record)->suppressed_type;
+	else if (type == LOG_REPEATED)
+		type = ((struct repeated_log *)record)->repeated_type;
+
 	switch (type) {
 	case LOG_NETWORK_INTERACTION:
 		return "netlog";
@@ -450,14 +815,37 @@ get_module_name(enum secure_log_type type)
 	}
 }
 
+/* Get the details of the process responsible for a record */
+static inline const struct process_details *
+get_record_details(struct sec_log *record)
+__must_hold(log_lock)
+{
+	switch (record->type) {
+	case LOG_NETWORK_INTERACTION:
+		return &((struct netlog_log *)record)->context->details;
+	case LOG_EXECUTION:
+		return &((struct execlog_log *)record)->process;
+	default:
+		return NULL;
+	}
+}
+
 static inline size_t
 secure_log_read_fill_record(char *buf, size_t len, struct sec_log *record)
 __must_hold(log_lock)
 {
+	const struct process_details *process;
+	char tty_buffer[TTY_NAME_LEN];
+
 	/* Fill the common header 'len' here is only set to the headers, it
 	 * can't overflow here*/
-	len += SPRINTF(buf + len, CURRENT_DETAILS_FORMAT " ",
-		       CURRENT_DETAILS_ARGS(record->process));
+	process = get_record_details(record);
+	if (likely(process != NULL))
+		len += SPRINTF(buf + len, CURRENT_DETAILS_FORMAT " ", record->pid,
+			       process->sid, process->ppid,
+			       process->uid, process->gid,
+			       process->euid, process->egid,
+			       tty_names_get(process->tty, tty_buffer));
 
 	/* Print the content */
 	switch (record->type) {
@@ -467,6 +855,12 @@ __must_hold(log_lock)
 	case LOG_EXECUTION:
 		len = execlog_print((struct execlog_log *)record, buf, len);
 		break;
+	case LOG_SUPPRESSED:
+		len = suppressed_print((struct suppressed_log *)record, buf, len);
+		break;
+	case LOG_REPEATED:
+		len = repeated_print((struct repeated_log *)record, buf, len);
+		break;
 	default:
 		/* We can't overflow here as only static headers have been
 		 * written up to here */
@@ -540,18 +934,18 @@ secure_log_read(struct file *file, char __user *buf, size_t count,
 	/* Get the current record */
 	record = log_from_idx(data->log_curr_idx);
 
-	ts = record->process.nsec;
+	ts = record->nsec;
 	rem_nsec = do_div(ts, 1000000000);
 	if (data->simple_format == 0) {
 		/* Fill the syslog header */
 		len = SPRINTF(data->buf, "<%u>1 - - %s - - - [%5lu.%06lu]: ",
 			      (LOG_FACILITY << 3) | LOG_LEVEL,
-			      get_module_name(record->type),
+			      get_module_name(record),
 			      (unsigned long)ts, rem_nsec / 1000);
 	} else {
 		/* Use a simpler header */
 		len = SPRINTF(data->buf, "%s [%lu.%06lu]: ",
-			      get_module_name(record->type),
+			      get_module_name(record),
 			      (unsigned long)ts, rem_nsec / 1000);
 	}
 
@@ -717,6 +1111,8 @@ clean_chrdev_region:
 	unregister_chrdev_region(secure_dev, 1);
 clean_class:
 	class_destroy(secure_class);
+	/* The rate limit can be set before the module is initialized */
+	ratelimit_destroy();
 	return err;
 }
 
@@ -730,6 +1126,8 @@ destroy_secure_dev(void)
 	cdev_del(&secure_c_dev);
 	unregister_chrdev_region(secure_dev, 1);
 	class_destroy(secure_class);
+	ratelimit_destroy();
+	context_destroy_all();
 	return;
 }
 
@@ -9,6 +9,8 @@
 enum secure_log_type {
 	LOG_NETWORK_INTERACTION  /** High level network interaction log */ = 0,
 	LOG_EXECUTION			/** Execve (file execution) with arguments log */,
+	LOG_SUPPRESSED			/** Summary of records suppressed by the rate limiting */,
+	LOG_REPEATED			/** Summary of the repetitions of a record, aggregated by its module */,
 };
 
 
@@ -31,11 +33,37 @@ store_netlog_record(const char *path, enum netlog_action action,
 		    enum netlog_protocol protocol, unsigned short family,
 		    const void *src_ip, int src_port,
 		    const void *dst_ip, int dst_port);
+
+/* Same as store_netlog_record, for an event that happened at 'nsec' (local_clock) */
+void
+store_netlog_record_at(u64 nsec, const char *path, enum netlog_action action,
+		       enum netlog_protocol protocol, unsigned short family,
+		       const void *src_ip, int src_port,
+		       const void *dst_ip, int dst_port);
+
+/*
+ * Report 'count' repetitions of a netlog record by 'uid', between 'first'
+ * and 'last' (local_clock). Can be called from any context.
+ */
+void
+store_netlog_repeated(u64 first, u64 last, u32 count, uid_t uid,
+		      const char *path, enum netlog_action action,
+		      enum netlog_protocol protocol, unsigned short family,
+		      const void *dst_ip, int dst_port);
 #endif /* ?MODULE_NETLOG */
 
 #if defined(MODULE_EXECLOG) || defined(MODULE_SECURE_LOG)
 void
 store_execlog_record(const char *path, const char *argv, size_t argv_size);
+
+/*
+ * Report 'count' repetitions of an execlog record by 'uid', between 'first'
+ * and 'last' (local_clock). 'argv' can be the start of the arguments only.
+ * Can be called from any context.
+ */
+void
+store_execlog_repeated(u64 first, u64 last, u32 count, uid_t uid,
+		       const char *path, const char *argv, size_t argv_size);
 #endif /* ?MODULE_EXECLOG */
 
 #endif /* __SECURE_LOG__ */
@@ -0,0 +1,280 @@
+#define pr_fmt(fmt) MODULE_NAME ": " fmt
+
+#include <linux/hash.h>
+#include <linux/kernel.h>
+#include <linux/module.h>
+#include <linux/moduleparam.h>
+#include <linux/percpu.h>
+#include <linux/sched.h>
+#include <linux/spinlock.h>
+#include <linux/version.h>
+#include <linux/workqueue.h>
+#include "ratelimit.h"
+#include "sparse_compat.h"
+
+/*
+ * Per-uid token buckets, checked before any reservation in the ring buffer.
+ *
+ * Each CPU owns its own set of buckets, indexed by the type of the record and
+ * a hash of the uid, protected by a lock only contended by the worker: a uid
+ * can thus log up to 'ratelimit' records per second on each CPU. A bucket is
+ * taken over by the last uid hashed into it, which inherits its tat: uids
+ * sharing a bucket share its budget, alternating between them does not reset
+ * it.
+ *
+ * The worker reports, every second, the records suppressed since the last
+ * report, even if the uid never logs again.
+ *
+ * The token bucket is stored in its 'virtual scheduling' form: instead of a
+ * number of tokens, we store the theoretical arrival time (tat) of the next
+ * event. An event is allowed if it does not push the tat further than 'burst'
+ * intervals in the future. This avoids any division in the fast path.
+ */
+
+/* Types of records that can be rate limited */
+#define RATELIMIT_TYPES (LOG_EXECUTION + 1)
+
+struct ratelimit_bucket {
+	u64 tat        /** Theoretical arrival time of the next event */;
+	uid_t uid      /** UID currently owning this bucket */;
+	u32 suppressed /** Number of events suppressed since the last allowed one */;
+};
+
+struct ratelimit_table {
+	spinlock_t lock;
+	struct ratelimit_bucket buckets[RATELIMIT_TYPES][RATELIMIT_SLOTS];
+};
+
+static DEFINE_PER_CPU(struct ratelimit_table, ratelimit_tables);
+
+/* Configuration: events per second (0 disables rate limiting) and burst */
+static unsigned int ratelimit_rate;
+static unsigned int ratelimit_burst = RATELIMIT_DEFAULT_BURST;
+
+/* Derived values, in ns, used by the fast path */
+static u64 ratelimit_interval;
+static u64 ratelimit_tolerance;
+
+/* Only one update of the configuration at a time */
+static DEFINE_SPINLOCK(ratelimit_lock);
+
+/* The locks of the tables are initialized when first enabled */
+static bool ratelimit_initialized;
+
+static void ratelimit_work_fn(struct work_struct *work);
+static DECLARE_DELAYED_WORK(ratelimit_work, ratelimit_work_fn);
+
+bool
+ratelimit_allow(enum secure_log_type type, uid_t uid,
+		struct ratelimit_summary *summary)
+{
+	struct ratelimit_table *table;
+	struct ratelimit_bucket *bucket;
+	unsigned long flags;
+	u64 interval, tolerance, now, tat;
+	bool allowed;
+
+	summary->count = 0;
+
+	interval = READ_ONCE(ratelimit_interval);
+	if (likely(interval == 0) || unlikely(type >= RATELIMIT_TYPES))
+		return true;
+	/* Pairs with ratelimit_update: the locks are initialized */
+	smp_rmb();
+	tolerance = READ_ONCE(ratelimit_tolerance);
+
+	local_irq_save(flags);
+	table = this_cpu_ptr(&ratelimit_tables);
+	spin_lock(&table->lock);
+	bucket = &table->buckets[type][hash_32(uid, RATELIMIT_BITS)];
+
+	if (unlikely(bucket->uid != uid)) {
+		/* Take over the bucket, reporting what its previous owner lost */
+		if (bucket->suppressed != 0) {
+			summary->uid = bucket->uid;
+			summary->count = bucket->suppressed;
+		}
+		bucket->uid = uid;
+		bucket->suppressed = 0;
+	}
+
+	now = local_clock();
+	tat = max(bucket->tat, now) + interval;
+	if (tat - now <= tolerance) {
+		bucket->tat = tat;
+		allowed = true;
+		/* The bucket recovered: report what was suppressed */
+		if (unlikely(bucket->suppressed != 0)) {
+			summary->uid = uid;
+			summary->count = bucket->suppressed;
+			bucket->suppressed = 0;
+		}
+	} else {
+		if (likely(bucket->suppressed != U32_MAX))
+			++bucket->suppressed;
+		allowed = false;
+	}
+
+	spin_unlock(&table->lock);
+	local_irq_restore(flags);
+	return allowed;
+}
+
+/*
+ * Report the records suppressed on every CPU since the last report. The
+ * buckets of a type are only read with interrupts disabled, the records are
+ * stored once the lock is released.
+ */
+static void
+ratelimit_flush(void)
+{
+	struct ratelimit_table *table;
+	struct ratelimit_bucket *bucket;
+	struct ratelimit_summary summaries[RATELIMIT_SLOTS];
+	unsigned long flags;
+	int cpu, type, slot, nr;
+
+	for_each_possible_cpu(cpu) {
+		table = per_cpu_ptr(&ratelimit_tables, cpu);
+		for (type = 0; type < RATELIMIT_TYPES; ++type) {
+			nr = 0;
+			spin_lock_irqsave(&table->lock, flags);
+			for (slot = 0; slot < RATELIMIT_SLOTS; ++slot) {
+				bucket = &table->buckets[type][slot];
+				if (bucket->suppressed == 0)
+					continue;
+				summaries[nr].uid = bucket->uid;
+				summaries[nr].count = bucket->suppressed;
+				bucket->suppressed = 0;
+				++nr;
+			}
+			spin_unlock_irqrestore(&table->lock, flags);
+
+			for (slot = 0; slot < nr; ++slot)
+				ratelimit_report(type, &summaries[slot]);
+		}
+		cond_resched();
+	}
+}
+
+static void
+ratelimit_work_fn(struct work_struct *work)
+{
+	/* Once disabled, report everything left */
+	ratelimit_flush();
+	if (READ_ONCE(ratelimit_interval) != 0)
+		schedule_delayed_work(&ratelimit_work, HZ);
+}
+
+void
+ratelimit_destroy(void)
+{
+	unsigned long flags;
+
+	spin_lock_irqsave(&ratelimit_lock, flags);
+	WRITE_ONCE(ratelimit_interval, 0);
+	spin_unlock_irqrestore(&ratelimit_lock, flags);
+
+	cancel_delayed_work_sync(&ratelimit_work);
+}
+
+static void
+ratelimit_update(void)
+__must_hold(ratelimit_lock)
+{
+	u64 interval = 0;
+	int cpu;
+
+	if (ratelimit_rate != 0)
+		interval = div_u64(NSEC_PER_SEC, ratelimit_rate);
+	if (interval == 0)
+		pr_info("[+] Rate limiting disabled\n");
+	else
+		pr_info("[+] Rate limiting to %u events/s per uid, burst %u\n",
+			ratelimit_rate, ratelimit_burst);
+
+	if (!ratelimit_initialized) {
+		for_each_possible_cpu(cpu)
+			spin_lock_init(&per_cpu_ptr(&ratelimit_tables, cpu)->lock);
+		ratelimit_initialized = true;
+		/* Pairs with ratelimit_allow */
+		smp_wmb();
+	}
+
+	WRITE_ONCE(ratelimit_tolerance, interval * ratelimit_burst);
+	WRITE_ONCE(ratelimit_interval, interval);
+
+	/* Also run once disabled, to report the pending suppressed records */
+	schedule_delayed_work(&ratelimit_work, HZ);
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+ratelimit_param_set(const char *buf, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+ratelimit_param_set(const char *buf, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	unsigned int *target;
+	unsigned int value;
+	unsigned long flags;
+	int ret;
+
+	target = (unsigned int *)kp->arg;
+	if (unlikely(target == NULL))
+		return -EBADF;
+
+	ret = kstrtouint(buf, 0, &value);
+	if (ret < 0)
+		return ret;
+
+	if (target == &ratelimit_burst && value == 0) {
+		pr_err("Invalid ratelimit_burst %u: min is 1\n", value);
+		return -EINVAL;
+	}
+
+	spin_lock_irqsave(&ratelimit_lock, flags);
+	*target = value;
+	ratelimit_update();
+	spin_unlock_irqrestore(&ratelimit_lock, flags);
+
+	return 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int
+ratelimit_param_get(char *buffer, struct kernel_param *kp)
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+static int
+ratelimit_param_get(char *buffer, const struct kernel_param *kp)
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+{
+	unsigned int *target;
+
+	target = (unsigned int *)kp->arg;
+	if (unlikely(target == NULL))
+		return -EBADF;
+
+	return scnprintf(buffer, PAGE_SIZE, "%u", READ_ONCE(*target));
+}
+
+#if LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36)
+static const struct kernel_param_ops ratelimit_param = {
+	.set = ratelimit_param_set,
+	.get = ratelimit_param_get,
+};
+#endif /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+module_param_call(ratelimit, &ratelimit_param_set, &ratelimit_param_get, &ratelimit_rate, 0600);
+module_param_call(ratelimit_burst, &ratelimit_param_set, &ratelimit_param_get, &ratelimit_burst, 0600);
+#else /* LINUX_VERSION_CODE > KERNEL_VERSION(2, 6, 36) */
+module_param_cb(ratelimit, &ratelimit_param, &ratelimit_rate, 0600);
+module_param_cb(ratelimit_burst, &ratelimit_param, &ratelimit_burst, 0600);
+#endif /* LINUX_VERSION_CODE ? KERNEL_VERSION(2, 6, 36) */
+MODULE_PARM_DESC(ratelimit, "Maximum number of records per second, per uid, per"
+		 " type and per CPU before records are suppressed (0 disables rate limiting)."
+		 " A uid can thus log up to ratelimit times the number of CPUs records per second");
+MODULE_PARM_DESC(ratelimit_burst, "Number of records accepted in a row before"
+		 " the ratelimit applies");
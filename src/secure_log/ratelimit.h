@@ -0,0 +1,46 @@
+#ifndef __SECURE_LOG_RATELIMIT__
+#define __SECURE_LOG_RATELIMIT__
+
+#include <linux/moduleparam.h>
+#include <linux/types.h>
+#include <linux/version.h>
+#include "log.h"
+
+/* Number of per-uid buckets, per CPU and per log type (power of 2) */
+#define RATELIMIT_BITS 6
+#define RATELIMIT_SLOTS (1 << RATELIMIT_BITS)
+
+/* Default number of events allowed in a row before rate limiting kicks in */
+#define RATELIMIT_DEFAULT_BURST 100
+
+/* Events suppressed for a uid, to be reported in a summary record */
+struct ratelimit_summary {
+	uid_t uid   /** UID the suppressed events belonged to */;
+	u32 count   /** Number of suppressed events, 0 if nothing to report */;
+};
+
+/**
+ * Check if an event of the given type from the given uid can be logged.
+ * When a bucket recovers (or is taken over by another uid) while events
+ * were suppressed, 'summary' is filled and must be reported by the caller.
+ */
+bool ratelimit_allow(enum secure_log_type type, uid_t uid,
+		     struct ratelimit_summary *summary);
+
+/**
+ * Implemented by the module: report suppressed records from the worker,
+ * which flushes them every second. Called with interrupts enabled, and no
+ * lock of the rate limiter held.
+ */
+void ratelimit_report(enum secure_log_type type,
+		      const struct ratelimit_summary *summary);
+
+/* Stop the worker, once no record can be stored anymore */
+void ratelimit_destroy(void);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36)
+int ratelimit_param_set(const char *buf, struct kernel_param *kp);
+int ratelimit_param_get(char *buffer, struct kernel_param *kp);
+#endif /* LINUX_VERSION_CODE < KERNEL_VERSION(2, 6, 36) */
+
+#endif /* __SECURE_LOG_RATELIMIT__ */
@@ -0,0 +1,133 @@
+#include <linux/hash.h>
+#include <linux/kdev_t.h>
+#include <linux/kernel.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/tty.h>
+#include "sparse_compat.h"
+#include "tty_name.h"
+#include "tty_names.h"
+
+/*
+ * TTY names, indexed by device number.
+ *
+ * Records only store the device number of the TTY: resolving its name on
+ * every event is comparatively expensive. The names are kept in sets of
+ * TTY_NAMES_WAYS entries, the oldest entry of a full set is replaced: a TTY
+ * seen again after being evicted is learned again from its next event.
+ *
+ * Readers do not take any lock: each entry has a sequence, odd while the
+ * entry is being replaced, and readers copy the name again if it changed.
+ */
+
+struct tty_name_entry {
+	unsigned int seq          /** Sequence, odd while the entry is written */;
+	dev_t dev                 /** Device number, 0 if the entry is free */;
+	char name[TTY_NAME_LEN]   /** Name of the TTY */;
+};
+
+struct tty_names_set {
+	unsigned int next         /** Entry replaced by the next insertion */;
+	struct tty_name_entry entries[TTY_NAMES_WAYS];
+};
+
+static struct tty_names_set tty_names[1 << TTY_NAMES_BITS];
+
+/* Only one insertion at a time */
+static DEFINE_SPINLOCK(tty_names_lock);
+
+static inline struct tty_names_set *
+tty_names_set(dev_t dev)
+{
+	return &tty_names[hash_32((u32)dev, TTY_NAMES_BITS)];
+}
+
+/*
+ * Look 'dev' up, copying its name into 'buffer' (of size TTY_NAME_LEN) if
+ * 'buffer' is not NULL. Returns false if the name is not known.
+ */
+static bool
+tty_names_lookup(dev_t dev, char *buffer)
+{
+	struct tty_names_set *set = tty_names_set(dev);
+	struct tty_name_entry *entry;
+	unsigned int i, seq;
+	bool found;
+
+	for (i = 0; i < TTY_NAMES_WAYS; ++i) {
+		entry = &set->entries[i];
+		do {
+			seq = READ_ONCE(entry->seq);
+			/* Pairs with the second smp_wmb in tty_names_learn */
+			smp_rmb();
+			found = !(seq & 1) && READ_ONCE(entry->dev) == dev;
+			if (found && buffer != NULL)
+				memcpy(buffer, entry->name, TTY_NAME_LEN);
+			/* Pairs with the first smp_wmb in tty_names_learn */
+			smp_rmb();
+		} while ((seq & 1) || READ_ONCE(entry->seq) != seq);
+		if (found)
+			return true;
+	}
+	return false;
+}
+
+void
+tty_names_learn(dev_t dev)
+{
+	struct tty_names_set *set;
+	struct tty_name_entry *entry;
+	struct tty_struct *tty;
+	unsigned long flags;
+	unsigned int i;
+
+	if (dev == 0 || tty_names_lookup(dev, NULL))
+		return;
+
+	/* Get a reference on the TTY, it must still be the one we are learning */
+	tty = get_current_tty();
+	if (tty == NULL)
+		return;
+	if (tty_devnum(tty) != dev)
+		goto put;
+
+	set = tty_names_set(dev);
+	spin_lock_irqsave(&tty_names_lock, flags);
+	if (tty_names_lookup(dev, NULL))
+		goto unlock;
+
+	/* A free entry, or the oldest one */
+	entry = &set->entries[set->next];
+	for (i = 0; i < TTY_NAMES_WAYS; ++i) {
+		if (set->entries[i].dev == 0) {
+			entry = &set->entries[i];
+			break;
+		}
+	}
+	if (i == TTY_NAMES_WAYS)
+		set->next = (set->next + 1) % TTY_NAMES_WAYS;
+
+	WRITE_ONCE(entry->seq, entry->seq + 1);
+	smp_wmb();
+	WRITE_ONCE(entry->dev, dev);
+	copy_tty_name(tty, entry->name);
+	smp_wmb();
+	WRITE_ONCE(entry->seq, entry->seq + 1);
+unlock:
+	spin_unlock_irqrestore(&tty_names_lock, flags);
+put:
+	tty_kref_put(tty);
+}
+
+const char *
+tty_names_get(dev_t dev, char *buffer)
+{
+	if (dev == 0)
+		return null_tty_short;
+
+	if (likely(tty_names_lookup(dev, buffer)))
+		return buffer;
+
+	snprintf(buffer, TTY_NAME_LEN, "%u:%u", MAJOR(dev), MINOR(dev));
+	return buffer;
+}
@@ -0,0 +1,24 @@
+#ifndef __SECURE_LOG_TTY_NAMES__
+#define __SECURE_LOG_TTY_NAMES__
+
+#include <linux/types.h>
+
+/* Number of sets of TTY names (power of 2) */
+#define TTY_NAMES_BITS 6
+
+/* Number of TTY names per set, the oldest one is replaced */
+#define TTY_NAMES_WAYS 4
+
+/**
+ * Remember the name of the TTY of 'current', if it is the one identified by
+ * 'dev'. Cheap when the name is already known.
+ */
+void tty_names_learn(dev_t dev);
+
+/**
+ * Get the name of the TTY identified by 'dev', copied into 'buffer' (of size
+ * TTY_NAME_LEN). Falls back to 'major:minor' if the name is not known.
+ */
+const char *tty_names_get(dev_t dev, char *buffer);
+
+#endif /* __SECURE_LOG_TTY_NAMES__ */
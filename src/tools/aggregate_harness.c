@@ -0,0 +1,201 @@
+/*
+ * Replay a day-to-day load against the aggregation of repeated events
+ * (lib/aggregate.c), compiled in userspace with the stubs of this folder,
+ * and print how many records it saves, and at which cost.
+ *
+ *   aggregate_harness
+ *
+ * The replay lasts one hour, with the worker run every second, like a
+ * server running:
+ * - cron: every minute, 5 jobs running 6 commands 5 times each, in 50 ms;
+ * - a monitoring agent: 2 commands every 10 s;
+ * - a shell loop: every 5 minutes, 1000 runs of the same command in 2 s;
+ * - 1 execution per second with arguments never seen before.
+ * Other loads cycle through 10, 100 and 1000 keys, a table holding 128.
+ *
+ * Every event must be either logged or aggregated, and every aggregated
+ * event reported in one summary: exits with 1 otherwise.
+ */
+
+#include <time.h>
+#include "../lib/aggregate.c"
+
+static unsigned long summaries;
+static unsigned long summarized;
+
+void
+aggregate_report(const struct aggregate_summary *summary)
+{
+	++summaries;
+	summarized += summary->count;
+}
+
+struct harness_result {
+	unsigned long events;
+	unsigned long logged;
+};
+
+/* One execution, the key built like execlog's: uid, path and arguments */
+static void
+harness_exec(struct harness_result *result, unsigned int uid,
+	     const char *path, const char *argv)
+{
+	char key[AGGREGATE_KEY_SIZE];
+	int len;
+
+	len = snprintf(key, sizeof(key), "%u%c%s%c%s", uid, '\0', path, '\0', argv);
+	++result->events;
+	if (!aggregate_event(key, min((size_t)len, sizeof(key)), stub_clock))
+		++result->logged;
+}
+
+static void
+harness_second(struct harness_result *result, unsigned int second)
+{
+	static const char *const jobs[] = { "backup", "logrotate", "certs", "puppet", "stats" };
+	static const char *const commands[] = {
+		"/bin/date", "/usr/bin/find", "/bin/grep", "/usr/bin/awk", "/bin/gzip", "/bin/mv"
+	};
+	char argv[64];
+	u64 start = stub_clock;
+	unsigned int i, j, k;
+
+	if (second % 60 == 0) {
+		for (i = 0; i < 5; ++i) {
+			for (j = 0; j < 6; ++j) {
+				snprintf(argv, sizeof(argv), "--job %s", jobs[i]);
+				for (k = 0; k < 5; ++k) {
+					harness_exec(result, 0, commands[j], argv);
+					stub_clock += 300 * 1000;
+				}
+			}
+		}
+	}
+	if (second % 10 == 0) {
+		harness_exec(result, 998, "/usr/bin/df", "-P");
+		harness_exec(result, 998, "/bin/cat", "/proc/loadavg");
+	}
+	if (second % 300 == 0) {
+		for (i = 0; i < 1000; ++i) {
+			harness_exec(result, 1000, "/bin/true", "");
+			stub_clock += 2 * NSEC_PER_MSEC;
+		}
+	}
+	snprintf(argv, sizeof(argv), "https://example.org/?id=%u", second);
+	harness_exec(result, 1000, "/usr/bin/curl", argv);
+
+	stub_clock = start + NSEC_PER_SEC;
+	stub_run_work(&aggregate_work);
+}
+
+/* 'keys' distinct keys, 'events' events in all, one every 100 us */
+static void
+harness_cycle(struct harness_result *result, unsigned int keys, unsigned long events)
+{
+	char argv[32];
+	unsigned long i;
+
+	for (i = 0; i < events; ++i) {
+		snprintf(argv, sizeof(argv), "%lu", i % keys);
+		harness_exec(result, 1000, "/usr/bin/make", argv);
+		stub_clock += 100 * 1000;
+		if (i % 10000 == 9999)
+			stub_run_work(&aggregate_work);
+	}
+}
+
+static double
+harness_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Time of aggregate_event for 'keys' keys cycled through */
+static double
+harness_cost(const char *window, unsigned int keys)
+{
+	static char key[1000][64];
+	unsigned long i, calls = 10000000;
+	double start;
+
+	for (i = 0; i < keys; ++i)
+		snprintf(key[i], sizeof(key[i]), "1000%c/usr/bin/make%c%lu", '\0', '\0', i);
+	if (stub_param_set(aggregate_window, window) != 0)
+		return 0;
+	start = harness_now();
+	for (i = 0; i < calls; ++i) {
+		stub_clock += 1000;
+		aggregate_event(key[i % keys], sizeof(key[0]), stub_clock);
+	}
+	start = (harness_now() - start) / calls;
+	aggregate_destroy();
+	return start;
+}
+
+static int
+harness_replay(const char *name, const char *window, unsigned int keys)
+{
+	struct harness_result result = { 0, 0 };
+	unsigned long records;
+	unsigned int second;
+
+	memset(&aggregate_stats, 0, sizeof(aggregate_stats));
+	summaries = 0;
+	summarized = 0;
+	if (stub_param_set(aggregate_window, window) != 0)
+		return 1;
+	stub_run_work(&aggregate_work);
+
+	if (keys == 0) {
+		for (second = 0; second < 3600; ++second)
+			harness_second(&result, second);
+	} else {
+		harness_cycle(&result, keys, 1000000);
+	}
+	aggregate_destroy();
+
+	records = result.logged + summaries;
+	printf("%-10s %6s %8lu %7lu %10lu %9lu %9lu %7lu %5.1f%%\n",
+	       name, window, result.events, result.logged, aggregate_stats.aggregated,
+	       summaries, aggregate_stats.evictions, records,
+	       100.0 - 100.0 * records / result.events);
+
+	if (result.logged + aggregate_stats.aggregated != result.events ||
+	    summarized != aggregate_stats.aggregated ||
+	    summaries != aggregate_stats.summaries) {
+		printf("Events lost: %lu logged, %lu aggregated, %lu summarized\n",
+		       result.logged, aggregate_stats.aggregated, summarized);
+		return 1;
+	}
+	return 0;
+}
+
+int
+main(void)
+{
+	int ret = 0;
+
+	stub_clock = NSEC_PER_SEC;
+	printf("Table of a CPU: %zu bytes, %u entries\n\n",
+	       sizeof(struct aggregate_table), (1 << AGGREGATE_BITS) * AGGREGATE_WAYS);
+	printf("load       window   events  logged aggregated summaries evictions records  saved\n");
+	ret |= harness_replay("server", "100", 0);
+	ret |= harness_replay("server", "1000", 0);
+	ret |= harness_replay("server", "5000", 0);
+	ret |= harness_replay("server", "60000", 0);
+	ret |= harness_replay("cycle 10", "1000", 10);
+	ret |= harness_replay("cycle 100", "1000", 100);
+	ret |= harness_replay("cycle 1000", "1000", 1000);
+
+	if (ret != 0)
+		return 1;
+	printf("\nEvery event logged or summarized\n\n");
+
+	printf("aggregate_event, key of 64 bytes: %.1f ns repeated, %.1f ns evicting,"
+	       " %.1f ns disabled\n", harness_cost("1000", 10), harness_cost("1000", 1000),
+	       harness_cost("0", 10));
+	return 0;
+}
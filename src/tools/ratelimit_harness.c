@@ -0,0 +1,136 @@
+/*
+ * Check the per-uid rate limiting of secure_log (ratelimit.c), compiled in
+ * userspace with the stubs of this folder, and time ratelimit_allow.
+ *
+ *   ratelimit_harness
+ *
+ * Exits with 1 if a check fails.
+ */
+
+#include <time.h>
+#include "../secure_log/ratelimit.c"
+
+static unsigned long reported;
+static unsigned int failures;
+
+void
+ratelimit_report(enum secure_log_type type,
+		 const struct ratelimit_summary *summary)
+{
+	reported += summary->count;
+}
+
+#define harness_check(cond)						\
+	do {								\
+		if (!(cond)) {						\
+			printf("Failed line %d: %s\n", __LINE__, #cond);	\
+			++failures;					\
+		}							\
+	} while (0)
+
+/* Offer 'count' events of 'uid', one every 'step' ns, return those allowed */
+static unsigned long
+harness_offer(uid_t uid, unsigned long count, u64 step)
+{
+	struct ratelimit_summary summary;
+	unsigned long allowed = 0;
+	unsigned long i;
+
+	for (i = 0; i < count; ++i) {
+		if (ratelimit_allow(LOG_EXECUTION, uid, &summary))
+			++allowed;
+		reported += summary.count;
+		stub_clock += step;
+	}
+	return allowed;
+}
+
+/* Another uid sharing the bucket of 'uid' */
+static uid_t
+harness_same_bucket(uid_t uid)
+{
+	uid_t other;
+
+	for (other = uid + 1; hash_32(other, RATELIMIT_BITS) != hash_32(uid, RATELIMIT_BITS); ++other)
+		;
+	return other;
+}
+
+static double
+harness_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+int
+main(void)
+{
+	struct ratelimit_summary summary;
+	unsigned long allowed, i, calls = 10000000;
+	uid_t other;
+	double start;
+
+	stub_clock = NSEC_PER_SEC;
+
+	/* Disabled by default */
+	harness_check(harness_offer(1000, 1000, 0) == 1000);
+	harness_check(stub_param_set(ratelimit_burst, "0") == -EINVAL);
+
+	/* 10 events/s, burst 5: the burst at once, then one per 100 ms */
+	harness_check(stub_param_set(ratelimit, "10") == 0);
+	harness_check(stub_param_set(ratelimit_burst, "5") == 0);
+	harness_check(harness_offer(1000, 20, 0) == 5);
+	stub_clock += 100 * NSEC_PER_MSEC;
+	reported = 0;
+	harness_check(ratelimit_allow(LOG_EXECUTION, 1000, &summary));
+	harness_check(summary.uid == 1000 && summary.count == 15);
+
+	/* Over 10 s at 1000 events/s, about 10 per second get through */
+	stub_clock += 10 * NSEC_PER_SEC;
+	allowed = harness_offer(1001, 10000, NSEC_PER_MSEC);
+	printf("10000 events over 10 s at 10/s, burst 5: %lu allowed\n", allowed);
+	harness_check(allowed >= 100 && allowed <= 106);
+
+	/* Alternating with a uid of the same bucket does not reset its budget */
+	stub_clock += 10 * NSEC_PER_SEC;
+	other = harness_same_bucket(1002);
+	allowed = harness_offer(1002, 5, 0);
+	for (i = 0; i < 10; ++i) {
+		allowed += harness_offer(other, 1, 0);
+		allowed += harness_offer(1002, 1, 0);
+	}
+	printf("uids %u and %u sharing a bucket, 25 events at once: %lu allowed\n",
+	       1002, (unsigned int)other, allowed);
+	harness_check(allowed == 5);
+
+	/* The worker reports every suppressed event, allowed ones excluded */
+	stub_clock += 10 * NSEC_PER_SEC;
+	stub_run_work(&ratelimit_work);
+	reported = 0;
+	allowed = harness_offer(1003, 100, 0);
+	harness_check(stub_run_work(&ratelimit_work));
+	harness_check(allowed + reported == 100);
+	reported = 0;
+	harness_check(stub_run_work(&ratelimit_work));
+	harness_check(reported == 0);
+
+	/* Cost of the fast path, an allowed event of a known uid */
+	harness_check(stub_param_set(ratelimit, "1000000000") == 0);
+	start = harness_now();
+	for (i = 0; i < calls; ++i) {
+		stub_clock += 10;
+		ratelimit_allow(LOG_EXECUTION, (uid_t)(i & 0xff), &summary);
+	}
+	printf("ratelimit_allow: %.1f ns\n", (harness_now() - start) / calls);
+
+	ratelimit_destroy();
+	harness_check(!stub_run_work(&ratelimit_work));
+
+	if (failures != 0)
+		return 1;
+	printf("All checks passed\n");
+	return 0;
+}
@@ -0,0 +1,295 @@
+#ifndef __TOOLS_STUBS__
+#define __TOOLS_STUBS__
+
+/*
+ * Just enough of the kernel API to compile the logic of some module files in
+ * userspace, for the harnesses of this folder. Everything runs on one CPU,
+ * in one thread: locks do nothing, per CPU variables are plain variables,
+ * and delayed works only run when the harness calls stub_run_work.
+ * The clock is set by the harness (stub_clock).
+ */
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+
+#define KERNEL_VERSION(a, b, c) (((a) << 16) + ((b) << 8) + (c))
+#ifndef LINUX_VERSION_CODE
+#define LINUX_VERSION_CODE KERNEL_VERSION(5, 10, 0)
+#endif
+
+#ifndef MODULE_NAME
+#define MODULE_NAME "harness"
+#endif
+
+typedef uint8_t u8;
+typedef uint16_t u16;
+typedef uint32_t u32;
+typedef uint64_t u64;
+typedef int64_t s64;
+
+#define U32_MAX UINT32_MAX
+
+#define likely(x) __builtin_expect(!!(x), 1)
+#define unlikely(x) __builtin_expect(!!(x), 0)
+#define __percpu
+#define __must_hold(x)
+
+#define READ_ONCE(x) (*(volatile __typeof__(x) *)&(x))
+#define WRITE_ONCE(x, val) (*(volatile __typeof__(x) *)&(x) = (val))
+#define smp_rmb() __sync_synchronize()
+#define smp_wmb() __sync_synchronize()
+
+#define min(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a < _b ? _a : _b; })
+#define max(a, b) ({ __typeof__(a) _a = (a); __typeof__(b) _b = (b); _a > _b ? _a : _b; })
+
+#ifndef pr_fmt
+#define pr_fmt(fmt) fmt
+#endif
+#define pr_err(fmt, ...) fprintf(stderr, pr_fmt(fmt), ##__VA_ARGS__)
+#define pr_info(fmt, ...) do { if (stub_verbose) fprintf(stderr, pr_fmt(fmt), ##__VA_ARGS__); } while (0)
+
+/* Print pr_info messages */
+static bool stub_verbose __attribute__((unused));
+
+/* Time returned by local_clock, in ns */
+static u64 stub_clock __attribute__((unused));
+
+#define NSEC_PER_MSEC 1000000ULL
+#define NSEC_PER_SEC 1000000000ULL
+#define HZ 1000
+#define PAGE_SIZE 4096
+
+static inline u64
+local_clock(void)
+{
+	return stub_clock;
+}
+
+static inline unsigned long
+msecs_to_jiffies(unsigned int ms)
+{
+	return ms;
+}
+
+static inline u64
+div_u64(u64 dividend, u32 divisor)
+{
+	return dividend / divisor;
+}
+
+/* Memory */
+#define GFP_KERNEL 0
+#define kmalloc(size, flags) malloc(size)
+#define kfree(ptr) free((void *)(ptr))
+#define vmalloc(size) malloc(size)
+#define vfree(ptr) free((void *)(ptr))
+
+#define ERR_PTR(err) ((void *)(long)(err))
+#define PTR_ERR(ptr) ((long)(ptr))
+#define IS_ERR(ptr) ((unsigned long)(ptr) >= (unsigned long)-4095)
+
+static inline void
+sort(void *base, size_t num, size_t size,
+     int (*cmp)(const void *, const void *), void *swap)
+{
+	qsort(base, num, size, cmp);
+}
+
+/* Locks */
+typedef struct { int unused; } spinlock_t;
+#define DEFINE_SPINLOCK(name) spinlock_t name
+#define spin_lock_init(lock) ((void)(lock))
+#define spin_lock(lock) ((void)(lock))
+#define spin_unlock(lock) ((void)(lock))
+#define spin_lock_irqsave(lock, flags) ((void)(lock), (flags) = 0)
+#define spin_unlock_irqrestore(lock, flags) ((void)(lock), (void)(flags))
+#define local_irq_save(flags) ((flags) = 0)
+#define local_irq_restore(flags) ((void)(flags))
+
+struct mutex { int unused; };
+#define DEFINE_MUTEX(name) struct mutex name
+#define mutex_lock(lock) ((void)(lock))
+#define mutex_unlock(lock) ((void)(lock))
+
+#define cond_resched() do { } while (0)
+
+/* Per CPU variables, one CPU */
+#define DEFINE_PER_CPU(type, name) type name
+#define this_cpu_ptr(ptr) (ptr)
+#define this_cpu_read(var) (var)
+#define this_cpu_inc(var) ((var)++)
+#define per_cpu(var, cpu) (*((void)(cpu), &(var)))
+#define per_cpu_ptr(ptr, cpu) ((void)(cpu), (ptr))
+#define for_each_possible_cpu(cpu) for ((cpu) = 0; (cpu) < 1; ++(cpu))
+
+/* Delayed works, run by the harness */
+struct work_struct { int unused; };
+struct delayed_work {
+	struct work_struct work;
+	void (*fn)(struct work_struct *work);
+	bool pending;
+	unsigned long delay;
+};
+#define DECLARE_DELAYED_WORK(name, func) struct delayed_work name = { .fn = (func) }
+
+static inline bool
+schedule_delayed_work(struct delayed_work *dwork, unsigned long delay)
+{
+	dwork->delay = delay;
+	if (dwork->pending)
+		return false;
+	dwork->pending = true;
+	return true;
+}
+
+static inline bool
+cancel_delayed_work_sync(struct delayed_work *dwork)
+{
+	bool pending = dwork->pending;
+
+	dwork->pending = false;
+	return pending;
+}
+
+/* Run a delayed work if it is queued, whatever its delay */
+static inline bool
+stub_run_work(struct delayed_work *dwork)
+{
+	if (!dwork->pending)
+		return false;
+	dwork->pending = false;
+	dwork->fn(&dwork->work);
+	return true;
+}
+
+/* Hashes, as in the kernel */
+#define GOLDEN_RATIO_32 0x61C88647
+
+static inline u32
+hash_32(u32 val, unsigned int bits)
+{
+	return (val * GOLDEN_RATIO_32) >> (32 - bits);
+}
+
+static inline u32
+rol32(u32 word, unsigned int shift)
+{
+	return (word << (shift & 31)) | (word >> ((-shift) & 31));
+}
+
+#define __jhash_mix(a, b, c)			\
+{						\
+	a -= c;  a ^= rol32(c, 4);  c += b;	\
+	b -= a;  b ^= rol32(a, 6);  a += c;	\
+	c -= b;  c ^= rol32(b, 8);  b += a;	\
+	a -= c;  a ^= rol32(c, 16); c += b;	\
+	b -= a;  b ^= rol32(a, 19); a += c;	\
+	c -= b;  c ^= rol32(b, 4);  b += a;	\
+}
+
+#define __jhash_final(a, b, c)			\
+{						\
+	c ^= b; c -= rol32(b, 14);		\
+	a ^= c; a -= rol32(c, 11);		\
+	b ^= a; b -= rol32(a, 25);		\
+	c ^= b; c -= rol32(b, 16);		\
+	a ^= c; a -= rol32(c, 4);		\
+	b ^= a; b -= rol32(a, 14);		\
+	c ^= b; c -= rol32(b, 24);		\
+}
+
+#define JHASH_INITVAL 0xdeadbeef
+
+static inline u32
+jhash_get32(const u8 *k)
+{
+	u32 value;
+
+	memcpy(&value, k, sizeof(value));
+	return value;
+}
+
+static inline u32
+jhash(const void *key, u32 length, u32 initval)
+{
+	u32 a, b, c;
+	const u8 *k = key;
+
+	a = b = c = JHASH_INITVAL + length + initval;
+	while (length > 12) {
+		a += jhash_get32(k);
+		b += jhash_get32(k + 4);
+		c += jhash_get32(k + 8);
+		__jhash_mix(a, b, c);
+		length -= 12;
+		k += 12;
+	}
+	switch (length) {
+	case 12: c += (u32)k[11] << 24; /* fall through */
+	case 11: c += (u32)k[10] << 16; /* fall through */
+	case 10: c += (u32)k[9] << 8;   /* fall through */
+	case 9:  c += k[8];             /* fall through */
+	case 8:  b += (u32)k[7] << 24;  /* fall through */
+	case 7:  b += (u32)k[6] << 16;  /* fall through */
+	case 6:  b += (u32)k[5] << 8;   /* fall through */
+	case 5:  b += k[4];             /* fall through */
+	case 4:  a += (u32)k[3] << 24;  /* fall through */
+	case 3:  a += (u32)k[2] << 16;  /* fall through */
+	case 2:  a += (u32)k[1] << 8;   /* fall through */
+	case 1:  a += k[0];
+		 __jhash_final(a, b, c);
+		 break;
+	case 0:
+		 break;
+	}
+	return c;
+}
+
+/* Strings */
+static inline int
+kstrtouint(const char *s, unsigned int base, unsigned int *res)
+{
+	unsigned long value;
+	char *end;
+
+	errno = 0;
+	value = strtoul(s, &end, base);
+	if (end == s || (*end != '\0' && *end != '\n') || *s == '-')
+		return -EINVAL;
+	if (errno != 0 || value > UINT32_MAX)
+		return -ERANGE;
+	*res = (unsigned int)value;
+	return 0;
+}
+
+#define scnprintf(buf, size, fmt, ...)					\
+	({ int _n = snprintf(buf, size, fmt, ##__VA_ARGS__);		\
+	   (_n >= (int)(size)) ? (int)(size) - 1 : _n; })
+
+/* Module parameters: their ops can be called through __param_<name> */
+struct kernel_param;
+struct kernel_param_ops {
+	int (*set)(const char *val, const struct kernel_param *kp);
+	int (*get)(char *buffer, const struct kernel_param *kp);
+};
+struct kernel_param {
+	const char *name;
+	const struct kernel_param_ops *ops;
+	void *arg;
+};
+#define module_param_cb(name, param_ops, param_arg, perm)		\
+	static const struct kernel_param __param_##name __attribute__((unused)) = \
+		{ #name, param_ops, param_arg }
+#define MODULE_PARM_DESC(name, desc)					\
+	static const char __param_desc_##name[] __attribute__((unused)) = desc
+
+/* Set a module parameter through its ops, as a write to /sys/module would */
+#define stub_param_set(name, val) (__param_##name.ops->set(val, &__param_##name))
+
+#endif /* __TOOLS_STUBS__ */
@@ -0,0 +1,306 @@
+/*
+ * Compile a netlog or execlog whitelist, in the syntax of the 'whitelist'
+ * module parameter (rules separated by ',' or new lines), into the binary
+ * format loaded by /dev/<module>_whitelist.
+ *
+ *   whitelist_compiler netlog|execlog [input [output]]
+ *
+ * Invalid rules are reported and nothing is written. Duplicates are removed.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "../lib/whitelist_blob.h"
+
+/* Same limits as the modules */
+#define MAX_EXEC_PATH 950
+#define FIELD_SEPARATOR '|'
+
+struct record {
+	size_t size  /** Size of the record, padding included */;
+	char *data   /** The record itself */;
+};
+
+static struct record *records;
+static size_t nr_records;
+static size_t max_records;
+
+static size_t
+record_size(size_t size)
+{
+	return (size + WHITELIST_BLOB_ALIGN - 1) & ~((size_t)WHITELIST_BLOB_ALIGN - 1);
+}
+
+/* New zeroed record of 'size' bytes (before padding) */
+static void *
+record_new(size_t size)
+{
+	struct record *record;
+
+	if (nr_records == max_records) {
+		max_records = (max_records == 0) ? 1024 : 2 * max_records;
+		records = realloc(records, max_records * sizeof(*records));
+		if (records == NULL) {
+			perror("realloc");
+			exit(EXIT_FAILURE);
+		}
+	}
+	record = &records[nr_records++];
+	record->size = record_size(size);
+	record->data = calloc(1, record->size);
+	if (record->data == NULL) {
+		perror("calloc");
+		exit(EXIT_FAILURE);
+	}
+	*(__u32 *)record->data = (__u32)record->size;
+	return record->data;
+}
+
+static void
+mask_ip(__u8 *raw, unsigned int prefix_len)
+{
+	unsigned int i;
+
+	for (i = prefix_len; i < 16 * 8; ++i)
+		raw[i >> 3] &= (__u8)~(0x80 >> (i & 7));
+}
+
+/* Parse 'path|i<ip[/prefix]>|p<port>', the address and port being optional */
+static int
+parse_netlog(char *rule)
+{
+	struct whitelist_blob_netlog *blob;
+	__u8 ip[16];
+	char *pos, *end, *prefix;
+	unsigned long value;
+	unsigned int family = 0, prefix_len = 0, max_prefix;
+	unsigned int port = 0;
+	size_t path_len;
+	char type;
+
+	memset(ip, 0, sizeof(ip));
+	pos = strchr(rule, FIELD_SEPARATOR);
+	path_len = (pos == NULL) ? strlen(rule) : (size_t)(pos - rule);
+	if (path_len == 0 || path_len >= MAX_EXEC_PATH)
+		return -1;
+
+	while (pos != NULL) {
+		*pos = '\0';
+		type = pos[1];
+		if (type == '\0')
+			return -1;
+		pos += 2;
+		if (*pos == '<')
+			++pos;
+		end = strchr(pos, FIELD_SEPARATOR);
+		if (end != NULL)
+			*end = '\0';
+		if (*pos != '\0' && pos[strlen(pos) - 1] == '>')
+			pos[strlen(pos) - 1] = '\0';
+		if (*pos == '\0')
+			return -1;
+
+		switch (type) {
+		case 'i':
+			prefix = strchr(pos, '/');
+			if (prefix != NULL)
+				*prefix++ = '\0';
+			if (inet_pton(AF_INET, pos, ip) == 1) {
+				family = 4;
+				max_prefix = 32;
+			} else if (inet_pton(AF_INET6, pos, ip) == 1) {
+				family = 6;
+				max_prefix = 128;
+			} else {
+				return -1;
+			}
+			prefix_len = max_prefix;
+			if (prefix != NULL) {
+				errno = 0;
+				value = strtoul(prefix, &prefix, 10);
+				if (errno != 0 || *prefix != '\0' || value > max_prefix)
+					return -1;
+				prefix_len = (unsigned int)value;
+				mask_ip(ip, prefix_len);
+			}
+			break;
+		case 'p':
+			errno = 0;
+			value = strtoul(pos, &prefix, 0);
+			if (errno != 0 || *prefix != '\0' || value < 1 || value > 65535)
+				return -1;
+			port = (unsigned int)value;
+			break;
+		default:
+			return -1;
+		}
+		pos = end;
+	}
+
+	blob = record_new(sizeof(*blob) + path_len);
+	blob->path_len = (__u16)path_len;
+	blob->port = (__u16)port;
+	blob->family = (__u8)family;
+	blob->prefix_len = (__u8)prefix_len;
+	memcpy(blob->ip, ip, sizeof(ip));
+	memcpy(blob->path, rule, path_len);
+	return 0;
+}
+
+/* Parse 'filename|argv start', the argv start being optional */
+static int
+parse_execlog(char *rule)
+{
+	struct whitelist_blob_execlog *blob;
+	size_t filename_len, argv_start_len = 0;
+	char *separator;
+
+	separator = strchr(rule, FIELD_SEPARATOR);
+	if (separator == NULL) {
+		filename_len = strlen(rule);
+	} else {
+		filename_len = (size_t)(separator - rule);
+		argv_start_len = strlen(separator + 1);
+	}
+	if (filename_len == 0 || filename_len >= MAX_EXEC_PATH ||
+	    argv_start_len > 0xffff)
+		return -1;
+
+	blob = record_new(sizeof(*blob) + filename_len + argv_start_len);
+	blob->filename_len = (__u16)filename_len;
+	blob->argv_start_len = (__u16)argv_start_len;
+	memcpy(blob->data, rule, filename_len);
+	if (argv_start_len > 0)
+		memcpy(blob->data + filename_len, separator + 1, argv_start_len);
+	return 0;
+}
+
+static int
+record_cmp(const void *a, const void *b)
+{
+	const struct record *record_a = a;
+	const struct record *record_b = b;
+
+	if (record_a->size != record_b->size)
+		return (record_a->size < record_b->size) ? -1 : 1;
+	return memcmp(record_a->data, record_b->data, record_a->size);
+}
+
+static char *
+read_all(FILE *input)
+{
+	size_t len = 0, size = 4096, ret;
+	char *buf = malloc(size);
+
+	while (buf != NULL) {
+		ret = fread(buf + len, 1, size - len - 1, input);
+		len += ret;
+		if (ret == 0)
+			break;
+		if (len + 1 == size) {
+			size *= 2;
+			buf = realloc(buf, size);
+		}
+	}
+	if (buf == NULL || ferror(input)) {
+		perror("read");
+		exit(EXIT_FAILURE);
+	}
+	buf[len] = '\0';
+	return buf;
+}
+
+int
+main(int argc, char **argv)
+{
+	struct whitelist_blob_header header;
+	int (*parse)(char *rule);
+	FILE *input = stdin;
+	FILE *output = stdout;
+	char *buf, *pos, *rule, *copy;
+	size_t i, kept;
+	int errors = 0;
+
+	if (argc < 2 || argc > 4) {
+		fprintf(stderr, "Usage: %s netlog|execlog [input [output]]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	memset(&header, 0, sizeof(header));
+	header.magic = WHITELIST_BLOB_MAGIC;
+	header.version = WHITELIST_BLOB_VERSION;
+	if (strcmp(argv[1], "netlog") == 0) {
+		header.type = WHITELIST_BLOB_NETLOG;
+		parse = parse_netlog;
+	} else if (strcmp(argv[1], "execlog") == 0) {
+		header.type = WHITELIST_BLOB_EXECLOG;
+		parse = parse_execlog;
+	} else {
+		fprintf(stderr, "Unknown module %s\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	if (argc > 2 && strcmp(argv[2], "-") != 0) {
+		input = fopen(argv[2], "r");
+		if (input == NULL) {
+			perror(argv[2]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	buf = read_all(input);
+	pos = buf;
+	while ((rule = strsep(&pos, ",\n")) != NULL) {
+		if (*rule == '\0')
+			continue;
+		copy = strdup(rule);
+		if (copy == NULL) {
+			perror("strdup");
+			return EXIT_FAILURE;
+		}
+		if (parse(copy) != 0) {
+			fprintf(stderr, "Invalid rule: %s\n", rule);
+			++errors;
+		}
+		free(copy);
+	}
+	if (errors > 0)
+		return EXIT_FAILURE;
+
+	/* Remove duplicates */
+	if (nr_records > 0)
+		qsort(records, nr_records, sizeof(*records), record_cmp);
+	kept = 0;
+	for (i = 0; i < nr_records; ++i) {
+		if (kept > 0 && record_cmp(&records[kept - 1], &records[i]) == 0) {
+			free(records[i].data);
+			continue;
+		}
+		records[kept++] = records[i];
+	}
+	header.count = (__u32)kept;
+
+	if (argc > 3 && strcmp(argv[3], "-") != 0) {
+		output = fopen(argv[3], "w");
+		if (output == NULL) {
+			perror(argv[3]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (fwrite(&header, sizeof(header), 1, output) != 1)
+		goto write_error;
+	for (i = 0; i < kept; ++i)
+		if (fwrite(records[i].data, records[i].size, 1, output) != 1)
+			goto write_error;
+	if (fclose(output) != 0)
+		goto write_error;
+	return EXIT_SUCCESS;
+
+write_error:
+	perror("write");
+	return EXIT_FAILURE;
+}
@@ -0,0 +1,235 @@
+/*
+ * Check and time the matching of execlog argv starts (whitelist_match.c),
+ * compiled in userspace with the stubs of this folder.
+ *
+ *   whitelist_match_harness [lookups]
+ *
+ * For several numbers of rules of one executable, the rules are compiled
+ * both ways (compared in turn, and in a byte trie), every answer is checked
+ * against a plain scan of the rules, and the time of a lookup is printed.
+ * Exits with 1 on a wrong answer.
+ */
+
+#include <time.h>
+
+/* Chosen at run time, to build both forms whatever the number of rules */
+static size_t harness_trie_min_rules;
+#define WHITE_TRIE_MIN_RULES harness_trie_min_rules
+
+#include "../execlog/whitelist_match.h"
+
+static void *
+white_alloc(size_t size)
+{
+	return malloc(size);
+}
+
+static void
+white_free(const void *ptr)
+{
+	free((void *)ptr);
+}
+
+#include "../execlog/whitelist_match.c"
+
+#define MAX_ARGV_START 24
+#define NR_QUERIES 1024
+
+static unsigned int seed = 1;
+
+static unsigned int
+harness_rand(void)
+{
+	seed = seed * 1103515245 + 12345;
+	return (seed >> 16) & 0x7fff;
+}
+
+static struct white_process *
+harness_row(const char *argv_start, size_t len)
+{
+	struct white_process *row;
+
+	row = calloc(1, sizeof(*row) + sizeof("/usr/bin/prog") + len + 1);
+	if (row == NULL)
+		exit(2);
+	strcpy(row->data, "/usr/bin/prog");
+	row->filename_len = strlen(row->data);
+	memcpy(ARGV_START(row), argv_start, len);
+	row->argv_start_len = len;
+	return row;
+}
+
+/* Argv start looking like real ones: words separated by NUL bytes */
+static size_t
+harness_argv(char *buf, size_t min_len)
+{
+	static const char chars[] = "abcdefghijklmnopqrstuvwxyz-/.";
+	size_t len = min_len + harness_rand() % (MAX_ARGV_START - min_len);
+	size_t i;
+
+	for (i = 0; i < len; ++i)
+		buf[i] = (harness_rand() % 6 == 0) ? '\0' : chars[harness_rand() % (sizeof(chars) - 1)];
+	return len;
+}
+
+/* Reference: some rule has an argv start which starts the query */
+static bool
+harness_expected(const struct white_process *rows, const char *argv, size_t size)
+{
+	const struct white_process *row;
+
+	for (row = rows; row != NULL; row = row->next)
+		if (row->argv_start_len <= size &&
+		    memcmp(ARGV_START(row), argv, row->argv_start_len) == 0)
+			return true;
+	return false;
+}
+
+static bool
+harness_correct(const struct white_process *found, const struct white_process *rows,
+		const char *argv, size_t size)
+{
+	if (found == NULL)
+		return !harness_expected(rows, argv, size);
+	return found->argv_start_len <= size &&
+	       memcmp(ARGV_START(found), argv, found->argv_start_len) == 0;
+}
+
+static double
+harness_now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* Check every query, then return the time of a lookup in ns */
+static double
+harness_run(const struct white_match *match, const struct white_process *rows,
+	    char (*queries)[MAX_ARGV_START * 2], const size_t *sizes,
+	    unsigned long lookups, unsigned long *errors)
+{
+	struct white_query query;
+	const struct white_process *found;
+	unsigned long i, hits = 0;
+	double start;
+
+	query.argv_needed = NULL;
+	for (i = 0; i < NR_QUERIES; ++i) {
+		query.argv_start = queries[i];
+		query.argv_size = sizes[i];
+		found = white_match_check(match, &query);
+		if (!harness_correct(found, rows, queries[i], sizes[i]))
+			++*errors;
+	}
+
+	start = harness_now();
+	for (i = 0; i < lookups; ++i) {
+		query.argv_start = queries[i % NR_QUERIES];
+		query.argv_size = sizes[i % NR_QUERIES];
+		hits += white_match_check(match, &query) != NULL;
+	}
+	/* Keep the lookups */
+	if (hits == ~0UL)
+		printf("\n");
+	return (harness_now() - start) / lookups;
+}
+
+int
+main(int argc, char *argv[])
+{
+	static const size_t nr_rules[] = { 1, 4, 8, 12, 16, 32, 100, 1000 };
+	static char queries[NR_QUERIES][MAX_ARGV_START * 2];
+	static size_t sizes[NR_QUERIES];
+	struct white_process *rows, *row, *rule[1000];
+	struct white_match *trie, *prefixes;
+	struct white_query query;
+	unsigned long lookups = 1000000;
+	unsigned long errors = 0;
+	size_t argv_needed;
+	char buf[MAX_ARGV_START];
+	size_t i, j, len;
+
+	if (argc > 1)
+		lookups = strtoul(argv[1], NULL, 0);
+	if (lookups == 0)
+		lookups = 1;
+
+	printf("rules  in turn (ns)  trie (ns)\n");
+	for (i = 0; i < sizeof(nr_rules) / sizeof(nr_rules[0]); ++i) {
+		rows = NULL;
+		for (j = 0; j < nr_rules[i]; ++j) {
+			len = harness_argv(buf, 2);
+			rule[j] = harness_row(buf, len);
+			rule[j]->next = rows;
+			rows = rule[j];
+		}
+		/* Half of the queries start with a rule */
+		for (j = 0; j < NR_QUERIES; ++j) {
+			if (j % 2 == 0) {
+				row = rule[harness_rand() % nr_rules[i]];
+				memcpy(queries[j], ARGV_START(row), row->argv_start_len);
+				sizes[j] = row->argv_start_len;
+				sizes[j] += harness_argv(queries[j] + sizes[j], 0);
+			} else {
+				sizes[j] = harness_argv(queries[j], 0);
+			}
+		}
+
+		harness_trie_min_rules = 0;
+		trie = white_match_build(rows);
+		harness_trie_min_rules = (size_t)-1;
+		prefixes = white_match_build(rows);
+		if (IS_ERR(trie) || IS_ERR(prefixes))
+			return 2;
+
+		printf("%5zu  %13.1f  %9.1f\n", nr_rules[i],
+		       harness_run(prefixes, rows, queries, sizes, lookups, &errors),
+		       harness_run(trie, rows, queries, sizes, lookups, &errors));
+
+		/* Without argv, the caller learns how much of it the rules need */
+		argv_needed = 0;
+		query.argv_start = NULL;
+		query.argv_size = 0;
+		query.argv_needed = &argv_needed;
+		if (white_match_check(trie, &query) != NULL ||
+		    white_match_check(prefixes, &query) != NULL ||
+		    argv_needed != trie->max_len)
+			++errors;
+
+		white_match_free(trie);
+		white_match_free(prefixes);
+
+		/* A rule without argv start matches any argv */
+		row = harness_row("", 0);
+		row->next = rows;
+		rows = row;
+		harness_trie_min_rules = 0;
+		trie = white_match_build(rows);
+		harness_trie_min_rules = (size_t)-1;
+		prefixes = white_match_build(rows);
+		if (IS_ERR(trie) || IS_ERR(prefixes))
+			return 2;
+		query.argv_start = "";
+		query.argv_needed = NULL;
+		if (white_match_check(trie, &query) != row ||
+		    white_match_check(prefixes, &query) != row)
+			++errors;
+		white_match_free(trie);
+		white_match_free(prefixes);
+
+		while (rows != NULL) {
+			row = rows->next;
+			free(rows);
+			rows = row;
+		}
+	}
+
+	if (errors != 0) {
+		printf("%lu wrong answers\n", errors);
+		return 1;
+	}
+	printf("All answers checked\n");
+	return 0;
+}